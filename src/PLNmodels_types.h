@@ -0,0 +1,5 @@
+// Included first by RcppExports.cpp (Rcpp::compileAttributes), so that Armadillo is configured as in the other
+// translation units (see arma_backend.h)
+#pragma once
+
+#include "arma_backend.h"
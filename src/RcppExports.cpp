@@ -1,11 +1,62 @@
 // Generated by using Rcpp::compileAttributes() -> do not edit by hand
 // Generator token: 10BE3573-1514-4C36-9D1C-5A225CD40393
 
+#include "PLNmodels_types.h"
 #include <RcppArmadillo.h>
 #include <Rcpp.h>
 
 using namespace Rcpp;
 
+// cpp_test_data
+bool cpp_test_data();
+RcppExport SEXP _PLNmodels_cpp_test_data() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_data());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_lbfgs
+bool cpp_test_lbfgs();
+RcppExport SEXP _PLNmodels_cpp_test_lbfgs() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_lbfgs());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_memory_tracking
+bool cpp_test_memory_tracking();
+RcppExport SEXP _PLNmodels_cpp_test_memory_tracking() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_memory_tracking());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_multistart
+bool cpp_test_multistart();
+RcppExport SEXP _PLNmodels_cpp_test_multistart() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_multistart());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_auto_algorithm_decisions
+Rcpp::CharacterVector cpp_auto_algorithm_decisions();
+RcppExport SEXP _PLNmodels_cpp_auto_algorithm_decisions() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_auto_algorithm_decisions());
+    return rcpp_result_gen;
+END_RCPP
+}
 // cpp_test_nlopt
 bool cpp_test_nlopt();
 RcppExport SEXP _PLNmodels_cpp_test_nlopt() {
@@ -16,138 +67,163 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// cpp_test_numa
+bool cpp_test_numa();
+RcppExport SEXP _PLNmodels_cpp_test_numa() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_numa());
+    return rcpp_result_gen;
+END_RCPP
+}
 // cpp_optimize_full
-Rcpp::List cpp_optimize_full(const Rcpp::List& init_parameters, const arma::mat& Y, const arma::mat& X, const arma::mat& O, const arma::vec& w, const Rcpp::List& configuration);
-RcppExport SEXP _PLNmodels_cpp_optimize_full(SEXP init_parametersSEXP, SEXP YSEXP, SEXP XSEXP, SEXP OSEXP, SEXP wSEXP, SEXP configurationSEXP) {
+Rcpp::List cpp_optimize_full(const Rcpp::List& init_parameters, SEXP Y_r, const arma::mat& X, SEXP O_r, const arma::vec& w, const Rcpp::List& configuration);
+RcppExport SEXP _PLNmodels_cpp_optimize_full(SEXP init_parametersSEXP, SEXP Y_rSEXP, SEXP XSEXP, SEXP O_rSEXP, SEXP wSEXP, SEXP configurationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const Rcpp::List& >::type init_parameters(init_parametersSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type Y_r(Y_rSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type O(OSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type O_r(O_rSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type w(wSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List& >::type configuration(configurationSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_optimize_full(init_parameters, Y, X, O, w, configuration));
+    rcpp_result_gen = Rcpp::wrap(cpp_optimize_full(init_parameters, Y_r, X, O_r, w, configuration));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_optimize_spherical
-Rcpp::List cpp_optimize_spherical(const Rcpp::List& init_parameters, const arma::mat& Y, const arma::mat& X, const arma::mat& O, const arma::vec& w, const Rcpp::List& configuration);
-RcppExport SEXP _PLNmodels_cpp_optimize_spherical(SEXP init_parametersSEXP, SEXP YSEXP, SEXP XSEXP, SEXP OSEXP, SEXP wSEXP, SEXP configurationSEXP) {
+Rcpp::List cpp_optimize_spherical(const Rcpp::List& init_parameters, SEXP Y_r, const arma::mat& X, SEXP O_r, const arma::vec& w, const Rcpp::List& configuration);
+RcppExport SEXP _PLNmodels_cpp_optimize_spherical(SEXP init_parametersSEXP, SEXP Y_rSEXP, SEXP XSEXP, SEXP O_rSEXP, SEXP wSEXP, SEXP configurationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const Rcpp::List& >::type init_parameters(init_parametersSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type Y_r(Y_rSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type O(OSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type O_r(O_rSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type w(wSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List& >::type configuration(configurationSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_optimize_spherical(init_parameters, Y, X, O, w, configuration));
+    rcpp_result_gen = Rcpp::wrap(cpp_optimize_spherical(init_parameters, Y_r, X, O_r, w, configuration));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_optimize_diagonal
-Rcpp::List cpp_optimize_diagonal(const Rcpp::List& init_parameters, const arma::mat& Y, const arma::mat& X, const arma::mat& O, const arma::vec& w, const Rcpp::List& configuration);
-RcppExport SEXP _PLNmodels_cpp_optimize_diagonal(SEXP init_parametersSEXP, SEXP YSEXP, SEXP XSEXP, SEXP OSEXP, SEXP wSEXP, SEXP configurationSEXP) {
+Rcpp::List cpp_optimize_diagonal(const Rcpp::List& init_parameters, SEXP Y_r, const arma::mat& X, SEXP O_r, const arma::vec& w, const Rcpp::List& configuration);
+RcppExport SEXP _PLNmodels_cpp_optimize_diagonal(SEXP init_parametersSEXP, SEXP Y_rSEXP, SEXP XSEXP, SEXP O_rSEXP, SEXP wSEXP, SEXP configurationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const Rcpp::List& >::type init_parameters(init_parametersSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type Y_r(Y_rSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type O(OSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type O_r(O_rSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type w(wSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List& >::type configuration(configurationSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_optimize_diagonal(init_parameters, Y, X, O, w, configuration));
+    rcpp_result_gen = Rcpp::wrap(cpp_optimize_diagonal(init_parameters, Y_r, X, O_r, w, configuration));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_optimize_rank
-Rcpp::List cpp_optimize_rank(const Rcpp::List& init_parameters, const arma::mat& Y, const arma::mat& X, const arma::mat& O, const arma::vec& w, const Rcpp::List& configuration);
-RcppExport SEXP _PLNmodels_cpp_optimize_rank(SEXP init_parametersSEXP, SEXP YSEXP, SEXP XSEXP, SEXP OSEXP, SEXP wSEXP, SEXP configurationSEXP) {
+Rcpp::List cpp_optimize_rank(const Rcpp::List& init_parameters, SEXP Y_r, const arma::mat& X, SEXP O_r, const arma::vec& w, const Rcpp::List& configuration);
+RcppExport SEXP _PLNmodels_cpp_optimize_rank(SEXP init_parametersSEXP, SEXP Y_rSEXP, SEXP XSEXP, SEXP O_rSEXP, SEXP wSEXP, SEXP configurationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const Rcpp::List& >::type init_parameters(init_parametersSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type Y_r(Y_rSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type O(OSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type O_r(O_rSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type w(wSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List& >::type configuration(configurationSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_optimize_rank(init_parameters, Y, X, O, w, configuration));
+    rcpp_result_gen = Rcpp::wrap(cpp_optimize_rank(init_parameters, Y_r, X, O_r, w, configuration));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_optimize_sparse
-Rcpp::List cpp_optimize_sparse(const Rcpp::List& init_parameters, const arma::mat& Y, const arma::mat& X, const arma::mat& O, const arma::vec& w, const arma::mat& Omega, const Rcpp::List& configuration);
-RcppExport SEXP _PLNmodels_cpp_optimize_sparse(SEXP init_parametersSEXP, SEXP YSEXP, SEXP XSEXP, SEXP OSEXP, SEXP wSEXP, SEXP OmegaSEXP, SEXP configurationSEXP) {
+Rcpp::List cpp_optimize_sparse(const Rcpp::List& init_parameters, SEXP Y_r, const arma::mat& X, SEXP O_r, const arma::vec& w, const arma::mat& Omega, const Rcpp::List& configuration);
+RcppExport SEXP _PLNmodels_cpp_optimize_sparse(SEXP init_parametersSEXP, SEXP Y_rSEXP, SEXP XSEXP, SEXP O_rSEXP, SEXP wSEXP, SEXP OmegaSEXP, SEXP configurationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const Rcpp::List& >::type init_parameters(init_parametersSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type Y_r(Y_rSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type O(OSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type O_r(O_rSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type w(wSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type Omega(OmegaSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List& >::type configuration(configurationSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_optimize_sparse(init_parameters, Y, X, O, w, Omega, configuration));
+    rcpp_result_gen = Rcpp::wrap(cpp_optimize_sparse(init_parameters, Y_r, X, O_r, w, Omega, configuration));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_memory_estimate
+Rcpp::NumericVector cpp_memory_estimate(double n, double p, double d, double q, const std::string& model);
+RcppExport SEXP _PLNmodels_cpp_memory_estimate(SEXP nSEXP, SEXP pSEXP, SEXP dSEXP, SEXP qSEXP, SEXP modelSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type n(nSEXP);
+    Rcpp::traits::input_parameter< double >::type p(pSEXP);
+    Rcpp::traits::input_parameter< double >::type d(dSEXP);
+    Rcpp::traits::input_parameter< double >::type q(qSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type model(modelSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_memory_estimate(n, p, d, q, model));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_optimize_vestep_full
-Rcpp::List cpp_optimize_vestep_full(const Rcpp::List& init_parameters, const arma::mat& Y, const arma::mat& X, const arma::mat& O, const arma::vec& w, const arma::mat& Theta, const arma::mat& Omega, const Rcpp::List& configuration);
-RcppExport SEXP _PLNmodels_cpp_optimize_vestep_full(SEXP init_parametersSEXP, SEXP YSEXP, SEXP XSEXP, SEXP OSEXP, SEXP wSEXP, SEXP ThetaSEXP, SEXP OmegaSEXP, SEXP configurationSEXP) {
+Rcpp::List cpp_optimize_vestep_full(const Rcpp::List& init_parameters, SEXP Y_r, const arma::mat& X, SEXP O_r, const arma::vec& w, const arma::mat& Theta, const arma::mat& Omega, const Rcpp::List& configuration);
+RcppExport SEXP _PLNmodels_cpp_optimize_vestep_full(SEXP init_parametersSEXP, SEXP Y_rSEXP, SEXP XSEXP, SEXP O_rSEXP, SEXP wSEXP, SEXP ThetaSEXP, SEXP OmegaSEXP, SEXP configurationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const Rcpp::List& >::type init_parameters(init_parametersSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type Y_r(Y_rSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type O(OSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type O_r(O_rSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type w(wSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type Theta(ThetaSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type Omega(OmegaSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List& >::type configuration(configurationSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_optimize_vestep_full(init_parameters, Y, X, O, w, Theta, Omega, configuration));
+    rcpp_result_gen = Rcpp::wrap(cpp_optimize_vestep_full(init_parameters, Y_r, X, O_r, w, Theta, Omega, configuration));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_optimize_vestep_diagonal
-Rcpp::List cpp_optimize_vestep_diagonal(const Rcpp::List& init_parameters, const arma::mat& Y, const arma::mat& X, const arma::mat& O, const arma::vec& w, const arma::mat& Theta, const arma::mat& Omega, const Rcpp::List& configuration);
-RcppExport SEXP _PLNmodels_cpp_optimize_vestep_diagonal(SEXP init_parametersSEXP, SEXP YSEXP, SEXP XSEXP, SEXP OSEXP, SEXP wSEXP, SEXP ThetaSEXP, SEXP OmegaSEXP, SEXP configurationSEXP) {
+Rcpp::List cpp_optimize_vestep_diagonal(const Rcpp::List& init_parameters, SEXP Y_r, const arma::mat& X, SEXP O_r, const arma::vec& w, const arma::mat& Theta, const arma::mat& Omega, const Rcpp::List& configuration);
+RcppExport SEXP _PLNmodels_cpp_optimize_vestep_diagonal(SEXP init_parametersSEXP, SEXP Y_rSEXP, SEXP XSEXP, SEXP O_rSEXP, SEXP wSEXP, SEXP ThetaSEXP, SEXP OmegaSEXP, SEXP configurationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const Rcpp::List& >::type init_parameters(init_parametersSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type Y_r(Y_rSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type O(OSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type O_r(O_rSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type w(wSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type Theta(ThetaSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type Omega(OmegaSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List& >::type configuration(configurationSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_optimize_vestep_diagonal(init_parameters, Y, X, O, w, Theta, Omega, configuration));
+    rcpp_result_gen = Rcpp::wrap(cpp_optimize_vestep_diagonal(init_parameters, Y_r, X, O_r, w, Theta, Omega, configuration));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_optimize_vestep_spherical
-Rcpp::List cpp_optimize_vestep_spherical(const Rcpp::List& init_parameters, const arma::mat& Y, const arma::mat& X, const arma::mat& O, const arma::vec& w, const arma::mat& Theta, const arma::mat& Omega, const Rcpp::List& configuration);
-RcppExport SEXP _PLNmodels_cpp_optimize_vestep_spherical(SEXP init_parametersSEXP, SEXP YSEXP, SEXP XSEXP, SEXP OSEXP, SEXP wSEXP, SEXP ThetaSEXP, SEXP OmegaSEXP, SEXP configurationSEXP) {
+Rcpp::List cpp_optimize_vestep_spherical(const Rcpp::List& init_parameters, SEXP Y_r, const arma::mat& X, SEXP O_r, const arma::vec& w, const arma::mat& Theta, const arma::mat& Omega, const Rcpp::List& configuration);
+RcppExport SEXP _PLNmodels_cpp_optimize_vestep_spherical(SEXP init_parametersSEXP, SEXP Y_rSEXP, SEXP XSEXP, SEXP O_rSEXP, SEXP wSEXP, SEXP ThetaSEXP, SEXP OmegaSEXP, SEXP configurationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const Rcpp::List& >::type init_parameters(init_parametersSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type Y_r(Y_rSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
-    Rcpp::traits::input_parameter< const arma::mat& >::type O(OSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type O_r(O_rSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type w(wSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type Theta(ThetaSEXP);
     Rcpp::traits::input_parameter< const arma::mat& >::type Omega(OmegaSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List& >::type configuration(configurationSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_optimize_vestep_spherical(init_parameters, Y, X, O, w, Theta, Omega, configuration));
+    rcpp_result_gen = Rcpp::wrap(cpp_optimize_vestep_spherical(init_parameters, Y_r, X, O_r, w, Theta, Omega, configuration));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -161,18 +237,229 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// cpp_perf_counters
+Rcpp::DataFrame cpp_perf_counters(bool clear);
+RcppExport SEXP _PLNmodels_cpp_perf_counters(SEXP clearSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type clear(clearSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_perf_counters(clear));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_perf_counters
+bool cpp_test_perf_counters();
+RcppExport SEXP _PLNmodels_cpp_test_perf_counters() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_perf_counters());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_c_api
+bool cpp_test_c_api();
+RcppExport SEXP _PLNmodels_cpp_test_c_api() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_c_api());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_simd_info
+Rcpp::List cpp_simd_info();
+RcppExport SEXP _PLNmodels_cpp_simd_info() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_simd_info());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_simd
+bool cpp_test_simd();
+RcppExport SEXP _PLNmodels_cpp_test_simd() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_simd());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_thread_budget
+Rcpp::List cpp_thread_budget(int nb_tasks, int requested_outer);
+RcppExport SEXP _PLNmodels_cpp_thread_budget(SEXP nb_tasksSEXP, SEXP requested_outerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type nb_tasks(nb_tasksSEXP);
+    Rcpp::traits::input_parameter< int >::type requested_outer(requested_outerSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_thread_budget(nb_tasks, requested_outer));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_set_blas_threads
+int cpp_set_blas_threads(int nb_threads);
+RcppExport SEXP _PLNmodels_cpp_set_blas_threads(SEXP nb_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type nb_threads(nb_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_set_blas_threads(nb_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_thread_budget
+bool cpp_test_thread_budget();
+RcppExport SEXP _PLNmodels_cpp_test_thread_budget() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_thread_budget());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_trace_enable
+bool cpp_trace_enable(bool enabled);
+RcppExport SEXP _PLNmodels_cpp_trace_enable(SEXP enabledSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type enabled(enabledSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_trace_enable(enabled));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_trace_enabled
+bool cpp_trace_enabled();
+RcppExport SEXP _PLNmodels_cpp_trace_enabled() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_trace_enabled());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_trace_now
+double cpp_trace_now();
+RcppExport SEXP _PLNmodels_cpp_trace_now() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_trace_now());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_trace_add
+void cpp_trace_add(std::string name, std::string category, double start);
+RcppExport SEXP _PLNmodels_cpp_trace_add(SEXP nameSEXP, SEXP categorySEXP, SEXP startSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type name(nameSEXP);
+    Rcpp::traits::input_parameter< std::string >::type category(categorySEXP);
+    Rcpp::traits::input_parameter< double >::type start(startSEXP);
+    cpp_trace_add(name, category, start);
+    return R_NilValue;
+END_RCPP
+}
+// cpp_trace_clear
+void cpp_trace_clear();
+RcppExport SEXP _PLNmodels_cpp_trace_clear() {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    cpp_trace_clear();
+    return R_NilValue;
+END_RCPP
+}
+// cpp_trace_events
+Rcpp::List cpp_trace_events();
+RcppExport SEXP _PLNmodels_cpp_trace_events() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_trace_events());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_trace_chrome_json
+std::string cpp_trace_chrome_json();
+RcppExport SEXP _PLNmodels_cpp_trace_chrome_json() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_trace_chrome_json());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_trace
+bool cpp_test_trace();
+RcppExport SEXP _PLNmodels_cpp_test_trace() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_trace());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_ve_coordinate
+bool cpp_test_ve_coordinate();
+RcppExport SEXP _PLNmodels_cpp_test_ve_coordinate() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_ve_coordinate());
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_test_ve_newton
+bool cpp_test_ve_newton();
+RcppExport SEXP _PLNmodels_cpp_test_ve_newton() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(cpp_test_ve_newton());
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
+    {"_PLNmodels_cpp_test_data", (DL_FUNC) &_PLNmodels_cpp_test_data, 0},
+    {"_PLNmodels_cpp_test_lbfgs", (DL_FUNC) &_PLNmodels_cpp_test_lbfgs, 0},
+    {"_PLNmodels_cpp_test_memory_tracking", (DL_FUNC) &_PLNmodels_cpp_test_memory_tracking, 0},
+    {"_PLNmodels_cpp_test_multistart", (DL_FUNC) &_PLNmodels_cpp_test_multistart, 0},
+    {"_PLNmodels_cpp_auto_algorithm_decisions", (DL_FUNC) &_PLNmodels_cpp_auto_algorithm_decisions, 0},
     {"_PLNmodels_cpp_test_nlopt", (DL_FUNC) &_PLNmodels_cpp_test_nlopt, 0},
+    {"_PLNmodels_cpp_test_numa", (DL_FUNC) &_PLNmodels_cpp_test_numa, 0},
     {"_PLNmodels_cpp_optimize_full", (DL_FUNC) &_PLNmodels_cpp_optimize_full, 6},
     {"_PLNmodels_cpp_optimize_spherical", (DL_FUNC) &_PLNmodels_cpp_optimize_spherical, 6},
     {"_PLNmodels_cpp_optimize_diagonal", (DL_FUNC) &_PLNmodels_cpp_optimize_diagonal, 6},
     {"_PLNmodels_cpp_optimize_rank", (DL_FUNC) &_PLNmodels_cpp_optimize_rank, 6},
     {"_PLNmodels_cpp_optimize_sparse", (DL_FUNC) &_PLNmodels_cpp_optimize_sparse, 7},
+    {"_PLNmodels_cpp_memory_estimate", (DL_FUNC) &_PLNmodels_cpp_memory_estimate, 5},
     {"_PLNmodels_cpp_optimize_vestep_full", (DL_FUNC) &_PLNmodels_cpp_optimize_vestep_full, 8},
     {"_PLNmodels_cpp_optimize_vestep_diagonal", (DL_FUNC) &_PLNmodels_cpp_optimize_vestep_diagonal, 8},
     {"_PLNmodels_cpp_optimize_vestep_spherical", (DL_FUNC) &_PLNmodels_cpp_optimize_vestep_spherical, 8},
     {"_PLNmodels_cpp_test_packer", (DL_FUNC) &_PLNmodels_cpp_test_packer, 0},
+    {"_PLNmodels_cpp_perf_counters", (DL_FUNC) &_PLNmodels_cpp_perf_counters, 1},
+    {"_PLNmodels_cpp_test_perf_counters", (DL_FUNC) &_PLNmodels_cpp_test_perf_counters, 0},
+    {"_PLNmodels_cpp_test_c_api", (DL_FUNC) &_PLNmodels_cpp_test_c_api, 0},
+    {"_PLNmodels_cpp_simd_info", (DL_FUNC) &_PLNmodels_cpp_simd_info, 0},
+    {"_PLNmodels_cpp_test_simd", (DL_FUNC) &_PLNmodels_cpp_test_simd, 0},
+    {"_PLNmodels_cpp_thread_budget", (DL_FUNC) &_PLNmodels_cpp_thread_budget, 2},
+    {"_PLNmodels_cpp_set_blas_threads", (DL_FUNC) &_PLNmodels_cpp_set_blas_threads, 1},
+    {"_PLNmodels_cpp_test_thread_budget", (DL_FUNC) &_PLNmodels_cpp_test_thread_budget, 0},
+    {"_PLNmodels_cpp_trace_enable", (DL_FUNC) &_PLNmodels_cpp_trace_enable, 1},
+    {"_PLNmodels_cpp_trace_enabled", (DL_FUNC) &_PLNmodels_cpp_trace_enabled, 0},
+    {"_PLNmodels_cpp_trace_now", (DL_FUNC) &_PLNmodels_cpp_trace_now, 0},
+    {"_PLNmodels_cpp_trace_add", (DL_FUNC) &_PLNmodels_cpp_trace_add, 3},
+    {"_PLNmodels_cpp_trace_clear", (DL_FUNC) &_PLNmodels_cpp_trace_clear, 0},
+    {"_PLNmodels_cpp_trace_events", (DL_FUNC) &_PLNmodels_cpp_trace_events, 0},
+    {"_PLNmodels_cpp_trace_chrome_json", (DL_FUNC) &_PLNmodels_cpp_trace_chrome_json, 0},
+    {"_PLNmodels_cpp_test_trace", (DL_FUNC) &_PLNmodels_cpp_test_trace, 0},
+    {"_PLNmodels_cpp_test_ve_coordinate", (DL_FUNC) &_PLNmodels_cpp_test_ve_coordinate, 0},
+    {"_PLNmodels_cpp_test_ve_newton", (DL_FUNC) &_PLNmodels_cpp_test_ve_newton, 0},
     {NULL, NULL, 0}
 };
 
@@ -0,0 +1,29 @@
+// Armadillo include for the numerical core.
+//
+// The core (data, packer, optimizers, model fits: everything but optimize*.cpp and r_adapter.*) only uses Armadillo,
+// nlopt and the standard library, and reports errors with std exceptions. In the R package Armadillo comes from
+// RcppArmadillo, and Rcpp translates the std exceptions escaping exported functions into R errors.
+// The standalone library (CMakeLists.txt) defines PLNMODELS_STANDALONE and uses a system Armadillo instead. Code only
+// meaningful in R (self tests called from testthat, R utilities) is excluded from it with the same macro.
+//
+// Armadillo allocates matrix storage through the hooks of memory_tracking.cpp. The hooks must be declared before
+// Armadillo is included and used by every translation unit, hence this header is included before any other Armadillo
+// or RcppArmadillo include (RcppExports.cpp includes it through PLNmodels_types.h).
+#pragma once
+
+#ifndef PLNMODELS_NO_MEMORY_TRACKING
+#if defined(ARMA_INCLUDES) && !defined(ARMA_ALIEN_MEM_ALLOC_FUNCTION)
+#error "arma_backend.h must be included before Armadillo"
+#endif
+#include <cstddef> // size_t
+void * plnmodels_tracked_alloc(std::size_t n_bytes);
+void plnmodels_tracked_free(void * memory);
+#define ARMA_ALIEN_MEM_ALLOC_FUNCTION plnmodels_tracked_alloc
+#define ARMA_ALIEN_MEM_FREE_FUNCTION plnmodels_tracked_free
+#endif
+
+#ifdef PLNMODELS_STANDALONE
+#include <armadillo>
+#else
+#include <RcppArmadillo.h>
+#endif
@@ -0,0 +1,122 @@
+#include "data.h"
+#include "r_adapter.h"
+
+#include <stdexcept>
+
+// [[Rcpp::export]]
+bool cpp_test_data() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    const double epsilon = 1e-6;
+
+    // Storage selection from max count
+    auto y = arma::mat{{0., 3., 1.}, {2., 65535., 0.}};
+    auto small = CountMatrix::from_mat(y);
+    check(small.storage() == CountMatrix::Storage::U16, "u16 storage");
+    y(0, 0) = 65536.;
+    auto large = CountMatrix::from_mat(y);
+    check(large.storage() == CountMatrix::Storage::U32, "u32 storage");
+    y(0, 0) = 0.5;
+    auto real = CountMatrix::from_mat(y);
+    check(real.storage() == CountMatrix::Storage::Double, "double storage fallback (non integer)");
+    y(0, 0) = -1.;
+    check(CountMatrix::from_mat(y).storage() == CountMatrix::Storage::Double, "double storage fallback (negative)");
+    CountMatrix empty;
+    check(empty.n_rows == 0 && empty.n_cols == 0 && empty.storage() == CountMatrix::Storage::Double &&
+              empty.to_mat().n_elem == 0,
+          "default constructed");
+    y(0, 0) = 0.;
+    check(arma::approx_equal(small.to_mat(), y, "absdiff", epsilon), "to_mat");
+
+    // Kernels against their dense equivalent
+    auto w = arma::vec{0.5, 2.};
+    auto Z = arma::mat(2, 3, arma::fill::randu);
+    auto Zf = arma::conv_to<arma::fmat>::from(Z);
+    for(const CountMatrix * counts : {&small, &large, &real}) {
+        const arma::mat dense = counts->to_mat();
+        check(arma::approx_equal(counts->subtract_from(Z), Z - dense, "absdiff", epsilon), "subtract_from");
+        check(arma::approx_equal(counts->schur(Z), dense % Z, "absdiff", epsilon), "schur");
+        const double expected = accu(diagmat(w) * (dense % Z));
+        check(std::abs(counts->weighted_dot(w, Z) - expected) < epsilon * std::abs(expected), "weighted_dot");
+        check(std::abs(counts->weighted_dot(w, Zf) - expected) < 1e-5 * std::abs(expected), "weighted_dot float");
+        const arma::mat Zt = Z.t();
+        check(arma::approx_equal(counts->subtract_transposed_from(Zt), (Z - dense).t(), "absdiff", epsilon),
+              "subtract_transposed_from");
+        check(std::abs(counts->weighted_dot_transposed(w, Zt) - expected) < epsilon * std::abs(expected),
+              "weighted_dot_transposed");
+    }
+
+    // Offsets: structured forms against the equivalent dense matrix
+    auto rows = arma::vec{1., -2.};
+    auto cols = arma::rowvec{0.5, 0., 3.};
+    arma::mat dense_rows = arma::repmat(rows, 1, 3);
+    arma::mat dense_both = dense_rows + arma::repmat(cols, 2, 1);
+    // Keep R objects alive (dense double offsets alias R memory), wrap() of arma::vec would produce a (n,1) matrix
+    auto r_dense = Rcpp::NumericMatrix(Rcpp::wrap(dense_both));
+    auto r_rows = Rcpp::NumericVector(rows.begin(), rows.end());
+    auto from_dense = offsets_from_r(r_dense, 2, 3);
+    auto from_rows = offsets_from_r(r_rows, 2, 3);
+    auto from_both = offsets_from_r(Rcpp::List::create(Rcpp::Named("row") = rows, Rcpp::Named("col") = cols), 2, 3);
+    check(arma::approx_equal(from_dense.plus(Z), dense_both + Z, "absdiff", epsilon), "dense offsets");
+    check(arma::approx_equal(from_rows.plus(Z), dense_rows + Z, "absdiff", epsilon), "row offsets");
+    check(arma::approx_equal(from_both.plus(Z), dense_both + Z, "absdiff", epsilon), "row and column offsets");
+    arma::fmat Zf_offset = from_both.convert<float>().plus(Zf);
+    check(arma::approx_equal(arma::conv_to<arma::mat>::from(Zf_offset), dense_both + Z, "absdiff", 1e-5),
+          "float offsets");
+    bool mismatch_detected = false;
+    try {
+        offsets_from_r(r_rows, 3, 3);
+    } catch(const std::invalid_argument &) {
+        mismatch_detected = true;
+    }
+    check(mismatch_detected, "offsets dimension mismatch");
+
+    // Design: one-hot kernels against BLAS products
+    auto X_groups = arma::mat{{0., 1.}, {1., 0.}};
+    auto X_general = arma::mat{{1., 0.5}, {1., 0.}};
+    auto Theta = arma::mat(3, 2, arma::fill::randu);
+    auto Thetaf = arma::conv_to<arma::fmat>::from(Theta);
+    auto categorical = Design<double>(X_groups, w);
+    auto general = Design<double>(X_general, w);
+    check(categorical.is_categorical(), "one-hot design detection");
+    check(!general.is_categorical(), "general design detection");
+    check(arma::approx_equal(categorical.times_transposed(Theta), X_groups * Theta.t(), "absdiff", epsilon),
+          "categorical X Theta'");
+    check(arma::approx_equal(categorical.weighted_crossprod(Z), Z.t() * diagmat(w) * X_groups, "absdiff", epsilon),
+          "categorical R' (w X)");
+    check(arma::approx_equal(general.weighted_crossprod(Z), Z.t() * diagmat(w) * X_general, "absdiff", epsilon),
+          "general R' (w X)");
+    for(const Design<double> * design : {&categorical, &general}) {
+        const auto single = design->convert<float>();
+        arma::mat product = arma::conv_to<arma::mat>::from(single.times_transposed(Thetaf));
+        check(arma::approx_equal(product, design->times_transposed(Theta), "absdiff", 1e-5), "float X Theta'");
+        check(arma::approx_equal(single.weighted_crossprod(Zf), design->weighted_crossprod(Z), "absdiff", 1e-5),
+              "float R' (w X)");
+    }
+
+    // Active rows
+    auto active_rows = ActiveRows(w, 1.);
+    check(!active_rows.all() && active_rows.indices().n_elem == 1 && active_rows.indices()[0] == 1,
+          "active rows selection");
+    check(ActiveRows(w, 0.).all(), "active rows default threshold");
+    const ActiveData active(active_rows, small, from_rows, X_general, w);
+    check(arma::approx_equal(active.Y.to_mat(), small.to_mat().rows(1, 1), "absdiff", epsilon), "active responses");
+    check(arma::approx_equal(active.O.plus(Z.rows(1, 1)), dense_rows.rows(1, 1) + Z.rows(1, 1), "absdiff", epsilon),
+          "active offsets");
+    check(active.w.n_elem == 1 && active.w[0] == w[1], "active weights");
+    arma::mat active_product = X_general.rows(1, 1) * Theta.t();
+    check(arma::approx_equal(active.design.times_transposed(Theta), active_product, "absdiff", epsilon),
+          "active design");
+    arma::mat expanded = active_rows.expand(active_rows.restrict(Z) + 1., Z);
+    check(arma::approx_equal(expanded.row(0), Z.row(0), "absdiff", epsilon) &&
+              arma::approx_equal(expanded.row(1), Z.row(1) + 1., "absdiff", epsilon),
+          "expand active rows");
+    const auto all_rows = ActiveRows(w, 0.);
+    check(all_rows.restrict(Z).memptr() == Z.memptr(), "restrict all rows without copy");
+    return success;
+}
@@ -0,0 +1,576 @@
+// Compact representations of the data matrices used by the optimizers.
+#pragma once
+
+#include "arma_backend.h"
+#include <algorithm> // max
+#include <cmath>     // floor, log
+#include <cstdint>   // uint16_t, uint32_t
+#include <limits>
+#include <stdexcept>
+#include <utility>   // move
+
+#include "precision.h"
+
+// ---------------------------------------------------------------------------------------
+// Responses
+
+// Counts Y (n,p), stored as uint16 or uint32 depending on the max count.
+// Kernels read counts and convert them to floating point on the fly, which divides the memory footprint and
+// bandwidth of Y by 4 or 2 compared to a double matrix.
+// Non-integer or negative values (Y is not restricted to counts in R) fall back to double storage.
+class CountMatrix {
+  public:
+    enum class Storage { U16, U32, Double };
+
+    arma::uword n_rows = 0;
+    arma::uword n_cols = 0;
+
+    // Build from an arma::mat (used by the sanity tests and internal callers).
+    static CountMatrix from_mat(const arma::mat & y) { return from_values(y.memptr(), y.n_rows, y.n_cols); }
+
+    // Build from column-major values (R integer or numeric matrices, see r_adapter.h), selecting the smallest storage
+    // type.
+    template <typename T> static CountMatrix from_values(const T * values, arma::uword n_rows, arma::uword n_cols) {
+        return from_strided(values, n_rows, n_cols, 1, n_rows);
+    }
+
+    // Build from values with element (i,j) at values[i * row_stride + j * col_stride] (row-major or strided arrays
+    // of the C API, see plnmodels_c.h). Values are read directly into the compact storage.
+    template <typename T>
+    static CountMatrix from_strided(
+        const T * values, arma::uword n_rows, arma::uword n_cols, arma::uword row_stride, arma::uword col_stride) {
+        CountMatrix y;
+        y.n_rows = n_rows;
+        y.n_cols = n_cols;
+        // Select storage: integer counts only, then by max value
+        bool counts = true;
+        double max_value = 0.;
+        for(arma::uword j = 0; counts && j < n_cols; j += 1) {
+            for(arma::uword i = 0; i < n_rows; i += 1) {
+                const double v = double(values[i * row_stride + j * col_stride]);
+                if(!(v >= 0. && v == std::floor(v))) { // Also rejects NaN
+                    counts = false;
+                    break;
+                }
+                max_value = std::max(max_value, v);
+            }
+        }
+        if(counts && max_value <= double(std::numeric_limits<std::uint16_t>::max())) {
+            y.storage_ = Storage::U16;
+            y.y16_.set_size(n_rows, n_cols);
+            fill(y.y16_, values, row_stride, col_stride);
+        } else if(counts && max_value <= double(std::numeric_limits<std::uint32_t>::max())) {
+            y.storage_ = Storage::U32;
+            y.y32_.set_size(n_rows, n_cols);
+            fill(y.y32_, values, row_stride, col_stride);
+        } else {
+            y.storage_ = Storage::Double;
+            y.y64_.set_size(n_rows, n_cols);
+            fill(y.y64_, values, row_stride, col_stride);
+        }
+        return y;
+    }
+
+    Storage storage() const { return storage_; }
+
+    // Subset of rows
+    CountMatrix subset_rows(const arma::uvec & indices) const {
+        CountMatrix y;
+        y.n_rows = indices.n_elem;
+        y.n_cols = n_cols;
+        y.storage_ = storage_;
+        switch(storage_) {
+        case Storage::U16:
+            y.y16_ = y16_.rows(indices);
+            break;
+        case Storage::U32:
+            y.y32_ = y32_.rows(indices);
+            break;
+        default:
+            y.y64_ = y64_.rows(indices);
+            break;
+        }
+        return y;
+    }
+
+    // Dense double copy, for callers that need the full matrix
+    arma::mat to_mat() const {
+        switch(storage_) {
+        case Storage::U16:
+            return arma::conv_to<arma::mat>::from(y16_);
+        case Storage::U32:
+            return arma::conv_to<arma::mat>::from(y32_);
+        default:
+            return y64_;
+        }
+    }
+
+    // Dense double copy of rows [first_row, last_row], for kernels working on blocks of rows
+    arma::mat to_mat(arma::uword first_row, arma::uword last_row) const {
+        switch(storage_) {
+        case Storage::U16:
+            return arma::conv_to<arma::mat>::from(y16_.rows(first_row, last_row));
+        case Storage::U32:
+            return arma::conv_to<arma::mat>::from(y32_.rows(first_row, last_row));
+        default:
+            return y64_.rows(first_row, last_row);
+        }
+    }
+
+    // A - Y
+    template <typename eT> arma::Mat<eT> subtract_from(const arma::Mat<eT> & A) const {
+        check_size(A);
+        switch(storage_) {
+        case Storage::U16:
+            return subtract_from_impl(y16_, A);
+        case Storage::U32:
+            return subtract_from_impl(y32_, A);
+        default:
+            return subtract_from_impl(y64_, A);
+        }
+    }
+
+    // Y % Z
+    template <typename eT> arma::Mat<eT> schur(const arma::Mat<eT> & Z) const {
+        check_size(Z);
+        switch(storage_) {
+        case Storage::U16:
+            return schur_impl(y16_, Z);
+        case Storage::U32:
+            return schur_impl(y32_, Z);
+        default:
+            return schur_impl(y64_, Z);
+        }
+    }
+
+    // sum_{i,j} w_i Y_{i,j} Z_{i,j} accumulated in double.
+    template <typename eT> double weighted_dot(const arma::vec & w, const arma::Mat<eT> & Z) const {
+        check_size(Z);
+        switch(storage_) {
+        case Storage::U16:
+            return weighted_dot_impl(y16_, w, Z);
+        case Storage::U32:
+            return weighted_dot_impl(y32_, w, Z);
+        default:
+            return weighted_dot_impl(y64_, w, Z);
+        }
+    }
+
+    // At - Y', for kernels working on transposed (p,n) values
+    template <typename eT> arma::Mat<eT> subtract_transposed_from(const arma::Mat<eT> & At) const {
+        check_transposed_size(At);
+        switch(storage_) {
+        case Storage::U16:
+            return subtract_transposed_from_impl(y16_, At);
+        case Storage::U32:
+            return subtract_transposed_from_impl(y32_, At);
+        default:
+            return subtract_transposed_from_impl(y64_, At);
+        }
+    }
+
+    // sum_{i,j} w_i Y_{i,j} Zt_{j,i} accumulated in double.
+    template <typename eT> double weighted_dot_transposed(const arma::vec & w, const arma::Mat<eT> & Zt) const {
+        check_transposed_size(Zt);
+        switch(storage_) {
+        case Storage::U16:
+            return weighted_dot_transposed_impl(y16_, w, Zt);
+        case Storage::U32:
+            return weighted_dot_transposed_impl(y32_, w, Zt);
+        default:
+            return weighted_dot_transposed_impl(y64_, w, Zt);
+        }
+    }
+
+    // Row sums of log(Y!) using Ramanujan's approximation, log(0!) approximated by log(1!).
+    arma::vec logfact() const {
+        switch(storage_) {
+        case Storage::U16:
+            return logfact_impl(y16_);
+        case Storage::U32:
+            return logfact_impl(y32_);
+        default:
+            return logfact_impl(y64_);
+        }
+    }
+
+  private:
+    Storage storage_ = Storage::Double;
+    arma::Mat<arma::u16> y16_;
+    arma::Mat<arma::u32> y32_;
+    arma::mat y64_;
+
+    template <typename Count, typename T>
+    static void fill(arma::Mat<Count> & y, const T * values, arma::uword row_stride, arma::uword col_stride) {
+        for(arma::uword j = 0; j < y.n_cols; j += 1) {
+            Count * out = y.colptr(j);
+            const T * column = values + j * col_stride;
+            for(arma::uword i = 0; i < y.n_rows; i += 1) {
+                out[i] = static_cast<Count>(column[i * row_stride]);
+            }
+        }
+    }
+
+    template <typename eT> void check_size(const arma::Mat<eT> & m) const {
+        if(m.n_rows != n_rows || m.n_cols != n_cols) {
+            throw std::invalid_argument("CountMatrix: dimension mismatch");
+        }
+    }
+
+    template <typename eT> void check_transposed_size(const arma::Mat<eT> & mt) const {
+        if(mt.n_rows != n_cols || mt.n_cols != n_rows) {
+            throw std::invalid_argument("CountMatrix: dimension mismatch");
+        }
+    }
+
+    template <typename Count, typename eT>
+    static arma::Mat<eT> subtract_from_impl(const arma::Mat<Count> & y, const arma::Mat<eT> & A) {
+        auto result = arma::Mat<eT>(A.n_rows, A.n_cols);
+        const Count * y_ptr = y.memptr();
+        const eT * a_ptr = A.memptr();
+        eT * r_ptr = result.memptr();
+        for(arma::uword k = 0; k < A.n_elem; k += 1) {
+            r_ptr[k] = a_ptr[k] - static_cast<eT>(y_ptr[k]);
+        }
+        return result;
+    }
+
+    // Y is read column by column, At and the result by rows
+    template <typename Count, typename eT>
+    static arma::Mat<eT> subtract_transposed_from_impl(const arma::Mat<Count> & y, const arma::Mat<eT> & At) {
+        auto result = arma::Mat<eT>(At.n_rows, At.n_cols);
+        for(arma::uword j = 0; j < y.n_cols; j += 1) {
+            const Count * y_column = y.colptr(j);
+            for(arma::uword i = 0; i < y.n_rows; i += 1) {
+                result.at(j, i) = At.at(j, i) - static_cast<eT>(y_column[i]);
+            }
+        }
+        return result;
+    }
+
+    template <typename Count, typename eT>
+    static arma::Mat<eT> schur_impl(const arma::Mat<Count> & y, const arma::Mat<eT> & Z) {
+        auto result = arma::Mat<eT>(Z.n_rows, Z.n_cols);
+        const Count * y_ptr = y.memptr();
+        const eT * z_ptr = Z.memptr();
+        eT * r_ptr = result.memptr();
+        for(arma::uword k = 0; k < Z.n_elem; k += 1) {
+            r_ptr[k] = static_cast<eT>(y_ptr[k]) * z_ptr[k];
+        }
+        return result;
+    }
+
+    template <typename Count, typename eT>
+    static double weighted_dot_impl(const arma::Mat<Count> & y, const arma::vec & w, const arma::Mat<eT> & Z) {
+        CompensatedSum total;
+        for(arma::uword j = 0; j < Z.n_cols; j += 1) {
+            const Count * y_column = y.colptr(j);
+            const eT * z_column = Z.colptr(j);
+            double column_sum = 0.;
+            for(arma::uword i = 0; i < Z.n_rows; i += 1) {
+                column_sum += w[i] * double(y_column[i]) * double(z_column[i]);
+            }
+            total.add(column_sum);
+        }
+        return total.value();
+    }
+
+    template <typename Count, typename eT>
+    static double weighted_dot_transposed_impl(
+        const arma::Mat<Count> & y, const arma::vec & w, const arma::Mat<eT> & Zt) {
+        CompensatedSum total;
+        for(arma::uword j = 0; j < y.n_cols; j += 1) {
+            const Count * y_column = y.colptr(j);
+            double column_sum = 0.;
+            for(arma::uword i = 0; i < y.n_rows; i += 1) {
+                column_sum += w[i] * double(y_column[i]) * double(Zt.at(j, i));
+            }
+            total.add(column_sum);
+        }
+        return total.value();
+    }
+
+    template <typename Count> static arma::vec logfact_impl(const arma::Mat<Count> & y) {
+        auto sums = arma::vec(y.n_rows, arma::fill::zeros);
+        const double log_pi_2 = std::log(M_PI) / 2.;
+        for(arma::uword j = 0; j < y.n_cols; j += 1) {
+            const Count * column = y.colptr(j);
+            for(arma::uword i = 0; i < y.n_rows; i += 1) {
+                const double v = column[i] == Count(0) ? 1. : double(column[i]);
+                sums[i] += v * std::log(v) - v + std::log(8. * v * v * v + 4. * v * v + v + 1. / 30.) / 6. + log_pi_2;
+            }
+        }
+        return sums;
+    }
+};
+
+// ---------------------------------------------------------------------------------------
+// Offsets
+
+// Offsets O (n,p), stored either as a dense matrix or in structured form O_ij = row_i + col_j.
+// Offsets computed by compute_offset() only depend on the sample (log-depth), so the structured form avoids
+// storing a full (n,p) matrix and reading it at each evaluation of Z.
+// Exactly one of 'dense' and 'rows' is non-empty ; 'cols' may be empty.
+template <typename eT> struct Offsets {
+    arma::Mat<eT> dense; // (n,p) or empty
+    arma::Col<eT> rows;  // (n) or empty
+    arma::Row<eT> cols;  // (p) or empty
+
+    // Check that offsets match responses (n,p)
+    void check_dimensions(arma::uword n, arma::uword p) const {
+        if(!(dense.n_elem > 0 ? (dense.n_rows == n && dense.n_cols == p) : rows.n_elem == n)) {
+            throw std::invalid_argument("offsets: dimension mismatch with responses");
+        }
+        if(cols.n_elem > 0 && cols.n_elem != p) {
+            throw std::invalid_argument("offsets: column offsets dimension mismatch with responses");
+        }
+    }
+
+    // Subset of rows
+    Offsets subset_rows(const arma::uvec & indices) const {
+        Offsets o;
+        if(dense.n_elem > 0) {
+            o.dense = dense.rows(indices);
+        } else {
+            o.rows = rows.elem(indices);
+        }
+        o.cols = cols;
+        return o;
+    }
+
+    // Same offsets with another element type (used for single precision evaluation)
+    template <typename eT2> Offsets<eT2> convert() const {
+        Offsets<eT2> o;
+        o.dense = arma::conv_to<arma::Mat<eT2>>::from(dense);
+        o.rows = arma::conv_to<arma::Col<eT2>>::from(rows);
+        o.cols = arma::conv_to<arma::Row<eT2>>::from(cols);
+        return o;
+    }
+
+    // Z += O
+    void add_to(arma::Mat<eT> & Z) const {
+        if(dense.n_elem > 0) {
+            Z += dense;
+        } else {
+            Z.each_col() += rows;
+        }
+        if(cols.n_elem > 0) {
+            Z.each_row() += cols;
+        }
+    }
+
+    // O + Z
+    arma::Mat<eT> plus(arma::Mat<eT> Z) const {
+        add_to(Z);
+        return Z;
+    }
+};
+
+// ---------------------------------------------------------------------------------------
+// Covariates
+
+// Covariates X (n,d) with the weights w of the samples.
+// One-hot designs (each row has a single 1 and zeros elsewhere, as group indicators of PLNLDA or ~ 0 + group) are
+// stored as the group index of each row: X Theta' is then a row gather of Theta, and R' (w X) a grouped sum of the
+// rows of R, instead of BLAS products with d times more operations. Other designs use BLAS products.
+template <typename eT> class Design {
+  public:
+    arma::uword n_rows;
+    arma::uword n_cols;
+
+    Design(const arma::mat & X, const arma::vec & w) : n_rows(X.n_rows), n_cols(X.n_cols), categorical_(false) {
+        if(w.n_elem != X.n_rows) {
+            throw std::invalid_argument("Design: weights dimension mismatch with covariates");
+        }
+        auto groups = arma::uvec(X.n_rows);
+        bool one_hot = X.n_rows > 0 && X.n_cols > 0;
+        for(arma::uword i = 0; one_hot && i < X.n_rows; i += 1) {
+            arma::uword nb_ones = 0;
+            for(arma::uword k = 0; k < X.n_cols; k += 1) {
+                const double x = X(i, k);
+                if(x == 1.) {
+                    groups[i] = k;
+                    nb_ones += 1;
+                } else if(x != 0.) {
+                    one_hot = false;
+                }
+            }
+            one_hot = one_hot && nb_ones == 1;
+        }
+        if(one_hot) {
+            categorical_ = true;
+            groups_ = std::move(groups);
+            w_ = w;
+        } else {
+            X_ = arma::conv_to<arma::Mat<eT>>::from(X);
+            wX_ = X.each_col() % w;
+        }
+    }
+
+    bool is_categorical() const { return categorical_; }
+
+    // X B' for B (p,d), (n,p)
+    arma::Mat<eT> times_transposed(const arma::Mat<eT> & B) const {
+        if(B.n_cols != n_cols) {
+            throw std::invalid_argument("Design: dimension mismatch");
+        }
+        if(!categorical_) {
+            return X_ * B.t();
+        }
+        const arma::Mat<eT> Bt = B.t(); // (d,p), gather along columns
+        auto product = arma::Mat<eT>(n_rows, B.n_rows);
+        for(arma::uword j = 0; j < B.n_rows; j += 1) {
+            const eT * source = Bt.colptr(j);
+            eT * column = product.colptr(j);
+            for(arma::uword i = 0; i < n_rows; i += 1) {
+                column[i] = source[groups_[i]];
+            }
+        }
+        return product;
+    }
+
+    // R' (w X) for R (n,p), (p,d) accumulated in double
+    arma::mat weighted_crossprod(const arma::Mat<eT> & R) const {
+        if(R.n_rows != n_rows) {
+            throw std::invalid_argument("Design: dimension mismatch");
+        }
+        if(!categorical_) {
+            return dense_crossprod(R, wX_);
+        }
+        auto product = arma::mat(R.n_cols, n_cols);
+        auto sums = arma::vec(n_cols);
+        for(arma::uword j = 0; j < R.n_cols; j += 1) {
+            const eT * column = R.colptr(j);
+            sums.zeros();
+            for(arma::uword i = 0; i < n_rows; i += 1) {
+                sums[groups_[i]] += w_[i] * double(column[i]);
+            }
+            product.row(j) = sums.t();
+        }
+        return product;
+    }
+
+    // R' (w X%X) for R (n,p), (p,d): diagonal of the Theta block of Hessians. X%X = X for one-hot designs.
+    arma::mat weighted_square_crossprod(const arma::Mat<eT> & R) const {
+        if(!categorical_) {
+            return dense_crossprod(R, wX_ % arma::conv_to<arma::mat>::from(X_));
+        }
+        return weighted_crossprod(R);
+    }
+
+    // Same design with another element type for products (used for single precision evaluation)
+    template <typename eT2> Design<eT2> convert() const {
+        Design<eT2> d;
+        d.n_rows = n_rows;
+        d.n_cols = n_cols;
+        d.categorical_ = categorical_;
+        d.X_ = arma::conv_to<arma::Mat<eT2>>::from(X_);
+        d.wX_ = wX_;
+        d.groups_ = groups_;
+        d.w_ = w_;
+        return d;
+    }
+
+  private:
+    bool categorical_;
+    arma::Mat<eT> X_;   // dense covariates (n,d), empty if categorical
+    arma::mat wX_;      // w X (n,d), empty if categorical
+    arma::uvec groups_; // group of each row (n), empty if not categorical
+    arma::vec w_;       // weights (n), empty if not categorical
+
+    Design() = default;
+    template <typename> friend class Design;
+
+    static arma::mat dense_crossprod(const arma::mat & R, const arma::mat & wX) { return R.t() * wX; }
+    static arma::mat dense_crossprod(const arma::fmat & R, const arma::mat & wX) { return crossprod_double(R, wX); }
+};
+
+// ---------------------------------------------------------------------------------------
+// Active rows
+
+// Rows taking part in the optimization: weights above threshold (configuration["row_weight_threshold"], default 0:
+// only rows with zero weight are skipped).
+// Skipped rows are handled as zero weight rows: they do not contribute to the objective and gradients, and their
+// variational parameters keep their initial value. Mixture components are fitted with weights tau[,k], so with
+// well separated clusters each component only processes its own rows.
+class ActiveRows {
+  public:
+    ActiveRows(const arma::vec & w, double threshold) : n_rows_(w.n_elem) {
+        indices_ = arma::find(w > threshold);
+        if(indices_.is_empty()) {
+            throw std::invalid_argument("no row has a weight above config[row_weight_threshold]");
+        }
+    }
+
+    bool all() const { return indices_.n_elem == n_rows_; }
+    const arma::uvec & indices() const { return indices_; }
+
+    // Values of the active rows. If all rows are active, the result uses the memory of m (no copy): m must outlive it.
+    arma::mat restrict(const arma::mat & m) const {
+        if(all()) {
+            return arma::mat(const_cast<double *>(m.memptr()), m.n_rows, m.n_cols, false, true);
+        }
+        return arma::mat(m.rows(indices_));
+    }
+    arma::vec restrict(const arma::vec & v) const {
+        if(all()) {
+            return arma::vec(const_cast<double *>(v.memptr()), v.n_elem, false, true);
+        }
+        return arma::vec(v.elem(indices_));
+    }
+
+    // Values for all rows: optimized values for the active rows, initial values for the skipped rows
+    arma::mat expand(arma::mat active_values, const arma::mat & initial_values) const {
+        if(all()) {
+            return active_values;
+        }
+        arma::mat values = initial_values;
+        values.rows(indices_) = active_values;
+        return values;
+    }
+
+  private:
+    arma::uword n_rows_;
+    arma::uvec indices_;
+};
+
+// Data restricted to the active rows, referring to the full data when all rows are active.
+class ActiveData {
+  private:
+    CountMatrix Y_subset_;
+    Offsets<double> O_subset_;
+
+  public:
+    const CountMatrix & Y;        // responses (n_active,p)
+    const Offsets<double> & O;    // offsets (n_active,p)
+    const arma::vec w;            // weights (n_active)
+    const Design<double> design;  // covariates (n_active,d)
+
+    ActiveData(const ActiveRows & rows, const CountMatrix & Y_, const Offsets<double> & O_, const arma::mat & X,
+               const arma::vec & w_)
+        : Y_subset_(rows.all() ? CountMatrix() : Y_.subset_rows(rows.indices())),
+          O_subset_(rows.all() ? Offsets<double>() : O_.subset_rows(rows.indices())),
+          Y(rows.all() ? Y_ : Y_subset_),
+          O(rows.all() ? O_ : O_subset_),
+          w(rows.restrict(w_)),
+          design(rows.restrict(X), w) {}
+
+    // References to members, not copyable
+    ActiveData(const ActiveData &) = delete;
+    ActiveData & operator=(const ActiveData &) = delete;
+};
+
+// ---------------------------------------------------------------------------------------
+// Single precision data
+
+// Single precision copies of the data, for evaluation in Precision::Single mode.
+// Responses are read from their compact integer storage (see CountMatrix) and need no copy.
+// The Theta gradient reduction of Design is accumulated in double.
+struct SinglePrecisionData {
+    Design<float> X;  // covariates (n,d)
+    Offsets<float> O; // offsets (n,p)
+    arma::fvec w;     // weights (n)
+
+    SinglePrecisionData(const Design<double> & X_, const Offsets<double> & O_, const arma::vec & w_)
+        : X(X_.convert<float>()), O(O_.convert<float>()), w(arma::conv_to<arma::fvec>::from(w_)) {}
+};
@@ -0,0 +1,250 @@
+#include "lbfgs.h"
+
+#include <algorithm> // max, min
+#include <cmath>     // abs, isfinite, sqrt
+#include <stdexcept>
+#include <utility>   // move
+
+// ---------------------------------------------------------------------------------------
+// Ask / tell L-BFGS
+
+// Line search: backtracking until the Armijo sufficient decrease condition holds, with safeguarded quadratic
+// interpolation of the step. Correction pairs with non positive curvature are skipped, which keeps the inverse
+// Hessian approximation positive definite without a strong Wolfe line search.
+static const double armijo_c1 = 1e-4;
+static const int max_backtracks = 40;
+
+Lbfgs::Lbfgs(arma::vec x0, const LbfgsConfiguration & config)
+    : config_(config),
+      phase_(Phase::Initial),
+      status_(NLOPT_FAILURE),
+      nb_evaluations_(0),
+      x_(x0),
+      f_(0.),
+      slope_(0.),
+      step_(0.),
+      nb_backtracks_(0),
+      trial_(std::move(x0)) {}
+
+void Lbfgs::report(double objective, const arma::vec & gradient) {
+    if(phase_ == Phase::Done) {
+        throw std::logic_error("Lbfgs::report: optimization is already done");
+    }
+    if(gradient.n_elem != trial_.n_elem) {
+        throw std::invalid_argument("Lbfgs::report: gradient size");
+    }
+    nb_evaluations_ += 1;
+    const bool finite = std::isfinite(objective) && gradient.is_finite();
+
+    if(phase_ == Phase::Initial) {
+        if(!finite) {
+            return finish(NLOPT_FAILURE);
+        }
+        f_ = objective;
+        g_ = gradient;
+        if(arma::norm(g_, "inf") <= config_.gtol_abs) {
+            return finish(NLOPT_SUCCESS);
+        }
+        return start_iteration();
+    }
+
+    // Line search
+    if(!(finite && objective <= f_ + armijo_c1 * step_ * slope_)) {
+        nb_backtracks_ += 1;
+        if(nb_backtracks_ > max_backtracks || (config_.maxeval > 0 && nb_evaluations_ >= config_.maxeval)) {
+            return finish(nb_backtracks_ > max_backtracks ? NLOPT_ROUNDOFF_LIMITED : NLOPT_MAXEVAL_REACHED);
+        }
+        // Minimizer of the quadratic interpolating f_, slope_ and objective, kept in [0.1, 0.5] * step_
+        double factor = 0.5;
+        if(std::isfinite(objective)) {
+            const double curvature = objective - f_ - step_ * slope_;
+            if(curvature > 0.) {
+                factor = std::min(0.5, std::max(0.1, -slope_ * step_ / (2. * curvature)));
+            }
+        }
+        step_ *= factor;
+        trial_ = x_ + step_ * direction_;
+        return;
+    }
+
+    // Accept trial point
+    arma::vec s = trial_ - x_;
+    arma::vec y = gradient - g_;
+    const double sy = dot(s, y);
+    if(sy > 1e-10 * dot(y, y)) {
+        if(s_.size() >= config_.memory) {
+            s_.pop_front();
+            y_.pop_front();
+            rho_.pop_front();
+        }
+        rho_.push_back(1. / sy);
+        s_.push_back(std::move(s));
+        y_.push_back(std::move(y));
+    }
+    const double previous_f = f_;
+    const arma::vec previous_x = x_;
+    x_ = trial_;
+    f_ = objective;
+    g_ = gradient;
+
+    if(arma::norm(g_, "inf") <= config_.gtol_abs) {
+        return finish(NLOPT_SUCCESS);
+    }
+    if(std::abs(previous_f - f_) <= config_.ftol_rel * std::abs(f_)) {
+        return finish(NLOPT_FTOL_REACHED);
+    }
+    if(arma::all(arma::abs(x_ - previous_x) <= config_.xtol_rel * arma::abs(x_))) {
+        return finish(NLOPT_XTOL_REACHED);
+    }
+    if(config_.maxeval > 0 && nb_evaluations_ >= config_.maxeval) {
+        return finish(NLOPT_MAXEVAL_REACHED);
+    }
+    start_iteration();
+}
+
+void Lbfgs::start_iteration() {
+    // Two-loop recursion: direction_ = - H g_
+    const std::size_t m = s_.size();
+    arma::vec q = g_;
+    auto alpha = std::vector<double>(m);
+    for(std::size_t k = m; k-- > 0;) {
+        alpha[k] = rho_[k] * dot(s_[k], q);
+        q -= alpha[k] * y_[k];
+    }
+    if(m > 0) {
+        q *= 1. / (rho_[m - 1] * dot(y_[m - 1], y_[m - 1])); // Initial H = (s'y / y'y) I
+    }
+    for(std::size_t k = 0; k < m; k += 1) {
+        const double beta = rho_[k] * dot(y_[k], q);
+        q += (alpha[k] - beta) * s_[k];
+    }
+    direction_ = -q;
+    slope_ = dot(g_, direction_);
+    if(!(slope_ < 0.)) {
+        // Not a descent direction (numerical issues), restart from steepest descent
+        s_.clear();
+        y_.clear();
+        rho_.clear();
+        direction_ = -g_;
+        slope_ = -dot(g_, g_);
+    }
+    // Without curvature information the first step is scaled to a unit move
+    step_ = s_.empty() ? std::min(1., 1. / arma::norm(direction_, 2)) : 1.;
+    nb_backtracks_ = 0;
+    trial_ = x_ + step_ * direction_;
+    phase_ = Phase::LineSearch;
+}
+
+void Lbfgs::finish(nlopt_result status) {
+    status_ = status;
+    phase_ = Phase::Done;
+    trial_ = x_;
+}
+
+// ---------------------------------------------------------------------------------------
+// Batch driver
+
+void minimize_batch(
+    std::vector<Lbfgs> & problems,
+    const std::function<arma::vec(const arma::uvec & indices, const arma::mat & points, arma::mat & gradients)> &
+        batch_objective_and_grad //
+) {
+    if(problems.empty()) {
+        return;
+    }
+    const arma::uword size = problems[0].next_point().n_elem;
+    auto indices = arma::uvec(problems.size());
+    auto points = arma::mat(size, problems.size());
+    while(true) {
+        // Gather next points of unfinished problems
+        arma::uword nb_active = 0;
+        for(arma::uword k = 0; k < problems.size(); k += 1) {
+            if(!problems[k].done()) {
+                const arma::vec & point = problems[k].next_point();
+                if(point.n_elem != size) {
+                    throw std::invalid_argument("minimize_batch: problems must have the same size");
+                }
+                indices[nb_active] = k;
+                points.col(nb_active) = point;
+                nb_active += 1;
+            }
+        }
+        if(nb_active == 0) {
+            return;
+        }
+        // Evaluate all of them at once, and scatter results
+        const arma::uvec active_indices = indices.head(nb_active);
+        const arma::mat active_points = points.head_cols(nb_active);
+        arma::mat active_gradients(size, nb_active);
+        const arma::vec objectives = batch_objective_and_grad(active_indices, active_points, active_gradients);
+        if(objectives.n_elem != nb_active) {
+            throw std::invalid_argument("minimize_batch: objective count");
+        }
+        for(arma::uword c = 0; c < nb_active; c += 1) {
+            problems[active_indices[c]].report(objectives[c], active_gradients.col(c));
+        }
+    }
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// sanity test and example
+
+// [[Rcpp::export]]
+bool cpp_test_lbfgs() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    LbfgsConfiguration config;
+    config.memory = 5;
+    config.xtol_rel = 0.;
+    config.ftol_rel = 0.;
+    config.gtol_abs = 1e-8;
+    config.maxeval = 1000;
+
+    // Rosenbrock function, caller-driven loop
+    auto rosenbrock_config = config;
+    rosenbrock_config.gtol_abs = 1e-6;
+    auto rosenbrock = Lbfgs(arma::vec{-1.2, 1.}, rosenbrock_config);
+    while(!rosenbrock.done()) {
+        const arma::vec & x = rosenbrock.next_point();
+        const double a = 1. - x[0];
+        const double b = x[1] - x[0] * x[0];
+        auto grad = arma::vec{-2. * a - 400. * x[0] * b, 200. * b};
+        rosenbrock.report(a * a + 100. * b * b, grad);
+    }
+    check(rosenbrock.status() == NLOPT_SUCCESS, "lbfgs rosenbrock status");
+    check(arma::approx_equal(rosenbrock.solution(), arma::vec{1., 1.}, "absdiff", 1e-4), "lbfgs rosenbrock solution");
+
+    // Batch of separable quadratics 0.5 sum_i d_i (x_i - c_i)^2 with problem-specific centers
+    const arma::uword nb_problems = 100;
+    const auto d = arma::vec{1., 10., 100.};
+    const arma::mat centers = arma::randn<arma::mat>(3, nb_problems);
+    auto problems = std::vector<Lbfgs>(nb_problems, Lbfgs(arma::vec(3, arma::fill::zeros), config));
+    int nb_calls = 0;
+    auto batch_objective_and_grad =
+        [&](const arma::uvec & indices, const arma::mat & points, arma::mat & gradients) -> arma::vec {
+        nb_calls += 1;
+        const arma::mat delta = points - centers.cols(indices);
+        gradients = delta.each_col() % d;
+        return arma::vec(0.5 * sum(delta % gradients, 0).t());
+    };
+    minimize_batch(problems, batch_objective_and_grad);
+    bool all_converged = true;
+    int max_evaluations = 0;
+    for(arma::uword k = 0; k < nb_problems; k += 1) {
+        all_converged = all_converged && problems[k].status() == NLOPT_SUCCESS &&
+                        arma::approx_equal(problems[k].solution(), centers.col(k), "absdiff", 1e-6);
+        max_evaluations = std::max(max_evaluations, problems[k].nb_evaluations());
+    }
+    check(all_converged, "lbfgs batch convergence");
+    check(nb_calls == max_evaluations, "lbfgs batch lockstep evaluation");
+
+    return success;
+}
+
+#endif
@@ -0,0 +1,91 @@
+// L-BFGS minimizer with a reverse communication (ask/tell) interface.
+//
+// minimize_objective_on_parameters() (nlopt_wrapper.h) owns the optimization loop and calls back the objective.
+// Here the caller owns the loop instead:
+//
+//   auto optimizer = Lbfgs(x0, config);
+//   while(!optimizer.done()) {
+//       const arma::vec & x = optimizer.next_point();
+//       arma::vec grad(x.n_elem);
+//       double f = objective_and_grad(x, grad);
+//       optimizer.report(f, grad);
+//   }
+//   optimizer.solution(); optimizer.status();
+//
+// This allows to step many small independent problems (per-row VE, mixture components, bootstrap replicates) in
+// lockstep, and to evaluate all their objectives with a single fused kernel call (see minimize_batch()).
+#pragma once
+
+#include "arma_backend.h"
+#include <nlopt.h> // nlopt_result, status codes shared with minimize_objective_on_parameters()
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+struct LbfgsConfiguration {
+    arma::uword memory; // Number of stored correction pairs
+    double xtol_rel;    // Stop when every |x_i| changes by less than xtol_rel * |x_i|
+    double ftol_rel;    // Stop when the objective changes by less than ftol_rel * |f|
+    double gtol_abs;    // Stop when every |g_i| is below gtol_abs
+    int maxeval;        // Maximum number of evaluations, ignored if <= 0
+};
+
+class Lbfgs {
+  public:
+    Lbfgs(arma::vec x0, const LbfgsConfiguration & config);
+
+    bool done() const { return phase_ == Phase::Done; }
+
+    // Point where the objective and gradient must be evaluated next. Invalid once done().
+    const arma::vec & next_point() const { return trial_; }
+
+    // Give the objective and gradient at next_point(), and advance to the next point.
+    void report(double objective, const arma::vec & gradient);
+
+    // Best accepted point, and objective value at this point
+    const arma::vec & solution() const { return x_; }
+    double objective() const { return f_; }
+
+    // NLOPT_SUCCESS (gtol), NLOPT_FTOL_REACHED, NLOPT_XTOL_REACHED, NLOPT_MAXEVAL_REACHED, NLOPT_ROUNDOFF_LIMITED
+    // (line search failure) or NLOPT_FAILURE (non finite initial objective). Meaningful once done().
+    nlopt_result status() const { return status_; }
+    int nb_evaluations() const { return nb_evaluations_; }
+
+  private:
+    enum class Phase { Initial, LineSearch, Done };
+
+    LbfgsConfiguration config_;
+    Phase phase_;
+    nlopt_result status_;
+    int nb_evaluations_;
+
+    // Current iterate
+    arma::vec x_;
+    double f_;
+    arma::vec g_;
+
+    // Line search along direction_ from x_: trial_ = x_ + step_ * direction_
+    arma::vec direction_;
+    double slope_; // g_' direction_ < 0
+    double step_;
+    int nb_backtracks_;
+    arma::vec trial_;
+
+    // Correction pairs s = x_{k+1} - x_k, y = g_{k+1} - g_k, oldest first
+    std::deque<arma::vec> s_;
+    std::deque<arma::vec> y_;
+    std::deque<double> rho_; // 1 / (y's)
+
+    void start_iteration();
+    void finish(nlopt_result status);
+};
+
+// Minimize a batch of independent problems of identical size in lockstep.
+// At each round, the next points of all unfinished problems are stored as columns of a (size, k) matrix and
+// evaluated by a single call of batch_objective_and_grad(indices, points, gradients), which must fill the gradients
+// (same shape as points) and return the k objective values. indices gives the problem index of each column.
+void minimize_batch(
+    std::vector<Lbfgs> & problems,
+    const std::function<arma::vec(const arma::uvec & indices, const arma::mat & points, arma::mat & gradients)> &
+        batch_objective_and_grad);
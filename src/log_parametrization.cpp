@@ -0,0 +1,109 @@
+#include "log_parametrization.h"
+
+#include <memory> // shared_ptr
+#include <stdexcept>
+#include <utility> // move
+
+static arma::uvec segment_indices(PackedSegment segment) {
+    arma::uvec indices(segment.size);
+    for(arma::uword k = 0; k < segment.size; k += 1) {
+        indices[k] = segment.offset + k;
+    }
+    return indices;
+}
+
+LogParametrization::LogParametrization(PackedSegment segment, bool enabled)
+    : LogParametrization(segment_indices(segment), enabled) {}
+
+LogParametrization::LogParametrization(arma::uvec indices, bool enabled)
+    : indices_(std::move(indices)), enabled_(enabled) {}
+
+void LogParametrization::to_log(arma::vec & parameters, OptimizerConfiguration & config) const {
+    const arma::vec S = arma::abs(part(parameters));
+    if(arma::any(S == 0.)) {
+        throw std::invalid_argument("config[log_S] requires non zero initial values for S");
+    }
+    part(config.xtol_abs) /= S;
+    part(parameters) = log(S);
+}
+
+arma::vec LogParametrization::from_log(arma::vec parameters) const {
+    part(parameters) = exp(part(parameters));
+    return parameters;
+}
+
+LogParametrization::ObjectiveAndGrad LogParametrization::wrap(
+    ObjectiveAndGrad objective_and_grad_fn, std::shared_ptr<LastGradient> last) const {
+    return [this, objective_and_grad_fn, last](const arma::vec & log_parameters, arma::vec & gradients) -> double {
+        const arma::vec parameters = from_log(log_parameters);
+        const double objective = objective_and_grad_fn(parameters, gradients);
+        part(gradients) %= part(parameters);
+        if(last) {
+            last->log_parameters = log_parameters;
+            last->S_grad = part(gradients);
+        }
+        return objective;
+    };
+}
+
+HessianAt LogParametrization::wrap(
+    ObjectiveAndGrad objective_and_grad_fn, HessianAt hessian_at, std::shared_ptr<const LastGradient> last) const {
+    return [this, objective_and_grad_fn, hessian_at, last](const arma::vec & log_parameters,
+                                                           arma::vec & diagonal) -> HessianVectorProduct {
+        const arma::vec parameters = from_log(log_parameters);
+        const arma::vec S = part(parameters);
+        arma::vec S_grad;
+        if(arma::approx_equal(last->log_parameters, log_parameters, "absdiff", 0.)) {
+            S_grad = last->S_grad;
+        } else {
+            // Newton steps are taken from the last evaluated point, this is only a fallback
+            arma::vec gradients(parameters.n_elem);
+            objective_and_grad_fn(parameters, gradients);
+            S_grad = S % part(gradients);
+        }
+        const HessianVectorProduct product_in_S = hessian_at(parameters, diagonal);
+        part(diagonal) = part(diagonal) % S % S + S_grad;
+
+        return [this, product_in_S, S, S_grad](const arma::vec & direction, arma::vec & product) {
+            arma::vec direction_in_S = direction;
+            part(direction_in_S) %= S;
+            product_in_S(direction_in_S, product);
+            part(product) = part(product) % S + S_grad % part(direction);
+        };
+    };
+}
+
+OptimizerResult LogParametrization::minimize(
+    arma::vec & parameters, const OptimizerConfiguration & config, ObjectiveAndGrad objective_and_grad_fn) const {
+    if(!enabled_) {
+        return minimize_objective_on_parameters(parameters, config, std::move(objective_and_grad_fn));
+    }
+    auto log_config = config;
+    to_log(parameters, log_config);
+    const OptimizerResult result =
+        minimize_objective_on_parameters(parameters, log_config, wrap(std::move(objective_and_grad_fn)));
+    parameters = from_log(std::move(parameters));
+    return result;
+}
+
+OptimizerResult LogParametrization::minimize(
+    arma::vec & parameters,
+    const OptimizerConfiguration & config,
+    ObjectiveAndGrad objective_and_grad_fn,
+    HessianAt hessian_at //
+) const {
+    if(!enabled_) {
+        return minimize_objective_on_parameters(
+            parameters, config, std::move(objective_and_grad_fn), std::move(hessian_at));
+    }
+    auto log_config = config;
+    to_log(parameters, log_config);
+    auto last = std::make_shared<LastGradient>();
+    const OptimizerResult result = minimize_objective_on_parameters(
+        parameters,
+        log_config,
+        wrap(objective_and_grad_fn, last),
+        wrap(objective_and_grad_fn, std::move(hessian_at), last));
+    parameters = from_log(std::move(parameters));
+    return result;
+}
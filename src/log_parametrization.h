@@ -0,0 +1,61 @@
+// Optimization of log(S) instead of S (configuration["log_S"] = TRUE).
+//
+// Objectives evaluate log(S^2) and 1/S, so line searches stepping S near zero produce huge gradients, rejected steps
+// and roundoff failures. With x = log(S) the problem is unconstrained and S = exp(x) stays positive.
+// The objectives only depend on S^2, so S is replaced by |S| before the transformation.
+//
+// The transformation wraps the model closures (objective, gradient and Hessian products are still computed for S):
+// - S = exp(x), grad_x = S % grad_S
+// - H_x = diag(S) H_S diag(S) + diag(S % grad_S)
+// - xtol_abs values for S are mapped to xtol_abs / |S| at the initial point (dx = dS / S).
+// The diagonal term of H_x reuses the gradient of the last objective evaluation, at the point of the Newton step.
+#pragma once
+
+#include "arma_backend.h"
+
+#include <functional>
+#include <memory>
+
+#include "nlopt_wrapper.h"
+#include "packer.h"
+
+class LogParametrization {
+  public:
+    using ObjectiveAndGrad = std::function<double(const arma::vec & parameters, arma::vec & gradients)>;
+
+    // segment: location of S in the packed parameters. Enabled by configuration["log_S"] (default false).
+    LogParametrization(PackedSegment segment, bool enabled);
+    // S stored at indices of the packed parameters (see PackedInfo<InterleavedRows>::S_indices)
+    LogParametrization(arma::uvec indices, bool enabled);
+
+    bool enabled() const { return enabled_; }
+
+    // Same as minimize_objective_on_parameters(), optimizing log(S) if enabled.
+    // parameters are given and returned with S in the natural scale.
+    OptimizerResult minimize(
+        arma::vec & parameters, const OptimizerConfiguration & config, ObjectiveAndGrad objective_and_grad_fn) const;
+    OptimizerResult minimize(
+        arma::vec & parameters,
+        const OptimizerConfiguration & config,
+        ObjectiveAndGrad objective_and_grad_fn,
+        HessianAt hessian_at) const;
+
+  private:
+    arma::uvec indices_;
+    bool enabled_;
+
+    arma::subview_elem1<double, arma::uvec> part(arma::vec & v) const { return v.elem(indices_); }
+    arma::vec part(const arma::vec & v) const { return v.elem(indices_); }
+
+    // Point (in log scale) and S % grad_S of the last objective evaluation
+    struct LastGradient {
+        arma::vec log_parameters;
+        arma::vec S_grad;
+    };
+
+    void to_log(arma::vec & parameters, OptimizerConfiguration & config) const;
+    arma::vec from_log(arma::vec parameters) const;
+    ObjectiveAndGrad wrap(ObjectiveAndGrad objective_and_grad_fn, std::shared_ptr<LastGradient> last = nullptr) const;
+    HessianAt wrap(
+        ObjectiveAndGrad objective_and_grad_fn, HessianAt hessian_at, std::shared_ptr<const LastGradient> last) const;
+};
@@ -0,0 +1,140 @@
+#include "memory_tracking.h"
+
+#include <atomic>
+#include <cstdlib> // malloc, free
+#include <limits>
+
+#include "arma_backend.h"
+
+static std::atomic<std::int64_t> bytes_in_use(0);
+static std::atomic<std::int64_t> peak_bytes_in_use(0);
+static std::atomic<std::uint64_t> allocated_bytes(0);
+static std::atomic<std::uint64_t> nb_allocations(0);
+
+static void raise_peak(std::int64_t bytes) {
+    std::int64_t peak = peak_bytes_in_use.load(std::memory_order_relaxed);
+    while(bytes > peak && !peak_bytes_in_use.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Armadillo hooks
+
+// Blocks are aligned on 64 bytes (see simd_alignment in packer.h), above the 16 bytes alignment of malloc that
+// Armadillo assumes. The size of each block and the distance to the start of the malloc block are stored in a header
+// before the returned address.
+static const std::size_t block_alignment = 64;
+static const std::size_t header_size = 2 * sizeof(std::size_t);
+
+void * plnmodels_tracked_alloc(std::size_t n_bytes) {
+    void * block = std::malloc(n_bytes + header_size + block_alignment - 1);
+    if(block == nullptr) {
+        return nullptr; // Armadillo throws std::bad_alloc
+    }
+    const auto start = reinterpret_cast<std::uintptr_t>(block);
+    const std::uintptr_t aligned = (start + header_size + block_alignment - 1) & ~std::uintptr_t(block_alignment - 1);
+    std::size_t * header = reinterpret_cast<std::size_t *>(aligned) - 2;
+    header[0] = n_bytes;
+    header[1] = std::size_t(aligned - start);
+    const auto bytes = std::int64_t(n_bytes);
+    raise_peak(bytes_in_use.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    allocated_bytes.fetch_add(n_bytes, std::memory_order_relaxed);
+    nb_allocations.fetch_add(1, std::memory_order_relaxed);
+    return reinterpret_cast<void *>(aligned);
+}
+
+void plnmodels_tracked_free(void * memory) {
+    if(memory == nullptr) {
+        return;
+    }
+    const std::size_t * header = static_cast<const std::size_t *>(memory) - 2;
+    bytes_in_use.fetch_sub(std::int64_t(header[0]), std::memory_order_relaxed);
+    std::free(static_cast<char *>(memory) - header[1]);
+}
+
+// ---------------------------------------------------------------------------------------
+// Scopes
+
+bool memory_tracking_enabled() {
+#ifdef PLNMODELS_NO_MEMORY_TRACKING
+    return false;
+#else
+    return true;
+#endif
+}
+
+std::int64_t tracked_bytes_in_use() {
+    return bytes_in_use.load(std::memory_order_relaxed);
+}
+
+MemoryScope::MemoryScope()
+    : start_in_use_(bytes_in_use.load(std::memory_order_relaxed)),
+      saved_peak_(peak_bytes_in_use.exchange(start_in_use_, std::memory_order_relaxed)),
+      start_allocated_(allocated_bytes.load(std::memory_order_relaxed)),
+      start_nb_allocations_(nb_allocations.load(std::memory_order_relaxed)) {}
+
+MemoryScope::~MemoryScope() {
+    raise_peak(saved_peak_);
+}
+
+MemoryUsage MemoryScope::usage() const {
+    if(!memory_tracking_enabled()) {
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        return MemoryUsage{nan, nan, nan};
+    }
+    return MemoryUsage{
+        double(peak_bytes_in_use.load(std::memory_order_relaxed) - start_in_use_),
+        double(allocated_bytes.load(std::memory_order_relaxed) - start_allocated_),
+        double(nb_allocations.load(std::memory_order_relaxed) - start_nb_allocations_),
+    };
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_memory_tracking() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    if(!memory_tracking_enabled()) {
+        const MemoryScope scope;
+        check(scope.usage().peak_bytes != scope.usage().peak_bytes, "memory tracking disabled");
+        return success;
+    }
+    const std::int64_t in_use = tracked_bytes_in_use();
+    const double matrix_bytes = 100. * 100. * sizeof(double);
+    const MemoryScope outer;
+    {
+        const MemoryScope inner;
+        {
+            arma::mat a(100, 100, arma::fill::zeros);
+            arma::mat b = a + 1.;
+            check(tracked_bytes_in_use() >= in_use + std::int64_t(2. * matrix_bytes), "memory in use");
+            check(reinterpret_cast<std::uintptr_t>(a.memptr()) % 64 == 0 &&
+                      reinterpret_cast<std::uintptr_t>(b.memptr()) % 64 == 0,
+                  "memory alignment");
+        }
+        const MemoryUsage usage = inner.usage();
+        check(usage.peak_bytes >= 2. * matrix_bytes && usage.peak_bytes < 3. * matrix_bytes, "memory inner peak");
+        check(usage.allocated_bytes >= 2. * matrix_bytes && usage.nb_allocations >= 2., "memory inner allocations");
+    }
+    {
+        const MemoryScope other;
+        arma::vec v(10000);
+        check(other.usage().peak_bytes >= 10000. * sizeof(double), "memory other peak");
+    }
+    // The peak of the outer scope is kept across nested scopes
+    const MemoryUsage usage = outer.usage();
+    check(usage.peak_bytes >= 2. * matrix_bytes, "memory outer peak");
+    check(usage.allocated_bytes >= 2. * matrix_bytes + 10000. * sizeof(double), "memory outer allocations");
+    check(tracked_bytes_in_use() == in_use, "memory released");
+    return success;
+}
+
+#endif
@@ -0,0 +1,43 @@
+// Accounting of the heap memory of the numerical core.
+//
+// Armadillo allocates the storage of its matrices through plnmodels_tracked_alloc and plnmodels_tracked_free (see
+// arma_backend.h), which count the bytes in use, the bytes allocated and the number of allocations of the process.
+// The hooks also align the storage on 64 bytes.
+// A MemoryScope reports these quantities for the code run during its lifetime: fits open one scope each, reported in
+// ModelFit::memory. Scopes may be nested, but concurrent fits in several threads of one process are all counted in
+// each of their scopes.
+// Only Armadillo storage is counted: small matrices stored inside their object (up to 16 elements), std containers,
+// and the memory of nlopt and of the BLAS are not. Defining PLNMODELS_NO_MEMORY_TRACKING removes the hooks at compile
+// time, and usages are then NaN.
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint>
+
+struct MemoryUsage {
+    double peak_bytes;      // Peak of the bytes in use during the scope, above those in use at its start
+    double allocated_bytes; // Sum of the sizes of the allocations of the scope
+    double nb_allocations;
+};
+
+// False if compiled with PLNMODELS_NO_MEMORY_TRACKING
+bool memory_tracking_enabled();
+// Bytes of Armadillo storage currently allocated in the process
+std::int64_t tracked_bytes_in_use();
+
+class MemoryScope {
+  public:
+    MemoryScope();
+    ~MemoryScope();
+    MemoryScope(const MemoryScope &) = delete;
+    MemoryScope & operator=(const MemoryScope &) = delete;
+
+    // Usage since construction
+    MemoryUsage usage() const;
+
+  private:
+    std::int64_t start_in_use_;
+    std::int64_t saved_peak_; // Peak of an enclosing scope, restored at destruction
+    std::uint64_t start_allocated_;
+    std::uint64_t start_nb_allocations_;
+};
@@ -0,0 +1,876 @@
+#include "models.h"
+
+#include <algorithm> // max
+#include <functional>
+#include <memory> // unique_ptr
+#include <stdexcept>
+#include <string>
+#include <utility> // move
+
+#include "log_parametrization.h"
+#include "packer.h"
+#include "simd.h"
+#include "trace.h"
+
+inline arma::vec ki(const CountMatrix & y) {
+    arma::uword p = y.n_cols;
+    return -y.logfact() + 0.5 * (1. + (1. - double(p)) * std::log(2. * M_PI));
+}
+
+// ---------------------------------------------------------------------------------------
+// Options
+
+FitOptions FitOptions::defaults() {
+    FitOptions options;
+    options.optimizer = OptimizerConfiguration{
+        NLOPT_LD_CCSAQ,
+        arma::vec(), // xtol_abs, see optimizer_for()
+        1e-4,        // xtol_rel
+        0.,          // ftol_abs
+        1e-8,        // ftol_rel
+        10000,       // maxeval
+        -1.,         // maxtime
+        OptimizerEngine::Nlopt,
+        false, // diagonal_scaling
+        0,     // scaling_refresh
+        30,    // auto_probe_maxeval
+        1.,    // auto_probe_maxtime
+        "",    // shape_key
+    };
+    options.parameter_xtol_abs.value = 0.;
+    options.row_weight_threshold = 0.;
+    options.precision = Precision::Double;
+    options.log_S = false;
+    options.ve_engine = VeEngine::Nlopt;
+    options.ve_newton.ftol_rel = options.optimizer.ftol_rel;
+    options.ve_newton.xtol_rel = options.optimizer.xtol_rel;
+    options.ve_newton.maxiter = options.optimizer.maxeval;
+    options.ve_newton.block_size = 256;
+    options.lbfgs.memory = 10;
+    options.lbfgs.xtol_rel = options.optimizer.xtol_rel;
+    options.lbfgs.ftol_rel = options.optimizer.ftol_rel;
+    options.lbfgs.gtol_abs = 0.;
+    options.lbfgs.maxeval = options.optimizer.maxeval;
+    options.multistart.round_evaluations = 50;
+    options.multistart.nb_threads = 1;
+    options.multistart.converge_winner = false; // The winner is optimized with the configuration of the fit
+    options.numa.nb_workers = 0;
+    options.numa.pin = true;
+    options.perf_counters = false;
+    return options;
+}
+
+OptimizerConfiguration FitOptions::optimizer_for(arma::uword size) const {
+    OptimizerConfiguration config = optimizer;
+    config.xtol_abs = arma::vec(size);
+    config.xtol_abs.fill(parameter_xtol_abs.value);
+    config.shape_key += ":" + std::to_string(size);
+    return config;
+}
+
+// Fitted values of the packed parameter Index for all rows (see ActiveRows::expand), unpacked straight into values
+// when all rows are active
+template <std::size_t Index, typename P>
+static void unpack_rows(
+    const P & packer,
+    const arma::vec & parameters,
+    const ActiveRows & rows,
+    const arma::mat & initial_values,
+    arma::mat & values //
+) {
+    if(rows.all()) {
+        packer.template unpack_into<Index>(parameters, values);
+    } else {
+        values = rows.expand(packer.template unpack<Index>(parameters), initial_values);
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Fully parametrized covariance
+
+ModelFit optimize_full(
+    const ModelParameters & init, // Theta, M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const FitOptions & options,
+    ModelParameters * outputs
+) {
+    PLNMODELS_TRACE_SPAN("optimize_full", "fit");
+    const MemoryScope memory_scope;
+    // Prepare optimization
+    const auto design = Design<double>(X, w);
+    const arma::mat & init_Theta = init.Theta; // (p,d)
+    const arma::mat & init_M = init.M;         // (n,p)
+    const arma::mat & init_S = init.S;         // (n,p)
+
+    // Optimization on the rows with non negligible weights (see ActiveRows)
+    const auto rows = ActiveRows(w, options.row_weight_threshold);
+    const ActiveData active(rows, Y, O, X, w);
+    const auto active_M = rows.restrict(init_M);
+    const auto active_S = rows.restrict(init_S);
+
+    const auto packer = make_aligned_packer(init_Theta, active_M, active_S);
+    enum { THETA_ID, M_ID, S_ID }; // Names for packer indexes
+
+    auto parameters = arma::vec(packer.size);
+    packer.pack<THETA_ID>(parameters, init_Theta);
+    packer.pack<M_ID>(parameters, active_M);
+    packer.pack<S_ID>(parameters, active_S);
+
+    auto config = options.optimizer_for(packer.size);
+    options.parameter_xtol_abs.pack<THETA_ID>(packer, config.xtol_abs, "Theta");
+    options.parameter_xtol_abs.pack<M_ID>(packer, config.xtol_abs, "M");
+    options.parameter_xtol_abs.pack<S_ID>(packer, config.xtol_abs, "S");
+    const auto log_S = LogParametrization(packer.segment<S_ID>(), options.log_S);
+    PerfRecorder perf(options.perf_counters);
+
+    const double w_bar = accu(active.w);
+
+    // Optimize
+    auto objective_and_grad =
+        [&packer, &active, &w_bar](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+        arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+        arma::mat M = packer.unpack<M_ID>(parameters);
+        arma::mat S = packer.unpack<S_ID>(parameters);
+
+        arma::mat S2 = S % S;
+        arma::mat Z = active.O.plus(active.design.times_transposed(Theta) + M);
+        arma::mat A = fast_exp(Z + 0.5 * S2);
+        arma::mat Omega = w_bar * inv_sympd(M.t() * (M.each_col() % active.w) + diagmat(active.w.t() * S2));
+        double objective = accu(active.w.t() * (A - 0.5 * fast_log(S2))) - active.Y.weighted_dot(active.w, Z) -
+                           0.5 * w_bar * real(log_det(Omega));
+
+        arma::mat R = active.Y.subtract_from(A);
+        packer.pack<THETA_ID>(grad_storage, active.design.weighted_crossprod(R));
+        packer.pack<M_ID>(grad_storage, diagmat(active.w) * (M * Omega + R));
+        packer.pack<S_ID>(grad_storage, diagmat(active.w) * (S.each_row() % diagvec(Omega).t() + S % A - pow(S, -1)));
+        return objective;
+    };
+    // Hessian with Omega frozen at its current value, for NEWTON_CG
+    auto hessian_at =
+        [&packer, &active, &w_bar](const arma::vec & parameters, arma::vec & diagonal) -> HessianVectorProduct {
+        const arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+        const arma::mat M = packer.unpack<M_ID>(parameters);
+        const arma::mat S = packer.unpack<S_ID>(parameters);
+
+        const arma::mat S2 = S % S;
+        const arma::mat A = fast_exp(active.O.plus(active.design.times_transposed(Theta) + M) + 0.5 * S2);
+        const arma::mat Omega = w_bar * inv_sympd(M.t() * (M.each_col() % active.w) + diagmat(active.w.t() * S2));
+        const arma::rowvec omega2 = diagvec(Omega).t();
+        packer.pack<THETA_ID>(diagonal, active.design.weighted_square_crossprod(A));
+        const arma::mat hessian_S = A % (1. + S2) + 1. / S2;
+        packer.pack<M_ID>(diagonal, diagmat(active.w) * (A.each_row() + omega2));
+        packer.pack<S_ID>(diagonal, diagmat(active.w) * (hessian_S.each_row() + omega2));
+
+        return [&packer, &active, S, S2, A, Omega, omega2](const arma::vec & direction, arma::vec & product) {
+            const arma::mat dTheta = packer.unpack<THETA_ID>(direction);
+            const arma::mat dM = packer.unpack<M_ID>(direction);
+            const arma::mat dS = packer.unpack<S_ID>(direction);
+            const arma::mat AU = A % (active.design.times_transposed(dTheta) + dM + S % dS);
+            packer.pack<THETA_ID>(product, active.design.weighted_crossprod(AU));
+            packer.pack<M_ID>(product, diagmat(active.w) * (AU + dM * Omega));
+            packer.pack<S_ID>(product, diagmat(active.w) * (S % AU + A % dS + dS.each_row() % omega2 + dS / S2));
+        };
+    };
+    OptimizerResult result =
+        log_S.minimize(parameters, config, perf.wrap(objective_and_grad), perf.wrap(hessian_at));
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Variational parameters
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    unpack_rows<M_ID>(packer, parameters, rows, init_M, M);
+    unpack_rows<S_ID>(packer, parameters, rows, init_S, S);
+    arma::mat S2 = S % S;
+    // Regression parameters
+    arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+    // Variance parameters
+    arma::mat Sigma = (1. / w_bar) * (M.t() * (M.each_col() % w) + diagmat(sum(S2.each_col() % w, 0)));
+    arma::mat Omega = inv_sympd(Sigma);
+    // Element-wise log-likehood
+    arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+    arma::mat A = exp(Z + 0.5 * S2);
+    arma::vec loglik = sum(Y.schur(Z) - A + 0.5 * log(S2) - 0.5 * ((M * Omega) % M + S2 * diagmat(Omega)), 1) +
+                       0.5 * real(log_det(Omega)) + ki(Y);
+
+    fit.result = result;
+    fit.perf_counts = perf.finish("full");
+    fit.Theta = std::move(Theta);
+    fit.Z = std::move(Z);
+    fit.A = std::move(A);
+    fit.Sigma = std::move(Sigma);
+    fit.Omega = std::move(Omega);
+    fit.loglik = std::move(loglik);
+    fit.memory = memory_scope.usage();
+    return fit;
+}
+
+// ---------------------------------------------------------------------------------------
+// Spherical covariance
+
+ModelFit optimize_spherical(
+    const ModelParameters & init, // Theta, M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const FitOptions & options,
+    ModelParameters * outputs
+) {
+    PLNMODELS_TRACE_SPAN("optimize_spherical", "fit");
+    const MemoryScope memory_scope;
+    // Prepare optimization
+    const auto design = Design<double>(X, w);
+    const arma::mat & init_Theta = init.Theta; // (p,d)
+    const arma::mat & init_M = init.M;         // (n,p)
+    const auto init_S = arma::vec(init.S);     // (n)
+
+    // Optimization on the rows with non negligible weights (see ActiveRows)
+    const auto rows = ActiveRows(w, options.row_weight_threshold);
+    const ActiveData active(rows, Y, O, X, w);
+    const auto active_M = rows.restrict(init_M);
+    const auto active_S = rows.restrict(init_S);
+
+    const auto packer = make_aligned_packer(init_Theta, active_M, active_S);
+    enum { THETA_ID, M_ID, S_ID }; // Names for packer indexes
+
+    auto parameters = arma::vec(packer.size);
+    packer.pack<THETA_ID>(parameters, init_Theta);
+    packer.pack<M_ID>(parameters, active_M);
+    packer.pack<S_ID>(parameters, active_S);
+
+    auto config = options.optimizer_for(packer.size);
+    options.parameter_xtol_abs.pack<THETA_ID>(packer, config.xtol_abs, "Theta");
+    options.parameter_xtol_abs.pack<M_ID>(packer, config.xtol_abs, "M");
+    options.parameter_xtol_abs.pack<S_ID>(packer, config.xtol_abs, "S");
+    const auto log_S = LogParametrization(packer.segment<S_ID>(), options.log_S);
+    PerfRecorder perf(options.perf_counters);
+
+    const double w_bar = accu(active.w);
+
+    // Optimize
+    auto objective_and_grad =
+        [&packer, &active, &w_bar](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+        arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+        arma::mat M = packer.unpack<M_ID>(parameters);
+        arma::vec S = packer.unpack<S_ID>(parameters);
+
+        arma::vec S2 = S % S;
+        const arma::uword p = active.Y.n_cols;
+        arma::mat Z = active.O.plus(active.design.times_transposed(Theta) + M);
+        arma::mat A;
+        const double wA = fast_exp_weighted_sum(Z.each_col() + 0.5 * S2, active.w, A); // A and accu(diagmat(w) * A)
+        double sigma2 = arma::as_scalar(accu(M % (M.each_col() % active.w)) / (w_bar * double(p)) +
+                                        accu(active.w % S2) / w_bar);
+        double objective = wA - active.Y.weighted_dot(active.w, Z) -
+                           0.5 * double(p) * accu(active.w % fast_log(S2)) + 0.5 * w_bar * double(p) * log(sigma2);
+
+        arma::mat R = active.Y.subtract_from(A);
+        packer.pack<THETA_ID>(grad_storage, active.design.weighted_crossprod(R));
+        packer.pack<M_ID>(grad_storage, diagmat(active.w) * (M / sigma2 + R));
+        packer.pack<S_ID>(grad_storage, active.w % (S % sum(A, 1) - double(p) * pow(S, -1) - double(p) * S / sigma2));
+        return objective;
+    };
+    // Hessian with sigma2 frozen at its current value, for NEWTON_CG
+    auto hessian_at =
+        [&packer, &active, &w_bar](const arma::vec & parameters, arma::vec & diagonal) -> HessianVectorProduct {
+        const arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+        const arma::mat M = packer.unpack<M_ID>(parameters);
+        const arma::vec S = packer.unpack<S_ID>(parameters);
+
+        const arma::vec S2 = S % S;
+        const double p = double(active.Y.n_cols);
+        const arma::mat Z = active.O.plus(active.design.times_transposed(Theta) + M);
+        const arma::mat A = fast_exp(Z.each_col() + 0.5 * S2);
+        const arma::vec sum_A = sum(A, 1);
+        const double sigma2 = (accu(M % (M.each_col() % active.w)) / p + accu(active.w % S2)) / w_bar;
+        packer.pack<THETA_ID>(diagonal, active.design.weighted_square_crossprod(A));
+        packer.pack<M_ID>(diagonal, diagmat(active.w) * (A + 1. / sigma2));
+        packer.pack<S_ID>(diagonal, active.w % (sum_A % (1. + S2) + p / sigma2 + p / S2));
+
+        return [&packer, &active, S, S2, A, sum_A, sigma2, p](const arma::vec & direction, arma::vec & product) {
+            const arma::mat dTheta = packer.unpack<THETA_ID>(direction);
+            const arma::mat dM = packer.unpack<M_ID>(direction);
+            const arma::vec dS = packer.unpack<S_ID>(direction);
+            const arma::mat U = active.design.times_transposed(dTheta) + dM;
+            const arma::mat AU = A % (U.each_col() + S % dS);
+            packer.pack<THETA_ID>(product, active.design.weighted_crossprod(AU));
+            packer.pack<M_ID>(product, diagmat(active.w) * (AU + dM / sigma2));
+            packer.pack<S_ID>(product, active.w % (S % sum(AU, 1) + dS % sum_A + p * dS / sigma2 + p * dS / S2));
+        };
+    };
+    OptimizerResult result;
+    if(options.precision == Precision::Single) {
+        const auto data = SinglePrecisionData(active.design, active.O, active.w);
+        auto objective_and_grad_single =
+            [&packer, &active, &data, &w_bar](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+            arma::fmat Theta = arma::conv_to<arma::fmat>::from(packer.unpack<THETA_ID>(parameters));
+            arma::fmat M = arma::conv_to<arma::fmat>::from(packer.unpack<M_ID>(parameters));
+            arma::fvec S = arma::conv_to<arma::fvec>::from(packer.unpack<S_ID>(parameters));
+
+            arma::fvec S2 = S % S;
+            const arma::uword p = active.Y.n_cols;
+            arma::fmat Z = data.O.plus(data.X.times_transposed(Theta) + M);
+            arma::fmat A = exp(Z.each_col() + 0.5f * S2);
+            arma::vec S2_d = arma::conv_to<arma::vec>::from(S2);
+            double sigma2 = (weighted_accu<float>(active.w, M % M) / double(p) + dot(active.w, S2_d)) / w_bar;
+            double objective = weighted_accu(active.w, A) - active.Y.weighted_dot(active.w, Z) -
+                               0.5 * double(p) * dot(active.w, log(S2_d)) + 0.5 * w_bar * double(p) * log(sigma2);
+
+            arma::fmat R = active.Y.subtract_from(A);
+            arma::vec S_d = arma::conv_to<arma::vec>::from(S);
+            packer.pack<THETA_ID>(grad_storage, data.X.weighted_crossprod(R));
+            packer.pack<M_ID>(grad_storage, arma::conv_to<arma::mat>::from(diagmat(data.w) * (M / float(sigma2) + R)));
+            packer.pack<S_ID>(
+                grad_storage,
+                active.w % (S_d % rowsums_double(A) - double(p) * pow(S_d, -1) - double(p) * S_d / sigma2));
+            return objective;
+        };
+        result =
+            log_S.minimize(parameters, config, perf.wrap(objective_and_grad_single), perf.wrap(hessian_at));
+    } else {
+        result =
+            log_S.minimize(parameters, config, perf.wrap(objective_and_grad), perf.wrap(hessian_at));
+    }
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Variational parameters
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    unpack_rows<M_ID>(packer, parameters, rows, init_M, M);
+    unpack_rows<S_ID>(packer, parameters, rows, init_S, S); // vec(n) -> mat(n, 1)
+    arma::vec S2 = S % S;
+    // Regression parameters
+    arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+    // Variance parameters
+    const arma::uword p = Y.n_cols;
+    const double n_sigma2 = arma::as_scalar(dot(w, sum(pow(M, 2), 1) + double(p) * S2));
+    const double sigma2 = n_sigma2 / (double(p) * w_bar);
+    arma::mat Sigma = arma::eye(p, p) * sigma2;
+    arma::mat Omega = arma::eye(p, p) * pow(sigma2, -1);
+    // Element-wise log-likelihood
+    arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+    arma::mat A = exp(Z.each_col() + 0.5 * S2);
+    arma::mat loglik = sum(Y.schur(Z) - A - 0.5 * pow(M, 2) / sigma2, 1) - 0.5 * double(p) * S2 / sigma2 +
+                       0.5 * double(p) * log(S2 / sigma2) + ki(Y);
+
+    fit.result = result;
+    fit.perf_counts = perf.finish("spherical");
+    fit.Theta = std::move(Theta);
+    fit.Z = std::move(Z);
+    fit.A = std::move(A);
+    fit.Sigma = std::move(Sigma);
+    fit.Omega = std::move(Omega);
+    fit.loglik = std::move(loglik);
+    fit.memory = memory_scope.usage();
+    return fit;
+}
+
+// ---------------------------------------------------------------------------------------
+// Diagonal covariance
+
+ModelFit optimize_diagonal(
+    const ModelParameters & init, // Theta, M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const FitOptions & options,
+    ModelParameters * outputs
+) {
+    PLNMODELS_TRACE_SPAN("optimize_diagonal", "fit");
+    const MemoryScope memory_scope;
+    // Prepare optimization
+    const auto design = Design<double>(X, w);
+    const arma::mat & init_Theta = init.Theta; // (p,d)
+    const arma::mat & init_M = init.M;         // (n,p)
+    const arma::mat & init_S = init.S;         // (n,p)
+
+    // Optimization on the rows with non negligible weights (see ActiveRows)
+    const auto rows = ActiveRows(w, options.row_weight_threshold);
+    const ActiveData active(rows, Y, O, X, w);
+    const auto active_M = rows.restrict(init_M);
+    const auto active_S = rows.restrict(init_S);
+
+    const auto packer = make_aligned_packer(init_Theta, active_M, active_S);
+    enum { THETA_ID, M_ID, S_ID }; // Names for packer indexes
+
+    auto parameters = arma::vec(packer.size);
+    packer.pack<THETA_ID>(parameters, init_Theta);
+    packer.pack<M_ID>(parameters, active_M);
+    packer.pack<S_ID>(parameters, active_S);
+
+    auto config = options.optimizer_for(packer.size);
+    options.parameter_xtol_abs.pack<THETA_ID>(packer, config.xtol_abs, "Theta");
+    options.parameter_xtol_abs.pack<M_ID>(packer, config.xtol_abs, "M");
+    options.parameter_xtol_abs.pack<S_ID>(packer, config.xtol_abs, "S");
+    const auto log_S = LogParametrization(packer.segment<S_ID>(), options.log_S);
+    PerfRecorder perf(options.perf_counters);
+
+    const double w_bar = accu(active.w);
+
+    // Optimize
+    auto objective_and_grad =
+        [&packer, &active, &w_bar](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+        arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+        arma::mat M = packer.unpack<M_ID>(parameters);
+        arma::mat S = packer.unpack<S_ID>(parameters);
+
+        arma::mat S2 = S % S;
+        arma::mat Z = active.O.plus(active.design.times_transposed(Theta) + M);
+        arma::mat A = fast_exp(Z + 0.5 * S2);
+        arma::rowvec diag_sigma = sum(M % (M.each_col() % active.w) + (S2.each_col() % active.w), 0) / w_bar;
+        double objective = accu(diagmat(active.w) * (A - 0.5 * fast_log(S2))) - active.Y.weighted_dot(active.w, Z) +
+                           0.5 * w_bar * accu(log(diag_sigma));
+
+        arma::mat R = active.Y.subtract_from(A);
+        packer.pack<THETA_ID>(grad_storage, active.design.weighted_crossprod(R));
+        packer.pack<M_ID>(grad_storage, diagmat(active.w) * ((M.each_row() / diag_sigma) + R));
+        packer.pack<S_ID>(grad_storage, diagmat(active.w) * (S.each_row() % pow(diag_sigma, -1) + S % A - pow(S, -1)));
+        return objective;
+    };
+    // Hessian with the variances frozen at their current value, for NEWTON_CG
+    auto hessian_at =
+        [&packer, &active, &w_bar](const arma::vec & parameters, arma::vec & diagonal) -> HessianVectorProduct {
+        const arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+        const arma::mat M = packer.unpack<M_ID>(parameters);
+        const arma::mat S = packer.unpack<S_ID>(parameters);
+
+        const arma::mat S2 = S % S;
+        const arma::mat A = fast_exp(active.O.plus(active.design.times_transposed(Theta) + M) + 0.5 * S2);
+        const arma::rowvec omega2 = w_bar / sum(M % (M.each_col() % active.w) + (S2.each_col() % active.w), 0);
+        packer.pack<THETA_ID>(diagonal, active.design.weighted_square_crossprod(A));
+        const arma::mat hessian_S = A % (1. + S2) + 1. / S2;
+        packer.pack<M_ID>(diagonal, diagmat(active.w) * (A.each_row() + omega2));
+        packer.pack<S_ID>(diagonal, diagmat(active.w) * (hessian_S.each_row() + omega2));
+
+        return [&packer, &active, S, S2, A, omega2](const arma::vec & direction, arma::vec & product) {
+            const arma::mat dTheta = packer.unpack<THETA_ID>(direction);
+            const arma::mat dM = packer.unpack<M_ID>(direction);
+            const arma::mat dS = packer.unpack<S_ID>(direction);
+            const arma::mat AU = A % (active.design.times_transposed(dTheta) + dM + S % dS);
+            packer.pack<THETA_ID>(product, active.design.weighted_crossprod(AU));
+            packer.pack<M_ID>(product, diagmat(active.w) * (AU + dM.each_row() % omega2));
+            packer.pack<S_ID>(product, diagmat(active.w) * (S % AU + A % dS + dS.each_row() % omega2 + dS / S2));
+        };
+    };
+    OptimizerResult result;
+    if(options.precision == Precision::Single) {
+        const auto data = SinglePrecisionData(active.design, active.O, active.w);
+        auto objective_and_grad_single =
+            [&packer, &active, &data, &w_bar](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+            arma::fmat Theta = arma::conv_to<arma::fmat>::from(packer.unpack<THETA_ID>(parameters));
+            arma::fmat M = arma::conv_to<arma::fmat>::from(packer.unpack<M_ID>(parameters));
+            arma::fmat S = arma::conv_to<arma::fmat>::from(packer.unpack<S_ID>(parameters));
+
+            arma::fmat S2 = S % S;
+            arma::fmat Z = data.O.plus(data.X.times_transposed(Theta) + M);
+            arma::fmat A = exp(Z + 0.5f * S2);
+            arma::rowvec diag_sigma = weighted_colsums<float>(active.w, M % M + S2) / w_bar;
+            double objective = weighted_accu<float>(active.w, A - 0.5f * log(S2)) - active.Y.weighted_dot(active.w, Z) +
+                               0.5 * w_bar * accu(log(diag_sigma));
+
+            arma::fmat R = active.Y.subtract_from(A);
+            arma::frowvec diag_omega = arma::conv_to<arma::frowvec>::from(pow(diag_sigma, -1));
+            packer.pack<THETA_ID>(grad_storage, data.X.weighted_crossprod(R));
+            packer.pack<M_ID>(
+                grad_storage, arma::conv_to<arma::mat>::from(diagmat(data.w) * ((M.each_row() % diag_omega) + R)));
+            packer.pack<S_ID>(
+                grad_storage,
+                arma::conv_to<arma::mat>::from(diagmat(data.w) * (S.each_row() % diag_omega + S % A - pow(S, -1))));
+            return objective;
+        };
+        result =
+            log_S.minimize(parameters, config, perf.wrap(objective_and_grad_single), perf.wrap(hessian_at));
+    } else {
+        result =
+            log_S.minimize(parameters, config, perf.wrap(objective_and_grad), perf.wrap(hessian_at));
+    }
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Variational parameters
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    unpack_rows<M_ID>(packer, parameters, rows, init_M, M);
+    unpack_rows<S_ID>(packer, parameters, rows, init_S, S);
+    arma::mat S2 = S % S;
+    // Regression parameters
+    arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+    // Variance parameters
+    arma::rowvec sigma2 = w.t() * (pow(M, 2) + S2) / w_bar;
+    arma::vec omega2 = pow(sigma2.t(), -1);
+    arma::mat Sigma = diagmat(sigma2);
+    arma::mat Omega = diagmat(omega2);
+    // Element-wise log-likelihood
+    arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+    arma::mat A = exp(Z + 0.5 * S2);
+    arma::mat loglik =
+        sum(Y.schur(Z) - A + 0.5 * log(S2), 1) - 0.5 * (pow(M, 2) + S2) * omega2 + 0.5 * sum(log(omega2)) + ki(Y);
+
+    fit.result = result;
+    fit.perf_counts = perf.finish("diagonal");
+    fit.Theta = std::move(Theta);
+    fit.Z = std::move(Z);
+    fit.A = std::move(A);
+    fit.Sigma = std::move(Sigma);
+    fit.Omega = std::move(Omega);
+    fit.loglik = std::move(loglik);
+    fit.memory = memory_scope.usage();
+    return fit;
+}
+
+// ---------------------------------------------------------------------------------------
+// Rank-constrained covariance
+
+// Rank (q) is already determined by param dimensions ; not passed anywhere
+
+ModelFit optimize_rank(
+    const ModelParameters & init, // Theta, B, M, S
+    const std::vector<ModelParameters> & starts,
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const FitOptions & options,
+    ModelParameters * outputs
+) {
+    PLNMODELS_TRACE_SPAN("optimize_rank", "fit");
+    const MemoryScope memory_scope;
+    // Prepare optimization
+    const auto design = Design<double>(X, w);
+    const arma::mat & init_Theta = init.Theta; // (p,d)
+    const arma::mat & init_B = init.B;         // (p,q)
+    const arma::mat & init_M = init.M;         // (n,q)
+    const arma::mat & init_S = init.S;         // (n,q)
+
+    // Optimization on the rows with non negligible weights (see ActiveRows)
+    const auto rows = ActiveRows(w, options.row_weight_threshold);
+    const ActiveData active(rows, Y, O, X, w);
+    const auto active_M = rows.restrict(init_M);
+    const auto active_S = rows.restrict(init_S);
+
+    const auto packer = make_aligned_packer(init_Theta, init_B, active_M, active_S);
+    enum { THETA_ID, B_ID, M_ID, S_ID }; // Names for packer indexes
+
+    // Optional NUMA-aware row-parallel evaluation: data of each block of rows is first-touched by the pinned worker
+    // owning it; variational parameters live in nlopt buffers and are read remotely (see numa.h)
+    std::unique_ptr<NumaRowBlocks> numa;
+    if(options.numa.nb_workers > 0) {
+        if(options.precision == Precision::Single) {
+            throw std::invalid_argument("config[numa_workers] is not supported in single precision");
+        }
+        numa.reset(new NumaRowBlocks(options.numa, active.Y, active.O, rows.restrict(X), active.w));
+    }
+
+    auto parameters = arma::vec(packer.size, arma::fill::none);
+    packer.pack<THETA_ID>(parameters, init_Theta);
+    packer.pack<B_ID>(parameters, init_B);
+    packer.pack<M_ID>(parameters, active_M);
+    packer.pack<S_ID>(parameters, active_S);
+
+    auto config = options.optimizer_for(packer.size);
+    options.parameter_xtol_abs.pack<THETA_ID>(packer, config.xtol_abs, "Theta");
+    options.parameter_xtol_abs.pack<B_ID>(packer, config.xtol_abs, "B");
+    options.parameter_xtol_abs.pack<M_ID>(packer, config.xtol_abs, "M");
+    options.parameter_xtol_abs.pack<S_ID>(packer, config.xtol_abs, "S");
+    const auto log_S = LogParametrization(packer.segment<S_ID>(), options.log_S);
+    PerfRecorder perf(options.perf_counters);
+
+    // Optional additional starts raced against init (see multistart.h)
+    std::vector<MultistartCandidate> multistart; // Empty without starts
+    auto optimize = [&](const PerfRecorder::ObjectiveAndGrad & unmeasured_fn) -> OptimizerResult {
+        const auto fn = perf.wrap(unmeasured_fn);
+        if(starts.empty()) {
+            return log_S.minimize(parameters, config, fn);
+        }
+        auto packed_starts = std::vector<arma::vec>{parameters};
+        for(const ModelParameters & start : starts) {
+            auto packed = arma::vec(packer.size);
+            packer.pack<THETA_ID>(packed, start.Theta);
+            packer.pack<B_ID>(packed, start.B);
+            packer.pack<M_ID>(packed, rows.restrict(start.M));
+            packer.pack<S_ID>(packed, rows.restrict(start.S));
+            packed_starts.push_back(std::move(packed));
+        }
+        const MultistartResult race = race_multistart(packed_starts, options.lbfgs, options.multistart, fn);
+        parameters = race.solution;
+        multistart = race.candidates;
+        // The race only uses L-BFGS and stops when a single candidate is left: the winner is then optimized to
+        // convergence with the options of the fit (algorithm, log_S, scaling, xtol_abs, maxtime)
+        OptimizerResult result = log_S.minimize(parameters, config, fn);
+        result.nb_iterations += race.candidates[race.winner].nb_evaluations;
+        return result;
+    };
+
+    // Optimize
+    auto objective_and_grad = [&packer, &active](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+        arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+        arma::mat B = packer.unpack<B_ID>(parameters);
+        arma::mat M = packer.unpack<M_ID>(parameters);
+        arma::mat S = packer.unpack<S_ID>(parameters);
+
+        arma::mat S2 = S % S;
+        arma::mat Z = active.O.plus(active.design.times_transposed(Theta) + M * B.t());
+        arma::mat A;
+        const double wA = fast_exp_weighted_sum(Z + 0.5 * S2 * (B % B).t(), active.w, A); // A and accu(diagmat(w) * A)
+        double objective = wA - active.Y.weighted_dot(active.w, Z) +
+                           0.5 * accu(diagmat(active.w) * (M % M + S2 - fast_log(S2) - 1.));
+
+        arma::mat R = active.Y.subtract_from(A);
+        packer.pack<THETA_ID>(grad_storage, active.design.weighted_crossprod(R));
+        packer.pack<B_ID>(grad_storage, (diagmat(active.w) * R).t() * M + (A.t() * (S2.each_col() % active.w)) % B);
+        packer.pack<M_ID>(grad_storage, diagmat(active.w) * (R * B + M));
+        packer.pack<S_ID>(grad_storage, diagmat(active.w) * (S - 1. / S + A * (B % B) % S));
+        return objective;
+    };
+    OptimizerResult result;
+    if(options.precision == Precision::Single) {
+        const auto data = SinglePrecisionData(active.design, active.O, active.w);
+        auto objective_and_grad_single =
+            [&packer, &active, &data](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+            arma::fmat Theta = arma::conv_to<arma::fmat>::from(packer.unpack<THETA_ID>(parameters));
+            arma::fmat B = arma::conv_to<arma::fmat>::from(packer.unpack<B_ID>(parameters));
+            arma::fmat M = arma::conv_to<arma::fmat>::from(packer.unpack<M_ID>(parameters));
+            arma::fmat S = arma::conv_to<arma::fmat>::from(packer.unpack<S_ID>(parameters));
+
+            arma::fmat S2 = S % S;
+            arma::fmat Z = data.O.plus(data.X.times_transposed(Theta) + M * B.t());
+            arma::fmat A = exp(Z + 0.5f * S2 * (B % B).t());
+            double objective = weighted_accu(active.w, A) - active.Y.weighted_dot(active.w, Z) +
+                               0.5 * weighted_accu<float>(active.w, M % M + S2 - log(S2) - 1.f);
+
+            arma::fmat R = active.Y.subtract_from(A);
+            arma::fmat wR = diagmat(data.w) * R;
+            arma::fmat wS2 = S2.each_col() % data.w;
+            packer.pack<THETA_ID>(grad_storage, data.X.weighted_crossprod(R));
+            packer.pack<B_ID>(
+                grad_storage,
+                crossprod_double(wR, M) + crossprod_double(A, wS2) % arma::conv_to<arma::mat>::from(B));
+            packer.pack<M_ID>(grad_storage, arma::conv_to<arma::mat>::from(wR * B + diagmat(data.w) * M));
+            packer.pack<S_ID>(
+                grad_storage, arma::conv_to<arma::mat>::from(diagmat(data.w) * (S - 1.f / S + A * (B % B) % S)));
+            return objective;
+        };
+        result = optimize(objective_and_grad_single);
+    } else if(numa) {
+        // Same objective, as a sum over row blocks evaluated by their owners. Gradients of M and S are written
+        // in place by each worker, Theta and B gradients are reduced over blocks.
+        const arma::uword n = active.Y.n_rows;
+        auto objective_and_grad_numa = [&](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+            const arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+            const arma::mat B = packer.unpack<B_ID>(parameters);
+            const arma::mat B2t = (B % B).t();
+            PinnedWorkers & workers = numa->workers();
+            auto objectives = std::vector<double>(workers.size());
+            auto grad_Theta = std::vector<arma::mat>(workers.size());
+            auto grad_B = std::vector<arma::mat>(workers.size());
+            workers.run([&](std::size_t k) {
+                const RowBlock & block = numa->block(k);
+                const arma::uword first = workers.first_row(k);
+                const arma::uword last = workers.last_row(k);
+                arma::mat M = gather_rows(parameters, packer.segment<M_ID>(), n, first, last);
+                arma::mat S = gather_rows(parameters, packer.segment<S_ID>(), n, first, last);
+
+                arma::mat S2 = S % S;
+                arma::mat Z = block.O.plus(block.design.times_transposed(Theta) + M * B.t());
+                arma::mat A;
+                const double wA = fast_exp_weighted_sum(Z + 0.5 * S2 * B2t, block.w, A);
+                objectives[k] = wA - block.Y.weighted_dot(block.w, Z) +
+                                0.5 * accu(diagmat(block.w) * (M % M + S2 - fast_log(S2) - 1.));
+
+                arma::mat R = block.Y.subtract_from(A);
+                grad_Theta[k] = block.design.weighted_crossprod(R);
+                grad_B[k] = (diagmat(block.w) * R).t() * M + (A.t() * (S2.each_col() % block.w)) % B;
+                scatter_rows(grad_storage, packer.segment<M_ID>(), n, first, diagmat(block.w) * (R * B + M));
+                scatter_rows(
+                    grad_storage, packer.segment<S_ID>(), n, first, diagmat(block.w) * (S - 1. / S + A * (B % B) % S));
+            });
+            packer.clear_padding<M_ID>(grad_storage);
+            packer.clear_padding<S_ID>(grad_storage);
+            double objective = 0.;
+            arma::mat Theta_gradient = arma::zeros<arma::mat>(Theta.n_rows, Theta.n_cols);
+            arma::mat B_gradient = arma::zeros<arma::mat>(B.n_rows, B.n_cols);
+            for(std::size_t k = 0; k < workers.size(); k += 1) {
+                objective += objectives[k];
+                Theta_gradient += grad_Theta[k];
+                B_gradient += grad_B[k];
+            }
+            packer.pack<THETA_ID>(grad_storage, Theta_gradient);
+            packer.pack<B_ID>(grad_storage, B_gradient);
+            return objective;
+        };
+        result = optimize(objective_and_grad_numa);
+    } else {
+        result = optimize(objective_and_grad);
+    }
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Model and variational parameters
+    arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+    arma::mat B = packer.unpack<B_ID>(parameters);
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    unpack_rows<M_ID>(packer, parameters, rows, init_M, M);
+    unpack_rows<S_ID>(packer, parameters, rows, init_S, S);
+    arma::mat S2 = S % S;
+    arma::mat Sigma = B * (M.t() * (M.each_col() % w) + diagmat(sum(S2.each_col() % w, 0))) * B.t() / accu(w);
+    // Element-wise log-likelihood
+    arma::mat Z = O.plus(design.times_transposed(Theta) + M * B.t());
+    arma::mat A = exp(Z + 0.5 * S2 * (B % B).t());
+    arma::mat loglik = arma::sum(Y.schur(Z) - A, 1) - 0.5 * sum(M % M + S2 - log(S2) - 1., 1) + ki(Y);
+
+    fit.result = result;
+    fit.perf_counts = perf.finish("rank");
+    fit.Theta = std::move(Theta);
+    fit.B = std::move(B);
+    fit.Z = std::move(Z);
+    fit.A = std::move(A);
+    fit.Sigma = std::move(Sigma);
+    fit.loglik = std::move(loglik);
+    fit.multistart = std::move(multistart);
+    fit.memory = memory_scope.usage();
+    return fit;
+}
+
+// ---------------------------------------------------------------------------------------
+// Sparse inverse covariance
+
+ModelFit optimize_sparse(
+    const ModelParameters & init, // Theta, M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const arma::mat & Omega,
+    const FitOptions & options,
+    ModelParameters * outputs
+) {
+    PLNMODELS_TRACE_SPAN("optimize_sparse", "fit");
+    const MemoryScope memory_scope;
+    // Prepare optimization
+    const auto design = Design<double>(X, w);
+    const arma::mat & init_Theta = init.Theta; // (p,d)
+    const arma::mat & init_M = init.M;         // (n,p)
+    const arma::mat & init_S = init.S;         // (n,p)
+
+    // Optimization on the rows with non negligible weights (see ActiveRows)
+    const auto rows = ActiveRows(w, options.row_weight_threshold);
+    const ActiveData active(rows, Y, O, X, w);
+    const auto active_M = rows.restrict(init_M);
+    const auto active_S = rows.restrict(init_S);
+
+    const auto packer = make_aligned_packer(init_Theta, active_M, active_S);
+    enum { THETA_ID, M_ID, S_ID }; // Names for packer indexes
+
+    auto parameters = arma::vec(packer.size);
+    packer.pack<THETA_ID>(parameters, init_Theta);
+    packer.pack<M_ID>(parameters, active_M);
+    packer.pack<S_ID>(parameters, active_S);
+
+    auto config = options.optimizer_for(packer.size);
+    options.parameter_xtol_abs.pack<THETA_ID>(packer, config.xtol_abs, "Theta");
+    options.parameter_xtol_abs.pack<M_ID>(packer, config.xtol_abs, "M");
+    options.parameter_xtol_abs.pack<S_ID>(packer, config.xtol_abs, "S");
+    const auto log_S = LogParametrization(packer.segment<S_ID>(), options.log_S);
+    PerfRecorder perf(options.perf_counters);
+
+    // Optimize
+    auto objective_and_grad =
+        [&packer, &active, &Omega](const arma::vec & parameters, arma::vec & grad_storage) -> double {
+        arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+        arma::mat M = packer.unpack<M_ID>(parameters);
+        arma::mat S = packer.unpack<S_ID>(parameters);
+
+        arma::mat S2 = S % S;
+        arma::mat Z = active.O.plus(active.design.times_transposed(Theta) + M);
+        arma::mat A = fast_exp(Z + 0.5 * S2);
+        arma::mat nSigma = M.t() * (M.each_col() % active.w) + diagmat(active.w.t() * S2);
+        double objective = accu(active.w.t() * (A - 0.5 * fast_log(S2))) - active.Y.weighted_dot(active.w, Z) +
+                           0.5 * trace(Omega * nSigma);
+
+        arma::mat R = active.Y.subtract_from(A);
+        packer.pack<THETA_ID>(grad_storage, active.design.weighted_crossprod(R));
+        packer.pack<M_ID>(grad_storage, diagmat(active.w) * (M * Omega + R));
+        packer.pack<S_ID>(grad_storage, diagmat(active.w) * (S.each_row() % diagvec(Omega).t() + S % A - pow(S, -1)));
+        return objective;
+    };
+    OptimizerResult result = log_S.minimize(parameters, config, perf.wrap(objective_and_grad));
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Model and variational parameters
+    arma::mat Theta = packer.unpack<THETA_ID>(parameters);
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    unpack_rows<M_ID>(packer, parameters, rows, init_M, M);
+    unpack_rows<S_ID>(packer, parameters, rows, init_S, S);
+    arma::mat S2 = S % S;
+    arma::mat Sigma = (M.t() * (M.each_col() % w) + diagmat(w.t() * S2)) / accu(w);
+    // Element-wise log-likelihood
+    arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+    arma::mat A = exp(Z + 0.5 * S2);
+    arma::mat loglik = sum(Y.schur(Z) - A - 0.5 * ((M * Omega) % M - log(S2) + S2 * diagmat(Omega)), 1) +
+                       0.5 * real(log_det(Omega)) + ki(Y);
+
+    fit.result = result;
+    fit.perf_counts = perf.finish("sparse");
+    fit.Theta = std::move(Theta);
+    fit.Z = std::move(Z);
+    fit.A = std::move(A);
+    fit.Sigma = std::move(Sigma);
+    fit.loglik = std::move(loglik);
+    fit.memory = memory_scope.usage();
+    return fit;
+}
+
+// ---------------------------------------------------------------------------------------
+// Memory estimates
+
+MemoryEstimate estimate_fit_memory(
+    arma::uword n_, arma::uword p_, arma::uword d_, arma::uword q_, const std::string & model) {
+    const double n = double(n_), p = double(p_), d = double(d_), q = double(q_);
+    const double np = n * p;
+    // Sizes in doubles: packed parameters, matrices alive at the peak of the objective and of the post-processing,
+    // and outputs. The fitted M and S are unpacked in the output R matrices (not counted in the post-processing).
+    double nb_parameters, evaluation, post_processing, outputs;
+    if(model == "full" || model == "sparse") {
+        nb_parameters = p * d + 2. * np;
+        evaluation = 9. * np + 4. * p * p; // M, S, S2, Z, A, R and the gradient terms, Omega and its inverse
+        post_processing = 5. * np + 2. * p * p;
+        outputs = p * d + 4. * np + (model == "full" ? 2. : 1.) * p * p + n;
+    } else if(model == "diagonal") {
+        nb_parameters = p * d + 2. * np;
+        evaluation = 9. * np;
+        post_processing = 5. * np;
+        outputs = p * d + 4. * np + 2. * p * p + n;
+    } else if(model == "spherical") {
+        nb_parameters = p * d + np + n;
+        evaluation = 7. * np; // M, Z, A, R and the gradient terms
+        post_processing = 5. * np;
+        outputs = p * d + 3. * np + 2. * p * p + 2. * n;
+    } else if(model == "rank") {
+        const double nq = n * q;
+        nb_parameters = p * d + p * q + 2. * nq;
+        evaluation = 5. * np + 6. * nq; // Z, A, R and X Theta', M B'; M, S, S2 and the gradient terms
+        post_processing = 4. * np + nq + p * p;
+        outputs = p * d + p * q + 2. * np + 2. * nq + p * p + n;
+    } else {
+        throw std::invalid_argument("unknown model for memory estimates: " + model);
+    }
+    const double bytes = double(sizeof(double));
+    MemoryEstimate estimate;
+    estimate.inputs = bytes * (2. * np + n * d + n);
+    // Parameters, gradient and optimizer copies of the parameters, copy of X in the design
+    estimate.engine = bytes * (3. * nb_parameters + n * d + std::max(evaluation, post_processing));
+    estimate.optimizer = bytes * 10. * nb_parameters;
+    estimate.outputs = bytes * outputs;
+    estimate.total = estimate.inputs + estimate.engine + estimate.optimizer + estimate.outputs;
+    return estimate;
+}
+
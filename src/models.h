@@ -0,0 +1,247 @@
+// Model fits and VE steps on plain C++ types.
+//
+// Each function fits one covariance model (or the VE step of one model) from data and initial parameters, and
+// returns the optimized parameters with the derived quantities used by the R classes. The cpp_optimize_* functions
+// (optimize.cpp, optimize_ve.cpp) only convert their R arguments and results around these functions, and the same
+// engine can be linked into native code through the standalone library (see arma_backend.h).
+//
+// Data arguments of all functions:
+//   Y (n,p) counts, X (n,d) covariates, O (n,p) offsets and w (n) weights of the samples.
+// Shapes of ModelParameters, with q the rank of the rank model:
+//   Theta (p,d), B (p,q), M (n,p) or (n,q), S (n,p) or (n,q), or (n,1) for the spherical model.
+#pragma once
+
+#include "arma_backend.h"
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "data.h"
+#include "lbfgs.h"
+#include "memory_tracking.h"
+#include "multistart.h"
+#include "nlopt_wrapper.h"
+#include "numa.h"
+#include "perf_counters.h"
+#include "precision.h"
+#include "ve_newton.h"
+
+// Absolute tolerance on parameters (configuration["xtol_abs"]): one value for all parameters, or values given by
+// parameter name ("Theta", "B", "M", "S"). A parameter value is either a single value for all its elements or an
+// array with the dimensions of the parameter. Parameters without a value use 'value'.
+struct ParameterTolerance {
+    double value;
+    std::map<std::string, arma::vec> by_parameter;
+
+    // Stores the tolerance of parameter 'name' at its location Index in packed (see Packer)
+    template <std::size_t Index, typename P>
+    void pack(const P & packer, arma::vec & packed, const std::string & name) const {
+        double tolerance;
+        if(single_value(name, tolerance)) {
+            packer.template fill<Index>(packed, tolerance);
+        } else {
+            packer.template pack<Index>(packed, by_parameter.at(name));
+        }
+    }
+
+    // True if parameter 'name' has the same tolerance for all its elements (given or default value), stored in
+    // 'tolerance'
+    bool single_value(const std::string & name, double & tolerance) const {
+        const auto it = by_parameter.find(name);
+        if(it == by_parameter.end()) {
+            tolerance = value;
+            return true;
+        }
+        if(it->second.n_elem == 1) {
+            tolerance = it->second[0];
+            return true;
+        }
+        return false;
+    }
+
+    // Tolerance of parameter 'name' as a matrix with the dimensions of 'parameter', to pack composite values such as
+    // InterleavedRows when single_value() is false
+    arma::mat values(const std::string & name, const arma::mat & parameter) const {
+        arma::mat tolerance(parameter.n_rows, parameter.n_cols);
+        const auto it = by_parameter.find(name);
+        if(it == by_parameter.end()) {
+            tolerance.fill(value);
+        } else if(it->second.n_elem == 1) {
+            tolerance.fill(it->second[0]);
+        } else if(it->second.n_elem == parameter.n_elem) {
+            tolerance = arma::reshape(it->second, parameter.n_rows, parameter.n_cols);
+        } else {
+            throw std::invalid_argument("config[xtol_abs][" + name + "]: size does not match the parameter");
+        }
+        return tolerance;
+    }
+};
+
+// Options of a fit: the R control list (see the *_param functions in R/utils.R) in plain C++ types
+struct FitOptions {
+    // xtol_abs is ignored: it is built for each problem from parameter_xtol_abs, and the problem size is appended to
+    // shape_key.
+    OptimizerConfiguration optimizer;
+    ParameterTolerance parameter_xtol_abs;
+
+    double row_weight_threshold; // See ActiveRows
+    Precision precision;
+    bool log_S; // See LogParametrization
+
+    VeEngine ve_engine;
+    VeNewtonConfiguration ve_newton;
+
+    // Racing of additional starts (rank model)
+    LbfgsConfiguration lbfgs;
+    MultistartConfiguration multistart;
+
+    NumaConfiguration numa; // Row-parallel evaluation (rank model)
+
+    bool perf_counters; // Hardware counters around objective evaluations, see perf_counters.h
+
+    // Defaults of the R control lists (CCSAQ, ftol_rel = 1e-8, xtol_rel = 1e-4, maxeval = 10000, double precision)
+    static FitOptions defaults();
+
+    // Optimizer configuration for a problem of 'size' packed parameters, xtol_abs filled with parameter_xtol_abs.value
+    OptimizerConfiguration optimizer_for(arma::uword size) const;
+};
+
+// Parameters of a model, initial values or fitted values. Unused parameters are empty.
+struct ModelParameters {
+    arma::mat Theta;
+    arma::mat B;
+    arma::mat M;
+    arma::mat S;
+};
+
+// Result of a fit. Quantities not computed by a model are left empty.
+struct ModelFit {
+    OptimizerResult result;
+    arma::mat Theta; // (p,d)
+    arma::mat B;     // (p,q), rank model
+    arma::mat M;
+    arma::mat S;
+    arma::mat Z;      // (n,p) O + X Theta' + M (M B' for the rank model)
+    arma::mat A;      // (n,p) exp(Z + S^2 / 2)
+    arma::mat Sigma;  // (p,p)
+    arma::mat Omega;  // (p,p), except for the rank and sparse models
+    arma::vec loglik; // (n) element-wise log-likelihood
+    std::vector<MultistartCandidate> multistart; // Outcome of each start, rank model with additional starts
+    std::vector<PerfCounts> perf_counts;         // Counts of the fit if options.perf_counters, empty otherwise
+    MemoryUsage memory;                          // Armadillo heap memory used by the fit (see memory_tracking.h)
+};
+
+// Optional caller storage for the fitted M and S ('outputs' argument of the fits and VE steps): non empty matrices of
+// outputs, usually using memory of the caller (R matrices, see r_adapter.h), receive the fitted values in place, with
+// the dimensions of init.M and init.S. The corresponding members of the returned ModelFit are then left empty.
+inline arma::mat & output_for(arma::mat & member, ModelParameters * outputs, arma::mat ModelParameters::*parameter) {
+    return outputs != nullptr && !(outputs->*parameter).is_empty() ? outputs->*parameter : member;
+}
+
+// ---------------------------------------------------------------------------------------
+// Model fits
+
+ModelFit optimize_full(
+    const ModelParameters & init, // Theta, M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const FitOptions & options,
+    ModelParameters * outputs = nullptr);
+
+ModelFit optimize_spherical(
+    const ModelParameters & init, // Theta, M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const FitOptions & options,
+    ModelParameters * outputs = nullptr);
+
+ModelFit optimize_diagonal(
+    const ModelParameters & init, // Theta, M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const FitOptions & options,
+    ModelParameters * outputs = nullptr);
+
+// Rank (q) is determined by the dimensions of B. Additional starts are raced against init (see multistart.h).
+ModelFit optimize_rank(
+    const ModelParameters & init, // Theta, B, M, S
+    const std::vector<ModelParameters> & starts,
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const FitOptions & options,
+    ModelParameters * outputs = nullptr);
+
+ModelFit optimize_sparse(
+    const ModelParameters & init, // Theta, M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const arma::mat & Omega, // (p,p)
+    const FitOptions & options,
+    ModelParameters * outputs = nullptr);
+
+// ---------------------------------------------------------------------------------------
+// VE steps: variational parameters M and S for fixed model parameters Theta (p,d) and Omega (p,p).
+// Only result, M, S and loglik (and the perf_counts and memory diagnostics) are set in the returned ModelFit.
+
+ModelFit optimize_vestep_full(
+    const ModelParameters & init, // M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const arma::mat & Theta,
+    const arma::mat & Omega,
+    const FitOptions & options,
+    ModelParameters * outputs = nullptr);
+
+ModelFit optimize_vestep_diagonal(
+    const ModelParameters & init, // M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const arma::mat & Theta,
+    const arma::mat & Omega,
+    const FitOptions & options,
+    ModelParameters * outputs = nullptr);
+
+ModelFit optimize_vestep_spherical(
+    const ModelParameters & init, // M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const arma::mat & Theta,
+    const arma::mat & Omega,
+    const FitOptions & options,
+    ModelParameters * outputs = nullptr);
+
+// ---------------------------------------------------------------------------------------
+// Memory estimates
+
+// A priori memory of a fit, in bytes, for planning jobs before running them
+struct MemoryEstimate {
+    double inputs;    // Data held by the caller: Y and O as dense double matrices, X and w
+    double engine;    // Peak of the Armadillo heap memory of the fit, as measured in ModelFit::memory.peak_bytes
+    double optimizer; // Working vectors of nlopt (CCSAQ or MMA), not measured
+    double outputs;   // Copies of the fitted quantities returned to the caller (R matrices for cpp_optimize_*)
+    double total;
+};
+
+// model: "full", "diagonal", "spherical", "rank" (of rank q) or "sparse". Estimates assume that all rows are active,
+// double precision and the default optimizer; matrices alive at the peak of the objective and of the post-processing
+// are counted from the implementation of each model in models.cpp.
+MemoryEstimate estimate_fit_memory(
+    arma::uword n, arma::uword p, arma::uword d, arma::uword q, const std::string & model);
@@ -0,0 +1,363 @@
+#include "models.h"
+
+#include <utility> // move
+
+#include "log_parametrization.h"
+#include "packer.h"
+#include "simd.h"
+#include "trace.h"
+#include "ve_coordinate.h"
+
+inline arma::vec ki(const CountMatrix & y) {
+    arma::uword p = y.n_cols;
+    return -y.logfact() + 0.5 * (1. + (1. - double(p)) * std::log(2. * M_PI));
+}
+
+// xtol_abs of M and S interleaved by row: tolerance matrices are only built for parameters given an array of values
+static void pack_interleaved_tolerance(
+    const PackedInfo<InterleavedRows> & ms,
+    const ParameterTolerance & xtol_abs,
+    arma::vec & packed,
+    const arma::mat & M,
+    const arma::mat & S) {
+    double m_tolerance;
+    double s_tolerance;
+    if(xtol_abs.single_value("M", m_tolerance) && xtol_abs.single_value("S", s_tolerance)) {
+        ms.fill(packed, m_tolerance, s_tolerance);
+    } else {
+        ms.pack(packed, InterleavedRows{xtol_abs.values("M", M), xtol_abs.values("S", S)});
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// VE full
+
+ModelFit optimize_vestep_full(
+    const ModelParameters & init, // M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const arma::mat & Theta,
+    const arma::mat & Omega,
+    const FitOptions & options,
+    ModelParameters * outputs
+) {
+    if(options.ve_engine != VeEngine::Nlopt) {
+        throw std::invalid_argument("config[ve_engine] is not supported for the full model (nlopt only)");
+    }
+    PLNMODELS_TRACE_SPAN("optimize_vestep_full", "fit");
+    const MemoryScope memory_scope;
+    // Prepare optimization
+    const auto design = Design<double>(X, w);
+    const arma::mat & init_M = init.M; // (n,p)
+    const arma::mat & init_S = init.S; // (n,p)
+
+    // Rows are independent problems: M and S are interleaved by row, and the objective works on the transposed (p,n)
+    // values, so that each row is a contiguous column
+    const auto packer = make_aligned_packer(InterleavedRows{init_M, init_S});
+    enum { MS_ID }; // Names for packer indexes
+    const PackedInfo<InterleavedRows> & ms = std::get<MS_ID>(packer.elements);
+    const arma::uword n = init_M.n_rows;
+    const arma::uword p = init_M.n_cols;
+
+    auto parameters = arma::vec(packer.size);
+    packer.pack<MS_ID>(parameters, InterleavedRows{init_M, init_S});
+
+    auto config = options.optimizer_for(packer.size);
+    pack_interleaved_tolerance(ms, options.parameter_xtol_abs, config.xtol_abs, init_M, init_S);
+    const auto log_S = LogParametrization(ms.S_indices(), options.log_S);
+    PerfRecorder perf(options.perf_counters);
+
+    const arma::mat Z0t = O.plus(design.times_transposed(Theta)).t(); // (p,n)
+    const arma::vec omega2 = diagvec(Omega);
+
+    // Optimize
+    auto objective_and_grad = [&packer, &ms, n, p, &Z0t, &Y, &w, &Omega, &omega2](const arma::vec & parameters,
+                                                                                  arma::vec & grad_storage) -> double {
+        const arma::mat view = ms.rows_view(parameters, 0, n);
+        const arma::mat Mt = view.head_rows(p);
+        const arma::mat St = view.tail_rows(p);
+
+        arma::mat S2t = St % St;
+        arma::mat Zt = Z0t + Mt;
+        arma::mat At = fast_exp(Zt + 0.5 * S2t);
+        arma::mat OmegaMt = Omega * Mt;
+        double objective =
+            as_scalar(sum(At - 0.5 * fast_log(S2t) + 0.5 * (OmegaMt % Mt + S2t.each_col() % omega2), 0) * w) -
+            Y.weighted_dot_transposed(w, Zt);
+
+        arma::mat grad = ms.rows_view(grad_storage, 0, n);
+        grad.head_rows(p) = (OmegaMt + Y.subtract_transposed_from(At)) * diagmat(w);
+        grad.tail_rows(p) = (St.each_col() % omega2 + St % At - 1. / St) * diagmat(w);
+        packer.clear_padding<MS_ID>(grad_storage);
+        return objective;
+    };
+    OptimizerResult result = log_S.minimize(parameters, config, perf.wrap(objective_and_grad));
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Model and variational parameters, back to (n,p)
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    packer.unpack_into<MS_ID>(parameters, M, S);
+    arma::mat S2 = S % S;
+    // Element-wise log-likelihood
+    arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+    arma::mat A = exp(Z + 0.5 * S2);
+    arma::mat loglik = sum(Y.schur(Z) - A + 0.5 * log(S2) - 0.5 * ((M * Omega) % M + S2 * diagmat(Omega)), 1) +
+                       0.5 * real(log_det(Omega)) + ki(Y);
+
+    fit.result = result;
+    fit.perf_counts = perf.finish("vestep_full");
+    fit.loglik = std::move(loglik);
+    fit.memory = memory_scope.usage();
+    return fit;
+}
+
+// ---------------------------------------------------------------------------------------
+// VE diagonal
+
+ModelFit optimize_vestep_diagonal(
+    const ModelParameters & init, // M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const arma::mat & Theta,
+    const arma::mat & Omega,
+    const FitOptions & options,
+    ModelParameters * outputs
+) {
+    PLNMODELS_TRACE_SPAN("optimize_vestep_diagonal", "fit");
+    const MemoryScope memory_scope;
+    // Prepare optimization
+    const auto design = Design<double>(X, w);
+    const arma::mat & init_M = init.M; // (n,p)
+    const arma::mat & init_S = init.S; // (n,p)
+
+    const arma::uword n = init_M.n_rows;
+    const arma::uword p = init_M.n_cols;
+    PerfRecorder perf(options.perf_counters);
+
+    // The fitted M and S are written to the output storage: the batched Newton and coordinate ascent engines update
+    // them in place, from a copy of the initial values
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    OptimizerResult result;
+    if(options.ve_engine == VeEngine::BatchedNewton) {
+        // Rows are independent given Theta and Omega: solve them in blocks with vectorized Newton steps
+        M = init_M;
+        S = init_S;
+        perf.measure([&]() {
+            const arma::mat Z0 = O.plus(design.times_transposed(Theta));
+            result = ve_newton_diagonal(Z0, Y, Omega.diag(), M, S, options.ve_newton);
+        });
+    } else if(options.ve_engine == VeEngine::CoordinateAscent) {
+        // Exact elementwise updates of M (Lambert W) and S, alternated
+        M = init_M;
+        S = init_S;
+        perf.measure([&]() {
+            const arma::mat Z0 = O.plus(design.times_transposed(Theta));
+            result = ve_coordinate_diagonal(Z0, Y, Omega.diag(), M, S, options.ve_newton);
+        });
+    } else {
+        // Rows are independent problems: M and S are interleaved by row, and the objective works on the transposed
+        // (p,n) values, so that each row is a contiguous column
+        const auto packer = make_aligned_packer(InterleavedRows{init_M, init_S});
+        enum { MS_ID }; // Names for packer indexes
+        const PackedInfo<InterleavedRows> & ms = std::get<MS_ID>(packer.elements);
+
+        auto parameters = arma::vec(packer.size);
+        packer.pack<MS_ID>(parameters, InterleavedRows{init_M, init_S});
+
+        auto config = options.optimizer_for(packer.size);
+        pack_interleaved_tolerance(ms, options.parameter_xtol_abs, config.xtol_abs, init_M, init_S);
+        const auto log_S = LogParametrization(ms.S_indices(), options.log_S);
+
+        const arma::mat Z0t = O.plus(design.times_transposed(Theta)).t(); // (p,n)
+        const arma::vec omega2 = diagvec(Omega);
+        auto objective_and_grad = [&packer, &ms, n, p, &Z0t, &Y, &w, &omega2](const arma::vec & parameters,
+                                                                             arma::vec & grad_storage) -> double {
+            const arma::mat view = ms.rows_view(parameters, 0, n);
+            const arma::mat Mt = view.head_rows(p);
+            const arma::mat St = view.tail_rows(p);
+
+            arma::mat S2t = St % St;
+            arma::mat Zt = Z0t + Mt;
+            arma::mat At = fast_exp(Zt + 0.5 * S2t);
+            double objective =
+                as_scalar(sum(At - 0.5 * fast_log(S2t) + 0.5 * diagmat(omega2) * (Mt % Mt + S2t), 0) * w) -
+                Y.weighted_dot_transposed(w, Zt);
+
+            arma::mat grad = ms.rows_view(grad_storage, 0, n);
+            grad.head_rows(p) = (Mt.each_col() % omega2 + Y.subtract_transposed_from(At)) * diagmat(w);
+            grad.tail_rows(p) = (St.each_col() % omega2 + St % At - 1. / St) * diagmat(w);
+            packer.clear_padding<MS_ID>(grad_storage);
+            return objective;
+        };
+        result = log_S.minimize(parameters, config, perf.wrap(objective_and_grad));
+        packer.unpack_into<MS_ID>(parameters, M, S); // Back to (n,p)
+    }
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Model and variational parameters
+    const arma::vec omega2 = diagvec(Omega);
+    arma::mat S2 = S % S;
+    // Element-wise log-likelihood
+    arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+    arma::mat A = exp(Z + 0.5 * S2);
+    arma::mat loglik =
+        sum(Y.schur(Z) - A + 0.5 * log(S2), 1) - 0.5 * (pow(M, 2) + S2) * omega2 + 0.5 * sum(log(omega2)) + ki(Y);
+
+    fit.result = result;
+    fit.perf_counts = perf.finish("vestep_diagonal");
+    fit.loglik = std::move(loglik);
+    fit.memory = memory_scope.usage();
+    return fit;
+}
+
+// ---------------------------------------------------------------------------------------
+// VE spherical
+
+ModelFit optimize_vestep_spherical(
+    const ModelParameters & init, // M, S
+    const CountMatrix & Y,
+    const arma::mat & X,
+    const Offsets<double> & O,
+    const arma::vec & w,
+    const arma::mat & Theta,
+    const arma::mat & Omega,
+    const FitOptions & options,
+    ModelParameters * outputs
+) {
+    PLNMODELS_TRACE_SPAN("optimize_vestep_spherical", "fit");
+    const MemoryScope memory_scope;
+    // Prepare optimization
+    const auto design = Design<double>(X, w);
+    const arma::mat & init_M = init.M; // (n,p)
+    const arma::vec init_S(const_cast<double *>(init.S.memptr()), init.S.n_elem, false, true); // (n), no copy
+    PerfRecorder perf(options.perf_counters);
+
+    // The fitted M and S are written to the output storage: the batched Newton and coordinate ascent engines update
+    // them in place, from a copy of the initial values
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    OptimizerResult result;
+    if(options.ve_engine == VeEngine::BatchedNewton || options.ve_engine == VeEngine::CoordinateAscent) {
+        M = init_M;
+        if(!(S.n_rows == init_S.n_elem && S.n_cols == 1)) {
+            S.set_size(init_S.n_elem, 1);
+        }
+        arma::vec S_rows(S.memptr(), S.n_elem, false, true); // (n) view of S (n,1)
+        S_rows = init_S;
+        perf.measure([&]() {
+            const arma::mat Z0 = O.plus(design.times_transposed(Theta));
+            if(options.ve_engine == VeEngine::BatchedNewton) {
+                // Rows are independent given Theta and Omega: solve them in blocks with vectorized Newton steps
+                result = ve_newton_spherical(Z0, Y, Omega(0, 0), M, S_rows, options.ve_newton);
+            } else {
+                // Exact elementwise updates of M (Lambert W) and row updates of S, alternated
+                result = ve_coordinate_spherical(Z0, Y, Omega(0, 0), M, S_rows, options.ve_newton);
+            }
+        });
+    } else {
+        const auto packer = make_aligned_packer(init_M, init_S);
+        enum { M_ID, S_ID }; // Names for packer indexes
+
+        auto parameters = arma::vec(packer.size);
+        packer.pack<M_ID>(parameters, init_M);
+        packer.pack<S_ID>(parameters, init_S);
+
+        auto config = options.optimizer_for(packer.size);
+        options.parameter_xtol_abs.pack<M_ID>(packer, config.xtol_abs, "M");
+        options.parameter_xtol_abs.pack<S_ID>(packer, config.xtol_abs, "S");
+        const auto log_S = LogParametrization(packer.segment<S_ID>(), options.log_S);
+
+        auto objective_and_grad = [&packer, &O, &design, &Y, &w, &Theta, &Omega](const arma::vec & parameters,
+                                                                                 arma::vec & grad_storage) -> double {
+            arma::mat M = packer.unpack<M_ID>(parameters);
+            arma::vec S = packer.unpack<S_ID>(parameters);
+
+            arma::vec S2 = S % S;
+            arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+            arma::mat A = fast_exp(Z.each_col() + 0.5 * S2);
+            const arma::uword p = Y.n_cols;
+            double n_sigma2 = dot(w, sum(pow(M, 2), 1) + double(p) * S2);
+            double omega2 = Omega(0, 0);
+            double objective = accu(w.t() * A) - Y.weighted_dot(w, Z) - 0.5 * double(p) * dot(w, fast_log(S2)) +
+                               0.5 * n_sigma2 * omega2;
+
+            packer.pack<M_ID>(grad_storage, diagmat(w) * (M * omega2 + Y.subtract_from(A)));
+            packer.pack<S_ID>(grad_storage, w % (S % sum(A, 1) - double(p) * pow(S, -1) + double(p) * S * omega2));
+            return objective;
+        };
+        result = log_S.minimize(parameters, config, perf.wrap(objective_and_grad));
+        packer.unpack_into<M_ID>(parameters, M);
+        packer.unpack_into<S_ID>(parameters, S); // vec(n) -> mat(n, 1)
+    }
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Model and variational parameters
+    arma::vec S2 = S % S;
+        arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+        arma::mat A = fast_exp(Z.each_col() + 0.5 * S2);
+        const arma::uword p = Y.n_cols;
+        double n_sigma2 = dot(w, sum(pow(M, 2), 1) + double(p) * S2);
+        double omega2 = Omega(0, 0);
+        double objective =
+            accu(w.t() * A) - Y.weighted_dot(w, Z) - 0.5 * double(p) * dot(w, fast_log(S2)) + 0.5 * n_sigma2 * omega2;
+
+        packer.pack<M_ID>(grad_storage, diagmat(w) * (M * omega2 + Y.subtract_from(A)));
+        packer.pack<S_ID>(grad_storage, w % (S % sum(A, 1) - double(p) * pow(S, -1) + double(p) * S * omega2));
+        return objective;
+    };
+    OptimizerResult result;
+    if(options.ve_engine == VeEngine::BatchedNewton) {
+        // Rows are independent given Theta and Omega: solve them in blocks with vectorized Newton steps
+        arma::mat M = init_M;
+        arma::vec S = init_S;
+        perf.measure([&]() {
+            const arma::mat Z0 = O.plus(design.times_transposed(Theta));
+            result = ve_newton_spherical(Z0, Y, Omega(0, 0), M, S, options.ve_newton);
+        });
+        packer.pack<M_ID>(parameters, M);
+        packer.pack<S_ID>(parameters, S);
+    } else if(options.ve_engine == VeEngine::CoordinateAscent) {
+        // Exact elementwise updates of M (Lambert W) and row updates of S, alternated
+        arma::mat M = init_M;
+        arma::vec S = init_S;
+        perf.measure([&]() {
+            const arma::mat Z0 = O.plus(design.times_transposed(Theta));
+            result = ve_coordinate_spherical(Z0, Y, Omega(0, 0), M, S, options.ve_newton);
+        });
+        packer.pack<M_ID>(parameters, M);
+        packer.pack<S_ID>(parameters, S);
+    } else {
+        result = log_S.minimize(parameters, config, perf.wrap(objective_and_grad));
+    }
+
+    PLNMODELS_TRACE_SPAN("post-processing", "fit");
+    // Model and variational parameters
+    ModelFit fit;
+    arma::mat & M = output_for(fit.M, outputs, &ModelParameters::M);
+    arma::mat & S = output_for(fit.S, outputs, &ModelParameters::S);
+    packer.unpack_into<M_ID>(parameters, M);
+    packer.unpack_into<S_ID>(parameters, S); // vec(n) -> mat(n, 1)
+    arma::vec S2 = S % S;
+    double omega2 = Omega(0, 0);
+    // Element-wise log-likelihood
+    arma::mat Z = O.plus(design.times_transposed(Theta) + M);
+    arma::mat A = exp(Z.each_col() + 0.5 * S2);
+    const arma::uword p = Y.n_cols;
+    arma::mat loglik = sum(Y.schur(Z) - A - 0.5 * pow(M, 2) * omega2, 1) - 0.5 * double(p) * omega2 * S2 +
+                       0.5 * double(p) * log(S2 * omega2) + ki(Y);
+
+    fit.result = result;
+    fit.perf_counts = perf.finish("vestep_spherical");
+    fit.loglik = std::move(loglik);
+    fit.memory = memory_scope.usage();
+    return fit;
+}
@@ -0,0 +1,177 @@
+#include "multistart.h"
+
+#include <algorithm> // min, sort
+#include <atomic>
+#include <cmath> // isfinite
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "trace.h"
+
+// Advance each selected optimizer until it is done or has used evaluation_limit evaluations.
+// Optimizers are distributed dynamically over nb_threads threads ; the first error is rethrown in the caller thread.
+static void advance_concurrently(
+    std::vector<Lbfgs> & optimizers,
+    const std::vector<std::size_t> & selected,
+    int evaluation_limit,
+    int nb_threads,
+    const std::function<double(const arma::vec &, arma::vec &)> & objective_and_grad) {
+    std::atomic<std::size_t> next(0);
+    std::mutex error_mutex;
+    std::string error;
+    auto worker = [&]() {
+        try {
+            for(std::size_t k = next++; k < selected.size(); k = next++) {
+                Lbfgs & optimizer = optimizers[selected[k]];
+                while(!optimizer.done() && optimizer.nb_evaluations() < evaluation_limit) {
+                    const arma::vec & x = optimizer.next_point();
+                    PLNMODELS_TRACE_SPAN("objective", "evaluation");
+                    arma::vec gradient(x.n_elem);
+                    const double objective = objective_and_grad(x, gradient);
+                    optimizer.report(objective, gradient);
+                }
+            }
+        } catch(const std::exception & e) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if(error.empty()) {
+                error = e.what();
+            }
+            next = selected.size(); // Stop other workers
+        }
+    };
+    const auto nb_workers = std::min<std::size_t>(std::size_t(nb_threads), selected.size());
+    if(nb_workers <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        for(std::size_t t = 0; t < nb_workers; t += 1) {
+            threads.emplace_back(worker);
+        }
+        for(std::thread & thread : threads) {
+            thread.join();
+        }
+    }
+    if(!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+MultistartResult race_multistart(
+    const std::vector<arma::vec> & starts,
+    const LbfgsConfiguration & lbfgs_config,
+    const MultistartConfiguration & config,
+    const std::function<double(const arma::vec & parameters, arma::vec & gradients)> & objective_and_grad //
+) {
+    if(starts.empty()) {
+        throw std::invalid_argument("race_multistart: no start");
+    }
+    std::vector<Lbfgs> optimizers;
+    for(const arma::vec & start : starts) {
+        optimizers.emplace_back(start, lbfgs_config);
+    }
+    // Failed or not yet evaluated candidates are ranked last
+    auto ranking_objective = [&optimizers](std::size_t k) -> double {
+        const Lbfgs & optimizer = optimizers[k];
+        const bool failed =
+            optimizer.nb_evaluations() == 0 || (optimizer.done() && optimizer.status() == NLOPT_FAILURE);
+        const double objective = optimizer.objective();
+        return failed || !std::isfinite(objective) ? std::numeric_limits<double>::infinity() : objective;
+    };
+
+    std::vector<MultistartCandidate> candidates(starts.size(), MultistartCandidate{0., 0, 0, NLOPT_FORCED_STOP});
+    std::vector<std::size_t> alive(starts.size());
+    for(std::size_t k = 0; k < alive.size(); k += 1) {
+        alive[k] = k;
+    }
+    // Successive halving
+    int round = 0;
+    while(alive.size() > 1) {
+        round += 1;
+        PLNMODELS_TRACE_SPAN("multistart_round", "optimizer");
+        const int evaluation_limit = round * config.round_evaluations;
+        advance_concurrently(optimizers, alive, evaluation_limit, config.nb_threads, objective_and_grad);
+        std::sort(alive.begin(), alive.end(), [&ranking_objective](std::size_t a, std::size_t b) {
+            return ranking_objective(a) < ranking_objective(b);
+        });
+        const std::size_t nb_kept = (alive.size() + 1) / 2;
+        for(std::size_t k = nb_kept; k < alive.size(); k += 1) {
+            candidates[alive[k]].eliminated_round = round;
+        }
+        alive.resize(nb_kept);
+    }
+    const std::size_t winner = alive[0];
+    if(config.converge_winner) {
+        advance_concurrently(optimizers, alive, std::numeric_limits<int>::max(), 1, objective_and_grad);
+    }
+
+    for(std::size_t k = 0; k < optimizers.size(); k += 1) {
+        const Lbfgs & optimizer = optimizers[k];
+        candidates[k].objective = optimizer.objective();
+        candidates[k].nb_evaluations = optimizer.nb_evaluations();
+        if(optimizer.done()) {
+            candidates[k].status = optimizer.status();
+        }
+    }
+    return MultistartResult{optimizers[winner].solution(), winner, std::move(candidates)};
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_multistart() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    LbfgsConfiguration lbfgs_config;
+    lbfgs_config.memory = 5;
+    lbfgs_config.xtol_rel = 0.;
+    lbfgs_config.ftol_rel = 0.;
+    lbfgs_config.gtol_abs = 1e-8;
+    lbfgs_config.maxeval = 1000;
+    MultistartConfiguration config;
+    config.round_evaluations = 5;
+    config.nb_threads = 2;
+    config.converge_winner = true;
+
+    // Double well (x^2 - 1)^2 + 0.3 x, global minimum near x = -1, local minimum near x = 1
+    std::atomic<int> nb_calls(0);
+    auto double_well = [&nb_calls](const arma::vec & x, arma::vec & grad) -> double {
+        nb_calls += 1;
+        const double a = x[0] * x[0] - 1.;
+        grad[0] = 4. * x[0] * a + 0.3;
+        return a * a + 0.3 * x[0];
+    };
+    const auto starts = std::vector<arma::vec>{arma::vec{2.}, arma::vec{0.9}, arma::vec{-0.5}, arma::vec{1.5}};
+    const MultistartResult result = race_multistart(starts, lbfgs_config, config, double_well);
+    check(result.winner == 2, "multistart winner");
+    check(result.solution[0] < -0.9 && result.solution[0] > -1.1, "multistart global minimum");
+    check(result.candidates.size() == starts.size(), "multistart report size");
+    check(result.candidates[result.winner].eliminated_round == 0, "multistart winner round");
+    int total_evaluations = 0;
+    int nb_eliminated = 0;
+    for(const MultistartCandidate & candidate : result.candidates) {
+        total_evaluations += candidate.nb_evaluations;
+        nb_eliminated += candidate.eliminated_round > 0 ? 1 : 0;
+    }
+    check(nb_eliminated == int(starts.size()) - 1, "multistart eliminations");
+    check(total_evaluations == nb_calls, "multistart evaluation count");
+
+    // Without convergence of the winner, the race stops when a single candidate is left
+    config.converge_winner = false;
+    const MultistartResult stopped = race_multistart(starts, lbfgs_config, config, double_well);
+    check(stopped.winner == 2 && stopped.candidates[2].nb_evaluations <= 2 * config.round_evaluations,
+          "multistart without winner convergence");
+    return success;
+}
+
+#endif
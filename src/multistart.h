@@ -0,0 +1,43 @@
+// Racing multi-start optimization for non-convex objectives (rank model).
+//
+// All starts are optimized concurrently with the ask/tell L-BFGS (lbfgs.h), on a pool of threads. After each round
+// of round_evaluations evaluations per candidate, candidates are ranked by objective and the worst half is dropped
+// (successive halving). The last candidate is then optimized to convergence if converge_winner is set, or returned
+// as is, for callers that continue it with their own optimizer. Compared to optimizing each start to convergence, most
+// of the evaluation budget goes to the promising starts.
+#pragma once
+
+#include "arma_backend.h"
+#include <nlopt.h> // nlopt_result
+
+#include <functional>
+#include <vector>
+
+#include "lbfgs.h"
+
+struct MultistartConfiguration {
+    int round_evaluations; // Evaluations per candidate between eliminations
+    int nb_threads;        // Number of threads optimizing candidates concurrently
+    bool converge_winner;  // Optimize the last candidate to convergence with L-BFGS
+};
+
+// Outcome of each start
+struct MultistartCandidate {
+    double objective;      // Best objective reached
+    int nb_evaluations;    // Evaluations spent on this start
+    int eliminated_round;  // Round of elimination (starting at 1), 0 for the winner
+    nlopt_result status;   // L-BFGS status, NLOPT_FORCED_STOP if stopped before convergence
+};
+
+struct MultistartResult {
+    arma::vec solution;   // Parameters of the winner
+    std::size_t winner;   // Index of the winning start
+    std::vector<MultistartCandidate> candidates;
+};
+
+// objective_and_grad is called concurrently from several threads: it must not use the R API.
+MultistartResult race_multistart(
+    const std::vector<arma::vec> & starts,
+    const LbfgsConfiguration & lbfgs_config,
+    const MultistartConfiguration & config,
+    const std::function<double(const arma::vec & parameters, arma::vec & gradients)> & objective_and_grad);
@@ -0,0 +1,145 @@
+#include "newton_cg.h"
+
+#include <algorithm> // max, min
+#include <chrono>
+#include <cmath> // abs, isfinite, sqrt
+#include <stdexcept>
+
+#include "trace.h"
+
+static const double armijo_c1 = 1e-4;
+static const int max_backtracks = 40;
+static const arma::uword max_cg_iterations = 100;
+
+// Approximate solution of H p = -g by preconditioned conjugate gradient.
+// Falls back to the preconditioned steepest descent direction on negative curvature at the first iteration.
+static arma::vec truncated_newton_direction(
+    const arma::vec & gradient, const arma::vec & diagonal, const HessianVectorProduct & hessian_vector_product) {
+    const arma::uword n = gradient.n_elem;
+    // Jacobi preconditioner, guarded against non positive diagonal values
+    const arma::vec preconditioner = 1. / arma::clamp(diagonal, 1e-12, arma::datum::inf);
+    const double gradient_norm = arma::norm(gradient, 2);
+    const double tolerance = std::min(0.5, std::sqrt(gradient_norm)) * gradient_norm;
+
+    arma::vec direction(n, arma::fill::zeros);
+    arma::vec residual = -gradient;
+    arma::vec z = preconditioner % residual;
+    arma::vec conjugate = z;
+    arma::vec product(n);
+    double rz = dot(residual, z);
+    for(arma::uword k = 0; k < std::min(n, max_cg_iterations); k += 1) {
+        hessian_vector_product(conjugate, product);
+        const double curvature = dot(conjugate, product);
+        if(!(curvature > 0.)) {
+            if(k == 0) {
+                direction = conjugate;
+            }
+            break;
+        }
+        const double alpha = rz / curvature;
+        direction += alpha * conjugate;
+        residual -= alpha * product;
+        if(arma::norm(residual, 2) <= tolerance) {
+            break;
+        }
+        z = preconditioner % residual;
+        const double rz_next = dot(residual, z);
+        conjugate = z + (rz_next / rz) * conjugate;
+        rz = rz_next;
+    }
+    return direction;
+}
+
+OptimizerResult minimize_newton_cg(
+    arma::vec & parameters,
+    const OptimizerConfiguration & config,
+    const std::function<double(const arma::vec & parameters, arma::vec & gradients)> & objective_and_grad_fn,
+    const HessianAt & hessian_at //
+) {
+    if(!(config.xtol_abs.n_elem == parameters.n_elem)) {
+        throw std::invalid_argument("config.xtol_abs size");
+    }
+    PLNMODELS_TRACE_SPAN("newton_cg", "optimizer");
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    auto out_of_time = [&config, &start]() {
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+        return config.maxtime > 0. && elapsed.count() >= config.maxtime;
+    };
+    int nb_evaluations = 0;
+    auto evaluate = [&](const arma::vec & x, arma::vec & g) -> double {
+        nb_evaluations += 1;
+        PLNMODELS_TRACE_SPAN("objective", "evaluation");
+        return objective_and_grad_fn(x, g);
+    };
+    auto out_of_evaluations = [&config, &nb_evaluations]() {
+        return config.maxeval > 0 && nb_evaluations >= config.maxeval;
+    };
+
+    arma::vec & x = parameters;
+    arma::vec gradient(x.n_elem);
+    double objective = evaluate(x, gradient);
+    if(!(std::isfinite(objective) && gradient.is_finite())) {
+        return OptimizerResult{NLOPT_FAILURE, objective, nb_evaluations};
+    }
+    arma::vec diagonal(x.n_elem);
+    arma::vec trial_gradient(x.n_elem);
+    while(true) {
+        if(!arma::any(gradient != 0.)) {
+            return OptimizerResult{NLOPT_SUCCESS, objective, nb_evaluations};
+        }
+        arma::vec direction;
+        {
+            PLNMODELS_TRACE_SPAN("newton_direction", "evaluation");
+            const HessianVectorProduct hessian_vector_product = hessian_at(x, diagonal);
+            direction = truncated_newton_direction(gradient, diagonal, hessian_vector_product);
+        }
+        double slope = dot(gradient, direction);
+        if(!(slope < 0.)) {
+            direction = -gradient;
+            slope = -dot(gradient, gradient);
+        }
+
+        // Backtracking line search
+        double step = 1.;
+        arma::vec trial;
+        double trial_objective = 0.;
+        for(int backtrack = 0;; backtrack += 1) {
+            if(backtrack > max_backtracks) {
+                return OptimizerResult{NLOPT_ROUNDOFF_LIMITED, objective, nb_evaluations};
+            }
+            if(out_of_evaluations()) {
+                return OptimizerResult{NLOPT_MAXEVAL_REACHED, objective, nb_evaluations};
+            }
+            if(out_of_time()) {
+                return OptimizerResult{NLOPT_MAXTIME_REACHED, objective, nb_evaluations};
+            }
+            trial = x + step * direction;
+            trial_objective = evaluate(trial, trial_gradient);
+            if(std::isfinite(trial_objective) && trial_gradient.is_finite() &&
+               trial_objective <= objective + armijo_c1 * step * slope) {
+                break;
+            }
+            step *= 0.5;
+        }
+
+        // Accept step and test convergence
+        const arma::vec delta = arma::abs(trial - x);
+        const double objective_change = std::abs(trial_objective - objective);
+        x = trial;
+        objective = trial_objective;
+        gradient = trial_gradient;
+        if(objective_change <= config.ftol_abs || objective_change <= config.ftol_rel * std::abs(objective)) {
+            return OptimizerResult{NLOPT_FTOL_REACHED, objective, nb_evaluations};
+        }
+        if(arma::all(delta <= config.xtol_rel * arma::abs(x) || delta <= config.xtol_abs)) {
+            return OptimizerResult{NLOPT_XTOL_REACHED, objective, nb_evaluations};
+        }
+        if(out_of_evaluations()) {
+            return OptimizerResult{NLOPT_MAXEVAL_REACHED, objective, nb_evaluations};
+        }
+        if(out_of_time()) {
+            return OptimizerResult{NLOPT_MAXTIME_REACHED, objective, nb_evaluations};
+        }
+    }
+}
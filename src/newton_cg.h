@@ -0,0 +1,20 @@
+// Truncated Newton (Newton-CG) engine, selected with the algorithm name "NEWTON_CG".
+//
+// nlopt TNEWTON variants approximate Hessian-vector products by differences of gradients, which costs one gradient
+// evaluation per product. The ELBO of the PLN models has cheap analytic products instead (diagonal in S, Omega plus
+// diag(A) in M, structured in Theta), supplied by each model as a HessianAt closure (see nlopt_wrapper.h).
+//
+// Each outer iteration approximately solves H p = -g by preconditioned conjugate gradient, with the Hessian diagonal
+// as preconditioner, stopping when the residual is below min(0.5, sqrt(|g|)) |g| or on negative curvature. The step
+// along p is then damped by Armijo backtracking.
+#pragma once
+
+#include "nlopt_wrapper.h"
+
+// Stopping criteria from config: ftol_rel, ftol_abs, xtol_rel, xtol_abs, maxeval (objective and gradient evaluations,
+// Hessian-vector products are not counted), maxtime. Same status codes as nlopt ; nb_iterations counts evaluations.
+OptimizerResult minimize_newton_cg(
+    arma::vec & parameters,
+    const OptimizerConfiguration & config,
+    const std::function<double(const arma::vec & parameters, arma::vec & gradients)> & objective_and_grad_fn,
+    const HessianAt & hessian_at);
@@ -1,11 +1,24 @@
 #include "nlopt_wrapper.h"
+#include "newton_cg.h"
+#include "trace.h"
 
+#include <algorithm> // max
+#include <chrono>
+#include <cmath>       // isfinite
+#include <limits>      // infinity
 #include <memory>      // unique_ptr
+#include <mutex>
+#include <stdexcept>
 #include <type_traits> // remove_pointer
+#include <vector>
 
+// In the R package, nlopt is the copy of the nloptr package, whose functions are looked up at runtime.
 // This header DEFINES non inline functions that follow the declarations of nlopt.h
 // It must be only included once in a project, or it will generate multiple definitions.
+// The standalone library links to nlopt instead.
+#ifndef PLNMODELS_STANDALONE
 #include "nloptrAPI.h"
+#endif
 
 // ---------------------------------------------------------------------------------------
 // Algorithm naming
@@ -43,19 +56,63 @@ nlopt_algorithm algorithm_from_name(const std::string & name) {
         msg += " ";
         msg += association.name;
     }
-    throw Rcpp::exception(msg.c_str());
+    msg += " NEWTON_CG AUTO";
+    throw std::invalid_argument(msg);
+}
+
+OptimizerEngine engine_from_name(const std::string & name) {
+    if(name == "NEWTON_CG") {
+        return OptimizerEngine::NewtonCg;
+    } else if(name == "AUTO") {
+        return OptimizerEngine::Auto;
+    } else {
+        return OptimizerEngine::Nlopt;
+    }
 }
 
 // ---------------------------------------------------------------------------------------
 // nlopt wrapper
 
+// Scale d = 1 / sqrt(h) for each Hessian diagonal value h. Values are floored relative to the largest one, and
+// coordinates with non finite values are left unscaled.
+static arma::vec scaling_from_hessian_diagonal(const arma::vec & diagonal) {
+    auto scale = arma::vec(diagonal.n_elem, arma::fill::ones);
+    const arma::uvec finite = arma::find_finite(diagonal);
+    if(finite.is_empty()) {
+        return scale;
+    }
+    const double largest = arma::max(arma::abs(diagonal.elem(finite)));
+    if(!(largest > 0.)) {
+        return scale;
+    }
+    scale.elem(finite) = 1. / arma::sqrt(arma::clamp(diagonal.elem(finite), 1e-8 * largest, largest));
+    return scale;
+}
+
+static OptimizerResult minimize_auto(
+    arma::vec & parameters,
+    const OptimizerConfiguration & config,
+    const std::function<double(const arma::vec &, arma::vec &)> & objective_and_grad_fn,
+    const HessianAt & hessian_at);
+
 OptimizerResult minimize_objective_on_parameters(
     arma::vec & parameters,
     const OptimizerConfiguration & config,
     std::function<double(const arma::vec & parameters, arma::vec & gradients)> objective_and_grad_fn //
 ) {
     if(!(config.xtol_abs.n_elem == parameters.n_elem)) {
-        throw Rcpp::exception("config.xtol_abs size");
+        throw std::invalid_argument("config.xtol_abs size");
+    }
+    if(config.engine == OptimizerEngine::Auto) {
+        return minimize_auto(parameters, config, objective_and_grad_fn, HessianAt());
+    }
+    if(config.engine != OptimizerEngine::Nlopt) {
+        throw std::invalid_argument(
+            "algorithm NEWTON_CG is not available for this model (no analytic Hessian products)");
+    }
+    if(config.diagonal_scaling) {
+        throw std::invalid_argument(
+            "diagonal_scaling is not available for this model (no analytic Hessian diagonal)");
     }
 
     // Create optimizer, stored in a unique_ptr to ensure automatic destruction.
@@ -65,13 +122,13 @@ OptimizerResult minimize_objective_on_parameters(
     };
     auto optimizer = std::unique_ptr<Optimizer, Deleter>(nlopt_create(config.algorithm, parameters.n_elem));
     if(!optimizer) {
-        throw Rcpp::exception("nlopt_create");
+        throw std::runtime_error("nlopt_create");
     }
 
     // Set optimizer configuration, with error checking
     auto check = [](nlopt_result r, const char * reason) {
         if(r != NLOPT_SUCCESS) {
-            throw Rcpp::exception(reason);
+            throw std::runtime_error(reason);
         }
     };
     check(nlopt_set_xtol_abs(optimizer.get(), config.xtol_abs.memptr()), "nlopt_set_xtol_abs");
@@ -99,17 +156,203 @@ OptimizerResult minimize_objective_on_parameters(
         // Restore optim_data and use it to perform computation step
         OptimData & optim_data = *static_cast<OptimData *>(data);
         optim_data.nb_iterations += 1;
+        PLNMODELS_TRACE_SPAN("objective", "evaluation");
         return optim_data.objective_and_grad_fn(parameters, grad_storage);
     };
     if(nlopt_set_min_objective(optimizer.get(), optim_fn, &optim_data) != NLOPT_SUCCESS) {
-        throw Rcpp::exception("nlopt_set_min_objective");
+        throw std::runtime_error("nlopt_set_min_objective");
     }
 
+    PLNMODELS_TRACE_SPAN("nlopt_optimize", "optimizer");
     double objective = 0.;
     nlopt_result status = nlopt_optimize(optimizer.get(), parameters.memptr(), &objective);
     return OptimizerResult{status, objective, optim_data.nb_iterations};
 }
 
+OptimizerResult minimize_objective_on_parameters(
+    arma::vec & parameters,
+    const OptimizerConfiguration & config,
+    std::function<double(const arma::vec & parameters, arma::vec & gradients)> objective_and_grad_fn,
+    HessianAt hessian_at //
+) {
+    if(config.engine == OptimizerEngine::Auto) {
+        return minimize_auto(parameters, config, objective_and_grad_fn, hessian_at);
+    }
+    if(config.engine == OptimizerEngine::NewtonCg) {
+        return minimize_newton_cg(parameters, config, objective_and_grad_fn, hessian_at);
+    }
+    if(!config.diagonal_scaling) {
+        return minimize_objective_on_parameters(parameters, config, std::move(objective_and_grad_fn));
+    }
+
+    // Diagonal scaling: nlopt runs on y = x / scale, restarted at each scaling update
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    auto chunk_config = config;
+    chunk_config.diagonal_scaling = false;
+    OptimizerResult total = {NLOPT_FAILURE, 0., 0};
+    arma::vec diagonal(parameters.n_elem);
+    while(true) {
+        hessian_at(parameters, diagonal);
+        const arma::vec scale = scaling_from_hessian_diagonal(diagonal);
+
+        chunk_config.xtol_abs = config.xtol_abs / scale;
+        if(config.maxeval > 0) {
+            chunk_config.maxeval = config.maxeval - total.nb_iterations;
+        }
+        if(config.scaling_refresh > 0 && (chunk_config.maxeval <= 0 || chunk_config.maxeval > config.scaling_refresh)) {
+            chunk_config.maxeval = config.scaling_refresh;
+        }
+        if(config.maxtime > 0.) {
+            const std::chrono::duration<double> elapsed = Clock::now() - start;
+            chunk_config.maxtime = config.maxtime - elapsed.count();
+            if(chunk_config.maxtime <= 0.) {
+                total.status = NLOPT_MAXTIME_REACHED;
+                return total;
+            }
+        }
+
+        auto scaled_objective_and_grad = [&scale, &objective_and_grad_fn](const arma::vec & y,
+                                                                          arma::vec & grad) -> double {
+            const arma::vec x = y % scale;
+            const double objective = objective_and_grad_fn(x, grad);
+            grad %= scale;
+            return objective;
+        };
+        arma::vec scaled_parameters = parameters / scale;
+        const OptimizerResult chunk =
+            minimize_objective_on_parameters(scaled_parameters, chunk_config, scaled_objective_and_grad);
+        parameters = scaled_parameters % scale;
+        total.status = chunk.status;
+        total.objective = chunk.objective;
+        total.nb_iterations += chunk.nb_iterations;
+
+        // Continue with an updated scaling only if this run was stopped by the refresh period
+        const bool total_maxeval_reached = config.maxeval > 0 && total.nb_iterations >= config.maxeval;
+        if(!(config.scaling_refresh > 0 && chunk.status == NLOPT_MAXEVAL_REACHED && !total_maxeval_reached)) {
+            return total;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Automatic algorithm choice
+
+// Winners of previous probes, by shape key. Shared by all threads.
+static std::mutex auto_decisions_mutex;
+static std::map<std::string, std::string> auto_decisions;
+
+std::map<std::string, std::string> auto_algorithm_decisions() {
+    std::lock_guard<std::mutex> lock(auto_decisions_mutex);
+    return auto_decisions;
+}
+
+static OptimizerConfiguration with_algorithm(OptimizerConfiguration config, const std::string & name) {
+    config.engine = engine_from_name(name);
+    if(config.engine == OptimizerEngine::Nlopt) {
+        config.algorithm = algorithm_from_name(name);
+    }
+    return config;
+}
+
+static OptimizerResult minimize_auto(
+    arma::vec & parameters,
+    const OptimizerConfiguration & config,
+    const std::function<double(const arma::vec &, arma::vec &)> & objective_and_grad_fn,
+    const HessianAt & hessian_at //
+) {
+    auto run = [&objective_and_grad_fn, &hessian_at](arma::vec & x,
+                                                     const OptimizerConfiguration & c) -> OptimizerResult {
+        if(hessian_at) {
+            return minimize_objective_on_parameters(x, c, objective_and_grad_fn, hessian_at);
+        }
+        return minimize_objective_on_parameters(x, c, objective_and_grad_fn);
+    };
+    std::string winner;
+    {
+        std::lock_guard<std::mutex> lock(auto_decisions_mutex);
+        auto known = auto_decisions.find(config.shape_key);
+        if(known != auto_decisions.end()) {
+            winner = known->second;
+        }
+    }
+    if(winner == "NEWTON_CG" && !hessian_at) {
+        winner.clear(); // Decision taken for a problem with Hessian products, probe again
+    }
+    if(!winner.empty()) {
+        return run(parameters, with_algorithm(config, winner));
+    }
+
+    // Time-boxed probes from the initial point
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    std::vector<std::string> candidates = {"CCSAQ", "LBFGS", "MMA"};
+    if(hessian_at) {
+        candidates.push_back("NEWTON_CG");
+    }
+    int nb_evaluations = 0;
+    OptimizerResult best = {NLOPT_FAILURE, std::numeric_limits<double>::infinity(), 0};
+    arma::vec best_parameters = parameters;
+    for(const std::string & name : candidates) {
+        PLNMODELS_TRACE_SPAN("auto_probe", "optimizer");
+        auto probe_config = with_algorithm(config, name);
+        probe_config.maxeval = config.auto_probe_maxeval;
+        probe_config.maxtime = config.auto_probe_maxtime;
+        arma::vec probe_parameters = parameters;
+        const OptimizerResult probe = run(probe_parameters, probe_config);
+        nb_evaluations += probe.nb_iterations;
+        const bool usable = probe.status > 0 || probe.status == NLOPT_ROUNDOFF_LIMITED;
+        if(usable && std::isfinite(probe.objective) && probe.objective < best.objective) {
+            best = probe;
+            winner = name;
+            best_parameters = std::move(probe_parameters);
+        }
+    }
+    if(winner.empty()) {
+        // No probe made progress, use the default algorithm from the initial point
+        OptimizerResult result = run(parameters, with_algorithm(config, "CCSAQ"));
+        result.nb_iterations += nb_evaluations;
+        return result;
+    }
+    {
+        std::lock_guard<std::mutex> lock(auto_decisions_mutex);
+        auto_decisions[config.shape_key] = winner;
+    }
+
+    // Continue with the winner from its probe state, unless the probe already converged
+    parameters = std::move(best_parameters);
+    if(best.status != NLOPT_MAXEVAL_REACHED && best.status != NLOPT_MAXTIME_REACHED) {
+        best.nb_iterations = nb_evaluations;
+        return best;
+    }
+    auto final_config = with_algorithm(config, winner);
+    if(config.maxeval > 0) {
+        final_config.maxeval = std::max(1, config.maxeval - nb_evaluations);
+    }
+    if(config.maxtime > 0.) {
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+        final_config.maxtime = std::max(1e-3, config.maxtime - elapsed.count());
+    }
+    OptimizerResult result = run(parameters, final_config);
+    result.nb_iterations += nb_evaluations;
+    return result;
+}
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+
+// Algorithms chosen by control$algorithm = "AUTO" in this session, by shape (covariance model and problem size)
+// [[Rcpp::export]]
+Rcpp::CharacterVector cpp_auto_algorithm_decisions() {
+    const auto decisions = auto_algorithm_decisions();
+    auto names = Rcpp::CharacterVector();
+    auto values = Rcpp::CharacterVector();
+    for(const auto & decision : decisions) {
+        names.push_back(decision.first);
+        values.push_back(decision.second);
+    }
+    values.names() = names;
+    return values;
+}
+
 // ---------------------------------------------------------------------------------------
 // sanity test and example
 
@@ -133,6 +376,12 @@ bool cpp_test_nlopt() {
         epsilon,            // ftol_rel
         100,                // maxeval
         100.,               // maxtime
+        OptimizerEngine::Nlopt,
+        false, // diagonal_scaling
+        0,     // scaling_refresh
+        30,    // auto_probe_maxeval
+        1.,    // auto_probe_maxtime
+        "test",
     };
     auto x = arma::vec{42.};
     auto f_and_grad = [check](const arma::vec & x, arma::vec & grad) -> double {
@@ -146,5 +395,66 @@ bool cpp_test_nlopt() {
     check(arma::approx_equal(x, arma::vec{0.}, "absdiff", 10. * epsilon), "optim convergence");
     check(r.status != NLOPT_FAILURE, "optim status");
 
+    // Newton-CG on an ill-conditioned quadratic 0.5 x' H x - c' x, with H = diag(d) + u u'
+    const auto d = arma::vec{1., 100., 1e4};
+    const auto u = arma::vec{1., 1., 0.};
+    const auto c = arma::vec{1., 2., 3.};
+    const arma::mat H = arma::diagmat(d) + u * u.t();
+    auto quadratic = [&H, &c](const arma::vec & x, arma::vec & grad) -> double {
+        grad = H * x - c;
+        return 0.5 * dot(x, H * x) - dot(c, x);
+    };
+    int nb_products = 0;
+    auto hessian_at = [&d, &u, &nb_products](const arma::vec &, arma::vec & diagonal) -> HessianVectorProduct {
+        diagonal = d + u % u;
+        return [&d, &u, &nb_products](const arma::vec & direction, arma::vec & product) {
+            nb_products += 1;
+            product = d % direction + dot(u, direction) * u;
+        };
+    };
+    config.algorithm = NLOPT_LD_LBFGS;
+    config.engine = engine_from_name("NEWTON_CG");
+    config.xtol_abs = arma::vec(3, arma::fill::zeros);
+    config.xtol_rel = 0.;
+    config.ftol_abs = 0.;
+    config.ftol_rel = 1e-14;
+    x = arma::vec{1., 1., 1.};
+    r = minimize_objective_on_parameters(x, config, quadratic, hessian_at);
+    check(arma::approx_equal(x, arma::solve(H, c), "absdiff", 1e-8), "newton_cg convergence");
+    check(r.status == NLOPT_FTOL_REACHED, "newton_cg status");
+    check(r.nb_iterations < 20 && nb_products > 0, "newton_cg uses Hessian products");
+    bool rejected = false;
+    try {
+        minimize_objective_on_parameters(x, config, quadratic);
+    } catch(const std::invalid_argument &) {
+        rejected = true;
+    }
+    check(rejected, "newton_cg requires Hessian products");
+
+    // Diagonally scaled LBFGS on the same quadratic, with scaling updates
+    config.engine = OptimizerEngine::Nlopt;
+    config.diagonal_scaling = true;
+    config.scaling_refresh = 5;
+    config.ftol_rel = 1e-12;
+    x = arma::vec{1., 1., 1.};
+    r = minimize_objective_on_parameters(x, config, quadratic, hessian_at);
+    check(arma::approx_equal(x, arma::solve(H, c), "reldiff", 1e-4), "diagonal scaling convergence");
+    check(r.status == NLOPT_FTOL_REACHED || r.status == NLOPT_XTOL_REACHED, "diagonal scaling status");
+
+    // Automatic choice: probes, then reuse of the decision for the same shape key
+    config.diagonal_scaling = false;
+    config.engine = engine_from_name("AUTO");
+    config.auto_probe_maxeval = 5;
+    config.shape_key = "cpp_test_nlopt:quadratic";
+    x = arma::vec{1., 1., 1.};
+    r = minimize_objective_on_parameters(x, config, quadratic, hessian_at);
+    check(arma::approx_equal(x, arma::solve(H, c), "reldiff", 1e-4), "auto convergence");
+    check(auto_algorithm_decisions().count(config.shape_key) == 1, "auto decision recorded");
+    x = arma::vec{1., 1., 1.};
+    r = minimize_objective_on_parameters(x, config, quadratic);
+    check(arma::approx_equal(x, arma::solve(H, c), "reldiff", 1e-4), "auto convergence with known shape");
+
     return success;
-}
\ No newline at end of file
+}
+
+#endif
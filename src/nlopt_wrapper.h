@@ -1,16 +1,23 @@
-#include <RcppArmadillo.h>
+#pragma once
+
+#include "arma_backend.h"
 #include <nlopt.h>
 
 #include <functional> // lambda wrapping
+#include <map>
 #include <string>
-#include <utility> // move
 
 // Retrieve the algorithm enum value associated to 'name', or throw an error
 nlopt_algorithm algorithm_from_name(const std::string & name);
 
+// Optimizers: nlopt algorithms, the internal truncated Newton engine (algorithm name "NEWTON_CG", see newton_cg.h), or
+// an automatic choice among them (algorithm name "AUTO", see minimize_objective_on_parameters).
+enum class OptimizerEngine { Nlopt, NewtonCg, Auto };
+OptimizerEngine engine_from_name(const std::string & name);
+
 // Required configuration values for using an optimizer
 struct OptimizerConfiguration {
-    nlopt_algorithm algorithm; // Must be from the supported algorithm list.
+    nlopt_algorithm algorithm; // Must be from the supported algorithm list. Only used by the Nlopt engine.
 
     arma::vec xtol_abs; // of size packer.size
     double xtol_rel;
@@ -21,44 +28,18 @@ struct OptimizerConfiguration {
     int maxeval;
     double maxtime;
 
-    // Build configuration from R list (with named elements).
-    //
-    // xtol_abs has special handling, due to having values for each parameter element.
-    // 2 modes are supported, depending on the input type:
-    // - single float value: use single value for all parameter elements
-    // - named list with values for each parameter: use parameter-specific values
-    // The parameter-specific mode delegates extraction of the xtol_abs list and packing to xtol_abs array to
-    // a user sub function of prototype: void pack_xtol_abs(arma::vec & packed, Rcpp::List xtol_abs_list).
-    // These subfunctions are generally specific to the algorithm variant (parameter list types).
-    // They use PackedInfo::pack_double_or_arma() to accept as input, for each parameter:
-    // - a single double value: use this value for all elements of the parameter
-    // - an arma mat/vec with the parameter dimensions: use element-specific values
-    template <typename F>
-    static OptimizerConfiguration from_r_list(const Rcpp::List & list, arma::uword packer_size, F pack_xtol_abs) {
-        // Special handling for xtol_abs
-        auto xtol_abs = arma::vec(packer_size);
-        SEXP xtol_abs_r_value = list["xtol_abs"];
-        if(Rcpp::is<double>(xtol_abs_r_value)) {
-            xtol_abs.fill(Rcpp::as<double>(xtol_abs_r_value));
-        } else if(Rcpp::is<Rcpp::List>(xtol_abs_r_value)) {
-            pack_xtol_abs(xtol_abs, Rcpp::as<Rcpp::List>(xtol_abs_r_value));
-        } else {
-            throw Rcpp::exception("unsupported config[xtol_abs] type: must be double or list of by-parameter values");
-        }
-        // All others
-        return {
-            algorithm_from_name(Rcpp::as<std::string>(list["algorithm"])),
-
-            std::move(xtol_abs),
-            Rcpp::as<double>(list["xtol_rel"]),
-
-            Rcpp::as<double>(list["ftol_abs"]),
-            Rcpp::as<double>(list["ftol_rel"]),
-
-            Rcpp::as<int>(list["maxeval"]),
-            Rcpp::as<double>(list["maxtime"]),
-        };
-    }
+    OptimizerEngine engine;
+
+    // Diagonal scaling of the parameters for nlopt algorithms (see minimize_objective_on_parameters with hessian_at).
+    // Optional elements "diagonal_scaling" (default false) and "scaling_refresh" (default 0).
+    bool diagonal_scaling;
+    int scaling_refresh; // Number of evaluations between scaling updates, 0 to only scale at the initial point
+
+    // Probes of the Auto engine, from optional elements "auto_probe_maxeval" (default 30) and "auto_probe_maxtime"
+    // (seconds, default 1). shape_key identifies problems sharing the same decision: config["covariance"] and size.
+    int auto_probe_maxeval;
+    double auto_probe_maxtime;
+    std::string shape_key;
 };
 
 // Return value of an optimizer call.
@@ -76,4 +57,31 @@ OptimizerResult minimize_objective_on_parameters(
     // Computation step function (usually initialised with a stateful lambda / closure).
     // It should compute and return the objective value for the given parameters, and store computed gradients.
     // Both vectors are of size nb_parameters.
-    std::function<double(const arma::vec & parameters, arma::vec & gradients)> objective_and_grad_fn);
\ No newline at end of file
+    std::function<double(const arma::vec & parameters, arma::vec & gradients)> objective_and_grad_fn);
+
+// Second order information, required by the NewtonCg engine.
+// hessian_at(parameters, diagonal) stores the diagonal of the Hessian at parameters (used as a preconditioner) and
+// returns the Hessian-vector product operator at the same point. This allows to compute quantities shared by all
+// products (exp(Z), Omega) once per outer iteration.
+using HessianVectorProduct = std::function<void(const arma::vec & direction, arma::vec & product)>;
+using HessianAt = std::function<HessianVectorProduct(const arma::vec & parameters, arma::vec & diagonal)>;
+
+// Same as above, with analytic Hessian products available for the NewtonCg engine.
+// With config.diagonal_scaling, nlopt algorithms optimize y = x / d with d = 1 / sqrt(diag(H)) computed by hessian_at,
+// so that all parameters have unit curvature: quasi-Newton methods starting from identity curvature (and CCSAQ/MMA
+// which use a single curvature per coordinate) no longer have to learn the very different scales of Theta, M and S.
+// The scaling is updated every config.scaling_refresh evaluations, by restarting nlopt from the current point.
+// The variant without hessian_at rejects the NewtonCg engine and diagonal scaling.
+//
+// The Auto engine probes candidate algorithms (CCSAQ, LBFGS, MMA, and NEWTON_CG if hessian_at is available) from the
+// initial point, each for at most auto_probe_maxeval evaluations and auto_probe_maxtime seconds, then continues from
+// the best probe state with the algorithm that reached the lowest objective. The winner is recorded for the
+// config.shape_key of the problem, and later problems with the same key skip the probes.
+OptimizerResult minimize_objective_on_parameters(
+    arma::vec & parameters,
+    const OptimizerConfiguration & config,
+    std::function<double(const arma::vec & parameters, arma::vec & gradients)> objective_and_grad_fn,
+    HessianAt hessian_at);
+
+// Decisions of the Auto engine, as "shape key -> algorithm name" entries
+std::map<std::string, std::string> auto_algorithm_decisions();
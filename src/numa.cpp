@@ -0,0 +1,215 @@
+#include "numa.h"
+
+#include <algorithm> // copy, max, min
+#include <exception>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "thread_budget.h"
+#include "trace.h"
+
+// ---------------------------------------------------------------------------------------
+// Thread pinning
+
+#ifdef __linux__
+static std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu += 1) {
+            if(CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+static void pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // Best effort, runs unpinned on failure
+}
+#else
+static std::vector<int> allowed_cpus() {
+    return {};
+}
+static void pin_current_thread(int) {}
+#endif
+
+// ---------------------------------------------------------------------------------------
+// PinnedWorkers
+
+PinnedWorkers::PinnedWorkers(arma::uword n_rows, int nb_workers, bool pin)
+    : task_(nullptr), generation_(0), nb_running_(0), stop_(false) {
+    const auto size = std::max<arma::uword>(std::min<arma::uword>(arma::uword(nb_workers), n_rows), 1);
+    for(arma::uword k = 0; k <= size; k += 1) {
+        bounds_.push_back(k * n_rows / size);
+    }
+    const std::vector<int> cpus = pin ? allowed_cpus() : std::vector<int>();
+    for(arma::uword k = 0; k < size; k += 1) {
+        const int cpu = cpus.empty() ? -1 : cpus[k * cpus.size() / size];
+        threads_.emplace_back(&PinnedWorkers::worker_loop, this, std::size_t(k), cpu);
+    }
+}
+
+PinnedWorkers::~PinnedWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for(std::thread & thread : threads_) {
+        thread.join();
+    }
+}
+
+void PinnedWorkers::run(const std::function<void(std::size_t worker)> & task) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        error_.clear();
+        nb_running_ = threads_.size();
+        generation_ += 1;
+    }
+    start_.notify_all();
+    std::string error;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [this]() { return nb_running_ == 0; });
+        error = error_;
+    }
+    if(!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+void PinnedWorkers::worker_loop(std::size_t worker, int cpu) {
+    if(cpu >= 0) {
+        pin_current_thread(cpu);
+    }
+    std::uint64_t seen_generation = 0;
+    while(true) {
+        const std::function<void(std::size_t)> * task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&]() { return stop_ || generation_ != seen_generation; });
+            if(stop_) {
+                return;
+            }
+            seen_generation = generation_;
+            task = task_;
+        }
+        std::string error;
+        try {
+            PLNMODELS_TRACE_SPAN("numa_worker_rows", "kernel");
+            (*task)(worker);
+        } catch(const std::exception & e) {
+            error = e.what();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!error.empty() && error_.empty()) {
+            error_ = error;
+        }
+        nb_running_ -= 1;
+        if(nb_running_ == 0) {
+            finished_.notify_one();
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// NumaRowBlocks
+
+NumaRowBlocks::NumaRowBlocks(
+    const NumaConfiguration & config, const CountMatrix & Y, const Offsets<double> & O, const arma::mat & X,
+    const arma::vec & w)
+    : workers_(Y.n_rows, config.nb_workers, config.pin), blocks_(workers_.size()) {
+    previous_blas_threads_ = blas_get_num_threads();
+    blas_set_num_threads(1);
+    workers_.run([&](std::size_t k) {
+        const arma::uvec rows = arma::regspace<arma::uvec>(workers_.first_row(k), workers_.last_row(k) - 1);
+        blocks_[k].reset(new RowBlock(rows, Y, O, X, w));
+    });
+}
+
+NumaRowBlocks::~NumaRowBlocks() {
+    if(previous_blas_threads_ > 0) {
+        blas_set_num_threads(previous_blas_threads_);
+    }
+}
+
+arma::mat gather_rows(
+    const arma::vec & packed, PackedSegment segment, arma::uword n_rows, arma::uword first_row, arma::uword last_row) {
+    const arma::uword n_cols = segment.size / n_rows;
+    auto values = arma::mat(last_row - first_row, n_cols);
+    for(arma::uword j = 0; j < n_cols; j += 1) {
+        const double * column = packed.memptr() + segment.offset + j * n_rows;
+        std::copy(column + first_row, column + last_row, values.colptr(j));
+    }
+    return values;
+}
+
+void scatter_rows(
+    arma::vec & packed, PackedSegment segment, arma::uword n_rows, arma::uword first_row, const arma::mat & values) {
+    for(arma::uword j = 0; j < values.n_cols; j += 1) {
+        const double * column = values.colptr(j);
+        std::copy(column, column + values.n_rows, packed.memptr() + segment.offset + j * n_rows + first_row);
+    }
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_numa() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    // Row partition and concurrent execution
+    PinnedWorkers workers(10, 3, true);
+    check(workers.size() == 3, "numa workers size");
+    check(workers.first_row(0) == 0 && workers.last_row(2) == 10, "numa workers bounds");
+    auto counts = std::vector<arma::uword>(workers.size(), 0);
+    for(int repeat = 0; repeat < 5; repeat += 1) {
+        workers.run([&](std::size_t k) { counts[k] += workers.last_row(k) - workers.first_row(k); });
+    }
+    check(counts[0] + counts[1] + counts[2] == 50, "numa workers run");
+    bool caught = false;
+    try {
+        workers.run([](std::size_t k) {
+            if(k == 1) {
+                throw std::runtime_error("worker error");
+            }
+        });
+    } catch(const std::exception &) {
+        caught = true;
+    }
+    check(caught, "numa workers error");
+    check(PinnedWorkers(2, 8, false).size() == 2, "numa workers capped by rows");
+
+    // Row gather / scatter in a packed (n,k) matrix
+    const arma::mat values = arma::randu<arma::mat>(7, 3);
+    const auto segment = PackedSegment{2, values.n_elem};
+    auto packed = arma::vec(2 + values.n_elem, arma::fill::zeros);
+    scatter_rows(packed, segment, 7, 0, values.rows(0, 3));
+    scatter_rows(packed, segment, 7, 4, values.rows(4, 6));
+    check(arma::approx_equal(packed.subvec(2, packed.n_elem - 1), arma::vectorise(values), "absdiff", 0.),
+          "numa scatter");
+    check(arma::approx_equal(gather_rows(packed, segment, 7, 2, 5), values.rows(2, 4), "absdiff", 0.), "numa gather");
+    return success;
+}
+
+#endif
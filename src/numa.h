@@ -0,0 +1,101 @@
+// NUMA-aware row-parallel evaluation.
+//
+// On multi-socket machines, memory pages are placed on the node of the thread that first writes them (first-touch
+// policy). Data prepared by the R thread thus sits on a single node, and threads of the other sockets evaluating the
+// objective read it remotely. Here rows are split in contiguous blocks, each owned by a worker thread pinned to a
+// core: the worker allocates and fills its copy of the data of its rows, so that evaluations read the data locally.
+// Variational parameters are not placed: nlopt evaluates the objective on its own copies of x and of the gradient,
+// allocated on the node of the calling thread, so each worker gathers the M and S rows of its block remotely (see
+// gather_rows) and scatters its gradient rows back. They are small (k values per row) compared to the data.
+#pragma once
+
+#include "arma_backend.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "data.h"
+#include "packer.h" // PackedSegment
+
+struct NumaConfiguration {
+    int nb_workers; // Number of worker threads, 0 to disable row-parallel evaluation
+    bool pin;       // Pin each worker to a core (Linux only)
+};
+
+// Persistent pool of worker threads, worker k owning rows [first_row(k), last_row(k)).
+// Workers are spread evenly over the cores the process may run on, so that with contiguous core numbering per socket
+// all sockets get workers.
+class PinnedWorkers {
+  public:
+    PinnedWorkers(arma::uword n_rows, int nb_workers, bool pin);
+    ~PinnedWorkers();
+    PinnedWorkers(const PinnedWorkers &) = delete;
+    PinnedWorkers & operator=(const PinnedWorkers &) = delete;
+
+    std::size_t size() const { return threads_.size(); }
+    arma::uword first_row(std::size_t worker) const { return bounds_[worker]; }
+    arma::uword last_row(std::size_t worker) const { return bounds_[worker + 1]; }
+
+    // Run task(worker) in every worker thread and wait for all of them. The first error is rethrown.
+    // Concurrent calls are serialized. Tasks must not use the R API.
+    void run(const std::function<void(std::size_t worker)> & task);
+
+  private:
+    std::vector<arma::uword> bounds_;
+    std::vector<std::thread> threads_;
+
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable finished_;
+    const std::function<void(std::size_t)> * task_;
+    std::uint64_t generation_;
+    std::size_t nb_running_;
+    bool stop_;
+    std::string error_;
+
+    void worker_loop(std::size_t worker, int cpu);
+};
+
+// Data of a block of rows, allocated and filled by its owning worker
+struct RowBlock {
+    CountMatrix Y;         // responses (rows,p)
+    Offsets<double> O;     // offsets (rows,p)
+    arma::vec w;           // weights (rows)
+    Design<double> design; // covariates (rows,d)
+
+    RowBlock(const arma::uvec & rows, const CountMatrix & Y_, const Offsets<double> & O_, const arma::mat & X,
+             const arma::vec & w_)
+        : Y(Y_.subset_rows(rows)), O(O_.subset_rows(rows)), w(w_.elem(rows)), design(X.rows(rows), w) {}
+};
+
+// Workers with their local data. The BLAS is restricted to one thread while it exists, as workers already use all
+// the cores (see thread_budget.h).
+class NumaRowBlocks {
+  public:
+    NumaRowBlocks(const NumaConfiguration & config, const CountMatrix & Y, const Offsets<double> & O,
+                  const arma::mat & X, const arma::vec & w);
+    ~NumaRowBlocks();
+
+    PinnedWorkers & workers() { return workers_; }
+    const RowBlock & block(std::size_t worker) const { return *blocks_[worker]; }
+
+  private:
+    PinnedWorkers workers_;
+    std::vector<std::unique_ptr<RowBlock>> blocks_;
+    int previous_blas_threads_;
+};
+
+// Rows [first_row, last_row) of the (n_rows, k) column-major matrix stored at segment of packed
+arma::mat gather_rows(
+    const arma::vec & packed, PackedSegment segment, arma::uword n_rows, arma::uword first_row, arma::uword last_row);
+
+// Write values as rows [first_row, first_row + values.n_rows) of the matrix stored at segment of packed
+void scatter_rows(
+    arma::vec & packed, PackedSegment segment, arma::uword n_rows, arma::uword first_row, const arma::mat & values);
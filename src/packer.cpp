@@ -1,4 +1,8 @@
 #include "packer.h"
+#include "memory_tracking.h" // memory_tracking_enabled
+#include "models.h"          // ParameterTolerance
+
+#include <cstdint> // uintptr_t
 
 // [[Rcpp::export]]
 bool cpp_test_packer() {
@@ -21,6 +25,8 @@ bool cpp_test_packer() {
     check(std::get<1>(packer.elements).offset == 0, "packer offset 1");
     check(std::get<2>(packer.elements).offset == 4 * 10, "packer offset 2");
     check(std::get<3>(packer.elements).offset == 4 * 10 + 7, "packer offset 3");
+    check(packer.segment<1>().offset == 0 && packer.segment<1>().size == 4 * 10, "packer segment 1");
+    check(packer.segment<3>().offset == 4 * 10 + 7 && packer.segment<3>().size == 7, "packer segment 3");
 
     auto packed = arma::vec(packer.size);
     packer.pack<0>(packed, z);
@@ -33,15 +39,146 @@ bool cpp_test_packer() {
     check(arma::approx_equal(b, packer.unpack<2>(packed), "absdiff", epsilon), "unpack 2");
     check(arma::approx_equal(b, packer.unpack<3>(packed), "absdiff", epsilon), "unpack 3");
 
-    packer.pack_double_or_arma<1>(packed, Rcpp::wrap(0.));
-    check(packer.unpack<1>(packed).is_zero(), "pack_double_or_arma double(0.) in mat");
-    packer.pack_double_or_arma<1>(packed, Rcpp::wrap(a));
-    check(arma::approx_equal(a, packer.unpack<1>(packed), "absdiff", epsilon), "pack_double_or_arma mat");
+    packer.fill<1>(packed, 0.);
+    check(packer.unpack<1>(packed).is_zero(), "fill mat");
+    packer.fill<2>(packed, 0.);
+    check(packer.unpack<2>(packed).is_zero(), "fill vec");
+
+    // Aligned layout: each value starts on a 64 bytes boundary, padding is zeroed by pack and fill
+    const auto aligned = make_aligned_packer(z, a, b, b);
+    check(aligned.size == 40 + 8 + 8, "aligned packer size");
+    check(aligned.segment<1>().offset == 0 && aligned.segment<1>().size == 40, "aligned segment 1");
+    check(aligned.segment<2>().offset == 40 && aligned.segment<3>().offset == 48, "aligned offsets");
+    auto aligned_packed = arma::vec(aligned.size);
+    aligned_packed.fill(arma::datum::nan);
+    aligned.pack<1>(aligned_packed, a);
+    aligned.pack<2>(aligned_packed, b);
+    aligned.fill<3>(aligned_packed, 2.);
+    check(aligned_packed(47) == 0. && aligned_packed(55) == 0. && aligned_packed.is_finite(), "aligned padding");
+    check(arma::approx_equal(a, aligned.unpack<1>(aligned_packed), "absdiff", epsilon), "aligned unpack 1");
+    check(arma::approx_equal(b, aligned.unpack<2>(aligned_packed), "absdiff", epsilon), "aligned unpack 2");
+    check(reinterpret_cast<std::uintptr_t>(aligned_packed.memptr() + aligned.segment<3>().offset) % 64 == 0 ||
+              !memory_tracking_enabled(),
+          "aligned address");
+
+    // Padded columns: columns of a (4 rows) are stored with a stride of 8 elements
+    const auto padded = make_packer_with_layout(aligned_columns_layout, b, a);
+    check(padded.size == 8 + 8 * 10 && padded.segment<1>().offset == 8 && padded.segment<1>().size == 80,
+          "padded columns size");
+    auto padded_packed = arma::vec(padded.size);
+    padded_packed.fill(arma::datum::nan);
+    padded.pack<0>(padded_packed, b);
+    padded.pack<1>(padded_packed, 2. * a);
+    check(arma::approx_equal(2. * a, padded.unpack<1>(padded_packed), "absdiff", epsilon), "padded columns unpack");
+    check(padded_packed(8 + 4) == 0. && padded_packed(8 + 8 + 7) == 0. && padded_packed.is_finite(),
+          "padded columns padding");
+    padded.pack<1>(padded_packed, arma::vectorise(a));
+    check(arma::approx_equal(a, padded.unpack<1>(padded_packed), "absdiff", epsilon), "padded columns vec expression");
+    padded.fill<1>(padded_packed, 1.);
+    check(arma::accu(padded_packed.subvec(8, 87)) == 40., "padded columns fill");
+
+    // Rows of M (4,10) and S (4,1) interleaved: each row is a contiguous column of 11 values
+    const arma::mat s = arma::randu<arma::mat>(4, 1);
+    const auto interleaved = make_aligned_packer(b, InterleavedRows{a, s});
+    const auto & rows_info = std::get<1>(interleaved.elements);
+    check(interleaved.size == 8 + 48 && rows_info.offset == 8 && rows_info.n_elem() == 44, "interleaved size");
+    auto interleaved_packed = arma::vec(interleaved.size);
+    interleaved_packed.fill(arma::datum::nan);
+    interleaved.pack<0>(interleaved_packed, b);
+    interleaved.pack<1>(interleaved_packed, InterleavedRows{a, s});
+    check(interleaved_packed.is_finite() && interleaved_packed(8 + 44) == 0., "interleaved padding");
+    const arma::mat row_2 = rows_info.rows_view(interleaved_packed, 2, 3);
+    check(row_2.n_rows == 11 && arma::approx_equal(row_2.head_rows(10), a.row(2).t(), "absdiff", epsilon) &&
+              std::abs(row_2(10, 0) - s(2, 0)) < epsilon,
+          "interleaved row view");
+    const arma::vec packed_S = interleaved_packed.elem(rows_info.S_indices());
+    check(arma::approx_equal(packed_S, arma::vectorise(s), "absdiff", epsilon), "interleaved S indices");
+    arma::mat unpacked_M;
+    arma::mat unpacked_S(4, 1); // Written in place
+    const double * unpacked_S_memory = unpacked_S.memptr();
+    interleaved.unpack_into<1>(interleaved_packed, unpacked_M, unpacked_S);
+    check(arma::approx_equal(a, unpacked_M, "absdiff", epsilon), "interleaved unpack M");
+    check(arma::approx_equal(s, unpacked_S, "absdiff", epsilon) && unpacked_S.memptr() == unpacked_S_memory,
+          "interleaved unpack S");
+    arma::mat rows_1_3 = rows_info.rows_view(interleaved_packed, 1, 3);
+    rows_1_3.zeros();
+    interleaved.unpack_into<1>(interleaved_packed, unpacked_M, unpacked_S);
+    check(unpacked_M.rows(1, 2).is_zero(), "interleaved writable view");
+    rows_info.fill(interleaved_packed, 1., 2.);
+    interleaved.unpack_into<1>(interleaved_packed, unpacked_M, unpacked_S);
+    check(arma::all(arma::vectorise(unpacked_M) == 1.) && arma::all(arma::vectorise(unpacked_S) == 2.),
+          "interleaved fill M and S");
+
+    // Row vector, cube, scalar and sparse matrix (values on the pattern of the reference matrix)
+    const arma::rowvec r = arma::randu<arma::rowvec>(3);
+    const arma::cube c = arma::randu<arma::cube>(2, 3, 4);
+    const double sigma2 = 0.5;
+    arma::sp_mat sp(5, 4);
+    sp(0, 0) = 1.;
+    sp(3, 1) = 2.;
+    sp(2, 3) = 3.;
+    const auto others = make_aligned_packer(r, c, sigma2, sp);
+    check(others.size == 8 + 24 + 8 + 8 && others.segment<2>().offset == 32 && others.segment<3>().offset == 40,
+          "other types offsets");
+    auto others_packed = arma::vec(others.size);
+    others_packed.fill(arma::datum::nan);
+    others.pack<0>(others_packed, 2. * r);
+    others.pack<1>(others_packed, c);
+    others.pack<2>(others_packed, sigma2);
+    others.pack<3>(others_packed, 2. * sp);
+    check(others_packed.is_finite(), "other types padding");
+    check(arma::approx_equal(2. * r, others.unpack<0>(others_packed), "absdiff", epsilon), "rowvec unpack");
+    check(arma::approx_equal(c, others.unpack<1>(others_packed), "absdiff", epsilon), "cube unpack");
+    check(others.unpack<2>(others_packed) == sigma2, "double unpack");
+    check(arma::approx_equal(arma::mat(2. * sp), arma::mat(others.unpack<3>(others_packed)), "absdiff", epsilon),
+          "sp_mat unpack");
+    const auto & sp_info = std::get<3>(others.elements);
+    arma::vec sp_values = sp_info.values_view(others_packed);
+    check(arma::approx_equal(sp_values, arma::vec{2., 4., 6.}, "absdiff", epsilon), "sp_mat values order");
+    sp_values[1] = 0.;
+    check(others_packed(41) == 0. && others.unpack<3>(others_packed).n_nonzero == 2, "sp_mat values view");
+    arma::mat dense = arma::mat(sp) + 1.; // Values outside of the pattern are ignored
+    others.pack<3>(others_packed, dense);
+    check(arma::approx_equal(sp_values, arma::vec{2., 3., 4.}, "absdiff", epsilon), "sp_mat pack dense");
+    arma::sp_mat sp_unpacked;
+    double sigma2_unpacked = 0.;
+    arma::cube c_unpacked;
+    others.unpack_into<3>(others_packed, sp_unpacked);
+    others.unpack_into<2>(others_packed, sigma2_unpacked);
+    others.unpack_into<1>(others_packed, c_unpacked);
+    check(sp_unpacked.n_nonzero == 3 && sp_unpacked(3, 1) == 3. && sigma2_unpacked == sigma2 &&
+              arma::approx_equal(c, c_unpacked, "absdiff", epsilon),
+          "other types unpack into");
+    others.fill<1>(others_packed, 1.);
+    check(arma::all(arma::vectorise(others.unpack<1>(others_packed)) == 1.), "cube fill");
 
-    packer.pack_double_or_arma<2>(packed, Rcpp::wrap(0.));
-    check(packer.unpack<2>(packed).is_zero(), "pack_double_or_arma double(0.) in vec");
-    packer.pack_double_or_arma<2>(packed, Rcpp::wrap(b));
-    check(arma::approx_equal(b, packer.unpack<2>(packed), "absdiff", epsilon), "pack_double_or_arma vec");
+    // Tolerances by parameter: single value, array, or default value
+    ParameterTolerance tolerance;
+    tolerance.value = 1.;
+    tolerance.by_parameter["a"] = arma::vec{0.};
+    tolerance.by_parameter["b"] = arma::vectorise(b);
+    tolerance.pack<1>(packer, packed, "a");
+    check(packer.unpack<1>(packed).is_zero(), "tolerance single value in mat");
+    tolerance.pack<2>(packer, packed, "b");
+    check(arma::approx_equal(b, packer.unpack<2>(packed), "absdiff", epsilon), "tolerance array in vec");
+    tolerance.pack<3>(packer, packed, "c");
+    check(arma::all(packer.unpack<3>(packed) == 1.), "tolerance default value");
+    tolerance.by_parameter["M"] = arma::vectorise(a);
+    check(arma::approx_equal(tolerance.values("M", a), a, "absdiff", epsilon) &&
+              arma::all(arma::vectorise(tolerance.values("S", s)) == 1.),
+          "tolerance values");
+    double single = 0.;
+    check(tolerance.single_value("a", single) && single == 0. && tolerance.single_value("S", single) && single == 1. &&
+              !tolerance.single_value("M", single),
+          "tolerance single value");
+    tolerance.by_parameter["c"] = arma::vectorise(2. * c);
+    tolerance.by_parameter["sigma2"] = arma::vec{1e-4};
+    tolerance.pack<1>(others, others_packed, "c");
+    tolerance.pack<2>(others, others_packed, "sigma2");
+    tolerance.pack<3>(others, others_packed, "Omega");
+    check(arma::approx_equal(2. * c, others.unpack<1>(others_packed), "absdiff", epsilon) &&
+              others.unpack<2>(others_packed) == 1e-4 && arma::all(sp_values == 1.),
+          "tolerance other types");
 
     return success;
 }
\ No newline at end of file
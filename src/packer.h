@@ -2,79 +2,407 @@
 // Automatically generate a struct containing offsets, size, types of a list of arma values.
 // Provide functions to store or extract the arma values into a linearized arma::vec.
 // See tests in packer.cpp for usage.
+#pragma once
 
-#include <RcppArmadillo.h>
-#include <cstddef> // size_t
-#include <tuple>   // packer system
-#include <utility> // move, forward
+#include "arma_backend.h"
+
+#include <algorithm> // copy, equal
+#include <cstddef>   // size_t
+#include <tuple>     // packer system
+#include <utility>   // move, forward
+
+// Placement of the values in the packed vector, in number of elements.
+// Each value starts at a multiple of segment_alignment, and each matrix column at a multiple of column_alignment from
+// the start of its value. The gaps (padding) are not part of any value: writing a value with pack() or fill() also
+// zeroes the padding after it, so that gradients, Hessian diagonals and products built by packing every value are zero
+// on the padding, and padding parameters initialized to zero never move.
+struct PackingLayout {
+    arma::uword segment_alignment;
+    arma::uword column_alignment;
+};
+
+// 64 bytes: a cache line, and the width of AVX-512 registers. Armadillo storage is aligned on 64 bytes (see
+// memory_tracking.cpp), so aligned offsets are aligned addresses in packed vectors allocated by Armadillo.
+const arma::uword simd_alignment = 64 / sizeof(double);
+
+const PackingLayout contiguous_layout = {1, 1};
+const PackingLayout aligned_layout = {simd_alignment, 1};
+const PackingLayout aligned_columns_layout = {simd_alignment, simd_alignment};
+
+inline arma::uword round_up(arma::uword n, arma::uword alignment) {
+    return (n + alignment - 1) / alignment * alignment;
+}
 
 // Stores type, dimensions and offset for a single T object
-// Must be specialised ; see specialisations for arma::vec/arma::mat below
+// Must be specialised ; see specialisations for arma::vec/arma::rowvec/arma::mat/arma::cube/arma::sp_mat/double and
+// InterleavedRows below
 //
 // Required API when specialised:
-// Constructor(const T & reference_object, arma::uword & current_offset);
+// Constructor(const T & reference_object, arma::uword & current_offset, const PackingLayout & layout);
 // T unpack(const arma::vec & packed_storage);
+// void unpack_into(const arma::vec & packed_storage, "T-like" & destination); (see below)
 // void pack(arma::vec & packed_storage, "T-like arma expression type" expr);
-// void pack_double_or_arma(arma::vec & packed_storage, SEXP r_value); (see OptimizerConfiguration)
+// void fill(arma::vec & packed_storage, double value); (same value for all elements)
+// arma::uword n_elem() const; (number of packed elements)
+// PackedSegment segment() const; (location in the packed storage)
 template <typename T> struct PackedInfo;
 
+// Location of a packed value: elements [offset, offset + size) of the packed vector
+struct PackedSegment {
+    arma::uword offset;
+    arma::uword size;
+};
+
+// Storage of a value in the packed vector: 'storage' elements from offset (values and column padding), followed by
+// 'padding' elements up to the start of the next value.
+struct PackedStorage {
+    arma::uword offset;
+    arma::uword storage;
+    arma::uword padding;
+
+    PackedStorage(arma::uword storage_size, arma::uword & current_offset, const PackingLayout & layout) {
+        offset = current_offset;
+        storage = storage_size;
+        current_offset = round_up(offset + storage, layout.segment_alignment);
+        padding = current_offset - (offset + storage);
+    }
+
+    PackedSegment segment() const { return {offset, storage}; }
+
+    void clear_padding(arma::vec & packed) const {
+        packed.subvec(offset + storage, arma::size(padding, 1)).zeros();
+    }
+};
+
+// unpack_into() writes the value in place when destination already has its dimensions (such as a matrix using memory
+// of the caller, see the auxiliary memory constructors of arma::mat), and resizes destination otherwise.
+
 // All following implementation use vec.subvec() to access slices of the packed vector.
 // The "prefered" way to give indexces is using span(start, end).
 // However end is inclusive and unsigned, which causes underflow for 0-sized span of offset 0.
 // Thus I use the less intuitive (but correct) form: subvec(offset, arma::size(size, 1))
 
-template <> struct PackedInfo<arma::vec> {
-    arma::uword offset;
+template <> struct PackedInfo<arma::vec> : PackedStorage {
     arma::uword size;
 
-    PackedInfo(const arma::vec & v, arma::uword & current_offset) {
-        offset = current_offset;
-        size = v.n_elem;
-        current_offset += size;
-    }
+    PackedInfo(const arma::vec & v, arma::uword & current_offset, const PackingLayout & layout)
+        : PackedStorage(v.n_elem, current_offset, layout), size(v.n_elem) {}
+
+    arma::uword n_elem() const { return size; }
 
     arma::vec unpack(const arma::vec & packed) const { return packed.subvec(offset, arma::size(size, 1)); }
 
+    // Into a vector or a (size, 1) matrix
+    void unpack_into(const arma::vec & packed, arma::mat & destination) const {
+        if(!(destination.n_rows == size && destination.n_cols == 1)) {
+            destination.set_size(size, 1);
+        }
+        destination.col(0) = packed.subvec(offset, arma::size(size, 1));
+    }
+
     template <typename Expr> void pack(arma::vec & packed, Expr && expr) const {
         packed.subvec(offset, arma::size(size, 1)) = std::forward<Expr>(expr);
+        clear_padding(packed);
+    }
+
+    void fill(arma::vec & packed, double value) const {
+        packed.subvec(offset, arma::size(size, 1)).fill(value);
+        clear_padding(packed);
     }
+};
+
+// With column padding, columns are stored with a stride of column_stride >= rows elements
+template <> struct PackedInfo<arma::mat> : PackedStorage {
+    arma::uword rows;
+    arma::uword cols;
+    arma::uword column_stride;
 
-    void pack_double_or_arma(arma::vec & packed, SEXP r_value) const {
-        if(Rcpp::is<double>(r_value)) {
-            packed.subvec(offset, arma::size(size, 1)).fill(Rcpp::as<double>(r_value));
+    PackedInfo(const arma::mat & m, arma::uword & current_offset, const PackingLayout & layout)
+        : PackedStorage(round_up(m.n_rows, layout.column_alignment) * m.n_cols, current_offset, layout),
+          rows(m.n_rows),
+          cols(m.n_cols),
+          column_stride(round_up(m.n_rows, layout.column_alignment)) {}
+
+    arma::uword n_elem() const { return rows * cols; }
+
+    arma::mat unpack(const arma::vec & packed) const {
+        if(column_stride == rows) {
+            return arma::reshape(packed.subvec(offset, arma::size(rows * cols, 1)), arma::size(rows, cols));
+        }
+        const arma::mat view(const_cast<double *>(packed.memptr()) + offset, column_stride, cols, false, true);
+        return view.head_rows(rows);
+    }
+
+    void unpack_into(const arma::vec & packed, arma::mat & destination) const {
+        if(!(destination.n_rows == rows && destination.n_cols == cols)) {
+            destination.set_size(rows, cols);
+        }
+        const arma::mat view(const_cast<double *>(packed.memptr()) + offset, column_stride, cols, false, true);
+        destination = view.head_rows(rows);
+    }
+
+    template <typename Expr> void pack(arma::vec & packed, Expr && expr) const {
+        // Handles: mat expressions, vec expressions
+        if(column_stride == rows) {
+            packed.subvec(offset, arma::size(rows * cols, 1)) = arma::vectorise(std::forward<Expr>(expr));
+        } else {
+            arma::mat view(packed.memptr() + offset, column_stride, cols, false, true); // No copy
+            view.head_rows(rows) = arma::reshape(arma::vectorise(std::forward<Expr>(expr)), rows, cols);
+            view.tail_rows(column_stride - rows).zeros();
+        }
+        clear_padding(packed);
+    }
+
+    void fill(arma::vec & packed, double value) const {
+        if(column_stride == rows) {
+            packed.subvec(offset, arma::size(rows * cols, 1)).fill(value);
         } else {
-            pack(packed, Rcpp::as<arma::vec>(r_value));
+            arma::mat view(packed.memptr() + offset, column_stride, cols, false, true); // No copy
+            view.head_rows(rows).fill(value);
+            view.tail_rows(column_stride - rows).zeros();
         }
+        clear_padding(packed);
     }
 };
 
-template <> struct PackedInfo<arma::mat> {
-    arma::uword offset;
+template <> struct PackedInfo<arma::rowvec> : PackedStorage {
+    arma::uword size;
+
+    PackedInfo(const arma::rowvec & v, arma::uword & current_offset, const PackingLayout & layout)
+        : PackedStorage(v.n_elem, current_offset, layout), size(v.n_elem) {}
+
+    arma::uword n_elem() const { return size; }
+
+    arma::rowvec unpack(const arma::vec & packed) const { return packed.subvec(offset, arma::size(size, 1)).t(); }
+
+    // Into a row vector or a (1, size) matrix
+    void unpack_into(const arma::vec & packed, arma::mat & destination) const {
+        if(!(destination.n_rows == 1 && destination.n_cols == size)) {
+            destination.set_size(1, size);
+        }
+        destination.row(0) = packed.subvec(offset, arma::size(size, 1)).t();
+    }
+
+    template <typename Expr> void pack(arma::vec & packed, Expr && expr) const {
+        // Handles: rowvec expressions, vec expressions
+        packed.subvec(offset, arma::size(size, 1)) = arma::vectorise(std::forward<Expr>(expr));
+        clear_padding(packed);
+    }
+
+    void fill(arma::vec & packed, double value) const {
+        packed.subvec(offset, arma::size(size, 1)).fill(value);
+        clear_padding(packed);
+    }
+};
+
+// Scalar parameter (such as sigma2 of the spherical model)
+template <> struct PackedInfo<double> : PackedStorage {
+    PackedInfo(double, arma::uword & current_offset, const PackingLayout & layout)
+        : PackedStorage(1, current_offset, layout) {}
+
+    arma::uword n_elem() const { return 1; }
+
+    double unpack(const arma::vec & packed) const { return packed[offset]; }
+
+    void unpack_into(const arma::vec & packed, double & destination) const { destination = packed[offset]; }
+
+    void pack(arma::vec & packed, double value) const {
+        packed[offset] = value;
+        clear_padding(packed);
+    }
+    // 1 element arma expressions
+    template <typename T1> void pack(arma::vec & packed, const arma::Base<double, T1> & expr) const {
+        pack(packed, arma::as_scalar(expr.get_ref()));
+    }
+
+    void fill(arma::vec & packed, double value) const { pack(packed, value); }
+};
+
+// Slices are stored back to back: column padding does not apply.
+template <> struct PackedInfo<arma::cube> : PackedStorage {
     arma::uword rows;
     arma::uword cols;
+    arma::uword slices;
 
-    PackedInfo(const arma::mat & m, arma::uword & current_offset) {
-        offset = current_offset;
-        rows = m.n_rows;
-        cols = m.n_cols;
-        current_offset += rows * cols;
+    PackedInfo(const arma::cube & c, arma::uword & current_offset, const PackingLayout & layout)
+        : PackedStorage(c.n_elem, current_offset, layout), rows(c.n_rows), cols(c.n_cols), slices(c.n_slices) {}
+
+    arma::uword n_elem() const { return rows * cols * slices; }
+
+    arma::cube unpack(const arma::vec & packed) const {
+        return arma::cube(packed.memptr() + offset, rows, cols, slices); // Copy
     }
 
-    arma::mat unpack(const arma::vec & packed) const {
-        return arma::reshape(packed.subvec(offset, arma::size(rows * cols, 1)), arma::size(rows, cols));
+    void unpack_into(const arma::vec & packed, arma::cube & destination) const {
+        if(!(destination.n_rows == rows && destination.n_cols == cols && destination.n_slices == slices)) {
+            destination.set_size(rows, cols, slices);
+        }
+        const double * values = packed.memptr() + offset;
+        std::copy(values, values + n_elem(), destination.memptr());
     }
 
     template <typename Expr> void pack(arma::vec & packed, Expr && expr) const {
-        // Handles: mat expressions, vec expressions
-        packed.subvec(offset, arma::size(rows * cols, 1)) = arma::vectorise(std::forward<Expr>(expr));
+        // Handles: cube expressions, vec expressions
+        packed.subvec(offset, arma::size(n_elem(), 1)) = arma::vectorise(std::forward<Expr>(expr));
+        clear_padding(packed);
     }
 
-    void pack_double_or_arma(arma::vec & packed, SEXP r_value) const {
-        if(Rcpp::is<double>(r_value)) {
-            packed.subvec(offset, arma::size(rows * cols, 1)).fill(Rcpp::as<double>(r_value));
+    void fill(arma::vec & packed, double value) const {
+        packed.subvec(offset, arma::size(n_elem(), 1)).fill(value);
+        clear_padding(packed);
+    }
+};
+
+// Sparse matrix on a fixed sparsity pattern, the one of the reference matrix: only the values at the positions of the
+// pattern are packed, in its compressed sparse column order (the order of sp_mat::values). Values packed outside of
+// the pattern are ignored, and positions of the pattern absent from a packed sparse matrix are packed as zeros.
+// Column padding does not apply.
+template <> struct PackedInfo<arma::sp_mat> : PackedStorage {
+    arma::uword rows;
+    arma::uword cols;
+    arma::uvec row_indices; // Pattern in compressed sparse column format
+    arma::uvec col_ptrs;
+
+    PackedInfo(const arma::sp_mat & m, arma::uword & current_offset, const PackingLayout & layout)
+        : PackedStorage(m.n_nonzero, current_offset, layout), rows(m.n_rows), cols(m.n_cols) {
+        m.sync();
+        row_indices = arma::uvec(m.row_indices, m.n_nonzero);
+        col_ptrs = arma::uvec(m.col_ptrs, m.n_cols + 1);
+    }
+
+    arma::uword n_elem() const { return row_indices.n_elem; }
+
+    // Values of the pattern using the storage of packed (no copy)
+    arma::vec values_view(arma::vec & packed) const {
+        return arma::vec(packed.memptr() + offset, n_elem(), false, true);
+    }
+    // Same, read only
+    arma::vec values_view(const arma::vec & packed) const { return values_view(const_cast<arma::vec &>(packed)); }
+
+    // Zero values are dropped from the sparse matrix
+    arma::sp_mat unpack(const arma::vec & packed) const {
+        return arma::sp_mat(row_indices, col_ptrs, values_view(packed), rows, cols);
+    }
+
+    void unpack_into(const arma::vec & packed, arma::sp_mat & destination) const { destination = unpack(packed); }
+
+    void pack(arma::vec & packed, const arma::sp_mat & m) const {
+        m.sync();
+        arma::vec values = values_view(packed);
+        if(m.n_nonzero == n_elem() && std::equal(col_ptrs.begin(), col_ptrs.end(), m.col_ptrs) &&
+           std::equal(row_indices.begin(), row_indices.end(), m.row_indices)) {
+            values = arma::vec(m.values, m.n_nonzero);
+        } else {
+            for(arma::uword j = 0; j < cols; j += 1) {
+                for(arma::uword k = col_ptrs[j]; k < col_ptrs[j + 1]; k += 1) {
+                    values[k] = m(row_indices[k], j);
+                }
+            }
+        }
+        clear_padding(packed);
+    }
+    template <typename T1> void pack(arma::vec & packed, const arma::SpBase<double, T1> & expr) const {
+        pack(packed, arma::sp_mat(expr.get_ref()));
+    }
+    // Dense (rows, cols) matrix expressions, read at the positions of the pattern, or vectors of the n_elem() values
+    template <typename T1> void pack(arma::vec & packed, const arma::Base<double, T1> & expr) const {
+        const arma::mat m = expr.get_ref();
+        arma::vec values = values_view(packed);
+        if(m.n_rows == rows && m.n_cols == cols) {
+            for(arma::uword j = 0; j < cols; j += 1) {
+                for(arma::uword k = col_ptrs[j]; k < col_ptrs[j + 1]; k += 1) {
+                    values[k] = m(row_indices[k], j);
+                }
+            }
         } else {
-            pack(packed, Rcpp::as<arma::mat>(r_value));
+            values = arma::vectorise(m);
         }
+        clear_padding(packed);
+    }
+
+    void fill(arma::vec & packed, double value) const {
+        packed.subvec(offset, arma::size(n_elem(), 1)).fill(value);
+        clear_padding(packed);
+    }
+};
+
+// Variational parameters of rows, M (n,p) and S (n,k) with k = p (diagonal S) or k = 1 (one S per row), stored
+// interleaved by row: row i is M(i, :) followed by S(i, :), contiguous (array of structures by row, structure of
+// arrays within the row). Rows [first, last) then form a (p + k, last - first) column-major matrix, with M' in its
+// first p rows and S' in its last k rows, so that per-row kernels read each row as one contiguous column.
+// InterleavedRows only refers to M and S (no copy): they must outlive it.
+struct InterleavedRows {
+    const arma::mat & M;
+    const arma::mat & S;
+};
+
+// Column padding does not apply: rows are packed back to back. InterleavedRows does not hold values, so there is no
+// unpack(): values are read with unpack_into().
+template <> struct PackedInfo<InterleavedRows> : PackedStorage {
+    arma::uword rows;
+    arma::uword m_cols;
+    arma::uword s_cols;
+
+    PackedInfo(const InterleavedRows & v, arma::uword & current_offset, const PackingLayout & layout)
+        : PackedStorage(v.M.n_rows * (v.M.n_cols + v.S.n_cols), current_offset, layout),
+          rows(v.M.n_rows),
+          m_cols(v.M.n_cols),
+          s_cols(v.S.n_cols) {}
+
+    arma::uword n_elem() const { return rows * row_size(); }
+    arma::uword row_size() const { return m_cols + s_cols; }
+
+    // (row_size, last - first) matrix using the storage of rows [first, last) of packed (no copy)
+    arma::mat rows_view(arma::vec & packed, arma::uword first, arma::uword last) const {
+        return arma::mat(packed.memptr() + offset + first * row_size(), row_size(), last - first, false, true);
+    }
+    // Same, read only
+    arma::mat rows_view(const arma::vec & packed, arma::uword first, arma::uword last) const {
+        return rows_view(const_cast<arma::vec &>(packed), first, last);
+    }
+
+    // Indexes of the elements of S in the packed storage
+    arma::uvec S_indices() const {
+        arma::uvec indices(rows * s_cols);
+        for(arma::uword i = 0; i < rows; i += 1) {
+            for(arma::uword j = 0; j < s_cols; j += 1) {
+                indices[i * s_cols + j] = offset + i * row_size() + m_cols + j;
+            }
+        }
+        return indices;
+    }
+
+    // Values are transposed back to (n,p) and (n,k)
+    void unpack_into(const arma::vec & packed, arma::mat & M, arma::mat & S) const {
+        if(!(M.n_rows == rows && M.n_cols == m_cols)) {
+            M.set_size(rows, m_cols);
+        }
+        if(!(S.n_rows == rows && S.n_cols == s_cols)) {
+            S.set_size(rows, s_cols);
+        }
+        const arma::mat view = rows_view(packed, 0, rows);
+        M = view.head_rows(m_cols).t();
+        S = view.tail_rows(s_cols).t();
+    }
+
+    void pack(arma::vec & packed, const InterleavedRows & values) const {
+        arma::mat view = rows_view(packed, 0, rows);
+        view.head_rows(m_cols) = values.M.t();
+        view.tail_rows(s_cols) = values.S.t();
+        clear_padding(packed);
+    }
+
+    void fill(arma::vec & packed, double value) const {
+        packed.subvec(offset, arma::size(storage, 1)).fill(value);
+        clear_padding(packed);
+    }
+
+    // One value for all elements of M, another for all elements of S
+    void fill(arma::vec & packed, double m_value, double s_value) const {
+        arma::mat view = rows_view(packed, 0, rows);
+        view.head_rows(m_cols).fill(m_value);
+        view.tail_rows(s_cols).fill(s_value);
+        clear_padding(packed);
     }
 };
 
@@ -88,7 +416,7 @@ template <> struct PackedInfo<arma::mat> {
 // packer.pack<A_ID>(storage, value);
 template <typename... Types> struct Packer {
     std::tuple<PackedInfo<Types>...> elements; // Packing info for each element (offset, type, dimensions)
-    arma::uword size;                          // Total number of packed elements
+    arma::uword size;                          // Total number of packed elements, padding included
 
     // packer.unpack<i>(storage) : extract value of T_i in 'storage'
     template <std::size_t Index> auto unpack(const arma::vec & packed) const
@@ -96,26 +424,49 @@ template <typename... Types> struct Packer {
         return std::get<Index>(elements).unpack(packed);
     }
 
+    // packer.unpack_into<i>(storage, destination...) : extract value of T_i in 'storage' into 'destination'
+    template <std::size_t Index, typename... Destination>
+    void unpack_into(const arma::vec & packed, Destination &... destination) const {
+        std::get<Index>(elements).unpack_into(packed, destination...);
+    }
+
     // packer.pack<i>(storage, value) : stores 'value' at T_i's location in 'storage'
     template <std::size_t Index, typename Expr> void pack(arma::vec & packed, Expr && expr) const {
         std::get<Index>(elements).pack(packed, std::forward<Expr>(expr));
     }
 
-    // packer.pack_double_or_arma<i>(storage, r_value) :
-    // if 'r_value' is a double, fills T_i location in 'storage' with the double.
-    // if 'r_value' is an arma::mat/vec, check dimensions and fills T_i's location with it.
-    template <std::size_t Index> void pack_double_or_arma(arma::vec & packed, SEXP r_value) const {
-        std::get<Index>(elements).pack_double_or_arma(packed, r_value);
+    // packer.fill<i>(storage, value) : fills T_i's location in 'storage' with 'value'
+    template <std::size_t Index> void fill(arma::vec & packed, double value) const {
+        std::get<Index>(elements).fill(packed, value);
+    }
+
+    // packer.clear_padding<i>(storage) : zeroes the padding after T_i, for values written without pack() or fill()
+    template <std::size_t Index> void clear_padding(arma::vec & packed) const {
+        std::get<Index>(elements).clear_padding(packed);
     }
+
+    // packer.segment<i>() : location of T_i in the packed storage, column padding included
+    template <std::size_t Index> PackedSegment segment() const { return std::get<Index>(elements).segment(); }
 };
 
-template <typename... Types> Packer<Types...> make_packer(const Types &... values) {
+template <typename... Types>
+Packer<Types...> make_packer_with_layout(const PackingLayout & layout, const Types &... values) {
     // Initialize Packer<Types...> using brace init, which guarantees evaluation order (required here !).
     // Will call each PackedInfo<T> constructor in order, increasing offset.
     // Then the final offset value will be copied into the size field.
     arma::uword current_offset = 0;
     return {
-        {PackedInfo<Types>(values, current_offset)...}, // Increases offset sequentially for each value
-        current_offset,                                 // Final value
+        {PackedInfo<Types>(values, current_offset, layout)...}, // Increases offset sequentially for each value
+        current_offset,                                         // Final value
     };
-}
\ No newline at end of file
+}
+
+// Values stored back to back
+template <typename... Types> Packer<Types...> make_packer(const Types &... values) {
+    return make_packer_with_layout(contiguous_layout, values...);
+}
+
+// Values starting on 64 bytes boundaries, for the parameters of the optimizers
+template <typename... Types> Packer<Types...> make_aligned_packer(const Types &... values) {
+    return make_packer_with_layout(aligned_layout, values...);
+}
@@ -0,0 +1,335 @@
+#include "perf_counters.h"
+
+#include <cstdlib> // getenv, strtoull
+#include <cstring> // memset
+#include <limits>
+#include <mutex>
+#include <utility> // move
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const double not_available = std::numeric_limits<double>::quiet_NaN();
+
+PerfCounts PerfCounts::zero() {
+    return PerfCounts{0., 0., 0., 0., 0., 0., 0., 0};
+}
+
+PerfCounts & PerfCounts::operator+=(const PerfCounts & other) {
+    cycles += other.cycles;
+    instructions += other.instructions;
+    cache_references += other.cache_references;
+    cache_misses += other.cache_misses;
+    branch_misses += other.branch_misses;
+    flops += other.flops;
+    seconds += other.seconds;
+    nb_measures += other.nb_measures;
+    return *this;
+}
+
+// Counter fields of PerfCounts by event index
+static double & counter_field(PerfCounts & counts, int event) {
+    double * fields[] = {
+        &counts.cycles,
+        &counts.instructions,
+        &counts.cache_references,
+        &counts.cache_misses,
+        &counts.branch_misses,
+        &counts.flops};
+    return *fields[event];
+}
+
+// ---------------------------------------------------------------------------------------
+// perf_event_open group
+
+#ifdef __linux__
+static int open_event(std::uint32_t type, std::uint64_t config, int group_fd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd == -1 ? 1 : 0; // The leader enables the group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return int(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+#endif
+
+PerfCounterGroup::PerfCounterGroup() : leader_(-1) {
+    for(int k = 0; k < NB_EVENTS; k += 1) {
+        fds_[k] = -1;
+        positions_[k] = -1;
+    }
+#ifdef __linux__
+    struct Event {
+        std::uint32_t type;
+        std::uint64_t config;
+    };
+    Event events[NB_EVENTS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_RAW, 0},
+    };
+    const char * flops_event = std::getenv("PLNMODELS_PERF_FLOPS_EVENT");
+    const bool with_flops = flops_event != nullptr && *flops_event != '\0';
+    if(with_flops) {
+        events[NB_EVENTS - 1].config = std::strtoull(flops_event, nullptr, 0);
+    }
+    int nb_opened = 0;
+    for(int k = 0; k < NB_EVENTS; k += 1) {
+        if(k == NB_EVENTS - 1 && !with_flops) {
+            break;
+        }
+        const int fd = open_event(events[k].type, events[k].config, leader_);
+        if(fd < 0) {
+            if(k == 0) {
+                return; // No cycles counter: no PMU access at all
+            }
+            continue;
+        }
+        if(k == 0) {
+            leader_ = fd;
+        }
+        fds_[k] = fd;
+        positions_[k] = nb_opened;
+        nb_opened += 1;
+    }
+    ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+PerfCounterGroup::~PerfCounterGroup() {
+#ifdef __linux__
+    for(int k = NB_EVENTS - 1; k >= 0; k -= 1) {
+        if(fds_[k] >= 0) {
+            close(fds_[k]);
+        }
+    }
+#endif
+}
+
+PerfCounts PerfCounterGroup::read() const {
+    PerfCounts counts = PerfCounts::zero();
+    for(int k = 0; k < NB_EVENTS; k += 1) {
+        counter_field(counts, k) = not_available;
+    }
+#ifdef __linux__
+    if(leader_ < 0) {
+        return counts;
+    }
+    // Group read format: nr, time_enabled, time_running, value[nr]
+    std::uint64_t buffer[3 + NB_EVENTS];
+    const ssize_t size = ::read(leader_, buffer, sizeof(buffer));
+    if(size < ssize_t(3 * sizeof(std::uint64_t))) {
+        return counts;
+    }
+    const std::uint64_t nb_values = buffer[0];
+    // Scale counts if the group was not always scheduled on the PMU (multiplexing)
+    const double scale = buffer[2] > 0 ? double(buffer[1]) / double(buffer[2]) : 0.;
+    for(int k = 0; k < NB_EVENTS; k += 1) {
+        if(positions_[k] >= 0 && std::uint64_t(positions_[k]) < nb_values) {
+            counter_field(counts, k) = double(buffer[3 + positions_[k]]) * scale;
+        }
+    }
+#endif
+    return counts;
+}
+
+// ---------------------------------------------------------------------------------------
+// Recorder
+
+PerfRecorder::PerfRecorder(bool enabled)
+    : requested_(enabled), thread_(std::this_thread::get_id()), totals_(PerfCounts::zero()) {
+    if(!enabled) {
+        return;
+    }
+    std::unique_ptr<PerfCounterGroup> group(new PerfCounterGroup());
+    if(group->available()) {
+        group_ = std::move(group);
+    } else {
+        for(int k = 0; k < PerfCounterGroup::NB_EVENTS; k += 1) {
+            counter_field(totals_, k) = not_available;
+        }
+    }
+}
+
+void PerfRecorder::add_difference(const PerfCounts & after, const PerfCounts & before, double seconds) {
+    PerfCounts difference = PerfCounts::zero();
+    for(int k = 0; k < PerfCounterGroup::NB_EVENTS; k += 1) {
+        counter_field(difference, k) = counter_field(after, k) - counter_field(before, k);
+    }
+    difference.seconds = seconds;
+    difference.nb_measures = 1;
+    totals_ += difference;
+}
+
+std::vector<PerfCounts> PerfRecorder::finish(const std::string & model) const {
+    if(!requested_) {
+        return std::vector<PerfCounts>();
+    }
+    record_perf_counts(model, totals_);
+    return std::vector<PerfCounts>{totals_};
+}
+
+PerfRecorder::ObjectiveAndGrad PerfRecorder::wrap(ObjectiveAndGrad objective_and_grad_fn) {
+    if(!enabled() || !objective_and_grad_fn) {
+        return objective_and_grad_fn;
+    }
+    return [this, objective_and_grad_fn](const arma::vec & parameters, arma::vec & gradients) -> double {
+        double objective = 0.;
+        measure([&]() { objective = objective_and_grad_fn(parameters, gradients); });
+        return objective;
+    };
+}
+
+HessianAt PerfRecorder::wrap(HessianAt hessian_at) {
+    if(!enabled() || !hessian_at) {
+        return hessian_at;
+    }
+    return [this, hessian_at](const arma::vec & parameters, arma::vec & diagonal) -> HessianVectorProduct {
+        HessianVectorProduct product;
+        measure([&]() { product = hessian_at(parameters, diagonal); });
+        return [this, product](const arma::vec & direction, arma::vec & result) {
+            measure([&]() { product(direction, result); });
+        };
+    };
+}
+
+// ---------------------------------------------------------------------------------------
+// Totals by model
+
+static std::mutex perf_counts_mutex;
+static std::map<std::string, PerfCounts> perf_counts;
+
+void record_perf_counts(const std::string & model, const PerfCounts & counts) {
+    std::lock_guard<std::mutex> lock(perf_counts_mutex);
+    auto it = perf_counts.find(model);
+    if(it == perf_counts.end()) {
+        perf_counts.emplace(model, counts);
+    } else {
+        it->second += counts;
+    }
+}
+
+std::map<std::string, PerfCounts> perf_counts_by_model() {
+    std::lock_guard<std::mutex> lock(perf_counts_mutex);
+    return perf_counts;
+}
+
+void clear_perf_counts() {
+    std::lock_guard<std::mutex> lock(perf_counts_mutex);
+    perf_counts.clear();
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// R interface
+
+// Totals by model type since the last clear, as a data.frame
+// [[Rcpp::export]]
+Rcpp::DataFrame cpp_perf_counters(bool clear) {
+    const auto by_model = perf_counts_by_model();
+    if(clear) {
+        clear_perf_counts();
+    }
+    const auto nb_models = by_model.size();
+    auto model = Rcpp::CharacterVector(nb_models);
+    Rcpp::NumericVector columns[8];
+    for(auto & column : columns) {
+        column = Rcpp::NumericVector(nb_models);
+    }
+    std::size_t k = 0;
+    for(const auto & entry : by_model) {
+        const PerfCounts & counts = entry.second;
+        model[k] = entry.first;
+        columns[0][k] = counts.cycles;
+        columns[1][k] = counts.instructions;
+        columns[2][k] = counts.cache_references;
+        columns[3][k] = counts.cache_misses;
+        columns[4][k] = counts.branch_misses;
+        columns[5][k] = counts.flops;
+        columns[6][k] = counts.seconds;
+        columns[7][k] = double(counts.nb_measures);
+        k += 1;
+    }
+    return Rcpp::DataFrame::create(
+        Rcpp::Named("model") = model,
+        Rcpp::Named("cycles") = columns[0],
+        Rcpp::Named("instructions") = columns[1],
+        Rcpp::Named("cache_references") = columns[2],
+        Rcpp::Named("cache_misses") = columns[3],
+        Rcpp::Named("branch_misses") = columns[4],
+        Rcpp::Named("flops") = columns[5],
+        Rcpp::Named("seconds") = columns[6],
+        Rcpp::Named("measures") = columns[7],
+        Rcpp::Named("stringsAsFactors") = false);
+}
+
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_perf_counters() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    // Disabled recorders leave closures unchanged
+    PerfRecorder disabled(false);
+    check(!disabled.enabled(), "perf disabled");
+    int nb_calls = 0;
+    auto quadratic = [&nb_calls](const arma::vec & x, arma::vec & grad) -> double {
+        nb_calls += 1;
+        grad = 2. * x;
+        return dot(x, x);
+    };
+    arma::vec x = arma::linspace(0., 1., 1000);
+    arma::vec grad(x.n_elem);
+    disabled.wrap(quadratic)(x, grad);
+    check(nb_calls == 1 && disabled.totals().nb_measures == 0, "perf disabled wrap");
+
+    // Enabled recorders count measures; counters are NaN if the system provides none
+    PerfRecorder enabled(true);
+    auto wrapped = enabled.wrap(quadratic);
+    for(int k = 0; k < 10; k += 1) {
+        wrapped(x, grad);
+    }
+    const PerfCounts & totals = enabled.totals();
+    if(enabled.enabled()) {
+        check(totals.nb_measures == 10, "perf measures");
+        check(totals.cycles >= 0. && totals.seconds >= 0., "perf counts");
+    } else {
+        check(totals.nb_measures == 0 && totals.cycles != totals.cycles, "perf unavailable");
+    }
+    check(nb_calls == 11, "perf wrapped calls");
+
+    // Totals by model
+    const auto previous = perf_counts_by_model();
+    record_perf_counts("test", totals);
+    record_perf_counts("test", totals);
+    const auto by_model = perf_counts_by_model();
+    const auto it = by_model.find("test");
+    const int previous_measures = previous.count("test") > 0 ? previous.at("test").nb_measures : 0;
+    check(it != by_model.end() && it->second.nb_measures == previous_measures + 2 * totals.nb_measures,
+          "perf totals by model");
+    clear_perf_counts();
+    for(const auto & entry : previous) {
+        record_perf_counts(entry.first, entry.second);
+    }
+    return success;
+}
+
+#endif
@@ -0,0 +1,108 @@
+// Hardware performance counters around objective evaluations and kernels (configuration["perf_counters"] = TRUE).
+//
+// Counters are read with the Linux perf_event_open interface, for the user space of the thread that creates the
+// recorder: cycles, instructions, cache references and misses, branch misses, and a FLOP event if one is given in the
+// environment variable PLNMODELS_PERF_FLOPS_EVENT as a raw event code (e.g. "0x01c7" for
+// FP_ARITH_INST_RETIRED.SCALAR_DOUBLE on Intel since Skylake; the event and its meaning depend on the CPU).
+// Counts of events the CPU or the kernel do not provide are NaN (other systems, virtual machines without a PMU,
+// kernel.perf_event_paranoid > 2). Counts are scaled when the kernel multiplexes the counters.
+//
+// Calls made from other threads (multistart races, NUMA workers) are not measured: measures only cover the thread of
+// the fit.
+#pragma once
+
+#include "arma_backend.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlopt_wrapper.h"
+
+struct PerfCounts {
+    double cycles;
+    double instructions;
+    double cache_references;
+    double cache_misses;
+    double branch_misses;
+    double flops;
+    double seconds;   // Wall time of the measured regions
+    int nb_measures;  // Number of measured regions (evaluations, Hessian products, kernel calls)
+
+    static PerfCounts zero();
+    PerfCounts & operator+=(const PerfCounts & other);
+};
+
+// Group of counters of the calling thread, counting from construction
+class PerfCounterGroup {
+  public:
+    enum { NB_EVENTS = 6 }; // Counters in the order of the PerfCounts fields
+
+    PerfCounterGroup();
+    ~PerfCounterGroup();
+    PerfCounterGroup(const PerfCounterGroup &) = delete;
+    PerfCounterGroup & operator=(const PerfCounterGroup &) = delete;
+
+    bool available() const { return leader_ >= 0; }
+    // Current counter values (seconds and nb_measures are 0), NaN for unavailable events
+    PerfCounts read() const;
+
+  private:
+    int leader_;
+    int fds_[NB_EVENTS];
+    int positions_[NB_EVENTS]; // Position of each event in the group read, -1 if not opened
+};
+
+// Accumulated counts over the measured regions of one fit
+class PerfRecorder {
+  public:
+    using ObjectiveAndGrad = std::function<double(const arma::vec & parameters, arma::vec & gradients)>;
+
+    // Disabled recorders measure nothing and return wrapped closures unchanged.
+    // Enabled recorders fall back to disabled if no counter is available.
+    explicit PerfRecorder(bool enabled);
+
+    bool enabled() const { return group_ != nullptr; }
+    bool requested() const { return requested_; }
+
+    // Run f as one measured region
+    template <typename F> void measure(F && f) {
+        if(!enabled() || std::this_thread::get_id() != thread_) {
+            f();
+            return;
+        }
+        const PerfCounts before = group_->read();
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        add_difference(group_->read(), before, elapsed.count());
+    }
+
+    // Closures measuring each call (and each Hessian product), referencing this recorder.
+    // Empty closures are returned as is.
+    ObjectiveAndGrad wrap(ObjectiveAndGrad objective_and_grad_fn);
+    HessianAt wrap(HessianAt hessian_at);
+
+    const PerfCounts & totals() const { return totals_; }
+    // If counters were requested: totals as a single element, also added to the totals of 'model' (see
+    // perf_counts_by_model). Empty otherwise.
+    std::vector<PerfCounts> finish(const std::string & model) const;
+
+  private:
+    bool requested_;
+    std::unique_ptr<PerfCounterGroup> group_; // Null if disabled
+    std::thread::id thread_;
+    PerfCounts totals_;
+
+    void add_difference(const PerfCounts & after, const PerfCounts & before, double seconds);
+};
+
+// Totals by model type ("full", "rank", "vestep_diagonal", ...) over the fits of the session
+void record_perf_counts(const std::string & model, const PerfCounts & counts);
+std::map<std::string, PerfCounts> perf_counts_by_model();
+void clear_perf_counts();
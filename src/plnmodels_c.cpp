@@ -0,0 +1,639 @@
+#include "plnmodels_c.h"
+
+#include <cmath> // abs
+#include <exception>
+#include <memory> // unique_ptr
+#include <new>    // bad_alloc
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "data.h"
+#include "models.h"
+
+struct plnm_dataset {
+    CountMatrix Y;
+    arma::mat X;
+    Offsets<double> O;
+    arma::vec w;
+};
+
+struct plnm_options {
+    FitOptions options;
+};
+
+struct plnm_model {
+    plnm_covariance covariance;
+    ModelFit fit;
+    arma::mat fixed_Omega; // Omega given to the sparse model
+    arma::vec perf_counts; // (8) PerfCounts fields in order, empty if counters were not requested
+    arma::vec memory;      // (3) MemoryUsage fields in order
+};
+
+struct plnm_session {
+    plnm_covariance covariance;
+    arma::mat Theta;
+    arma::mat Omega;
+    FitOptions options;
+};
+
+// ---------------------------------------------------------------------------------------
+// Helpers
+
+static thread_local std::string last_error;
+
+// Run f, translating exceptions to status codes
+template <typename F> static plnm_status guarded(F f) {
+    try {
+        f();
+        return PLNM_OK;
+    } catch(const std::invalid_argument & e) {
+        last_error = e.what();
+        return PLNM_INVALID_ARGUMENT;
+    } catch(const std::bad_alloc &) {
+        last_error = "out of memory";
+        return PLNM_OUT_OF_MEMORY;
+    } catch(const std::exception & e) {
+        last_error = e.what();
+        return PLNM_RUNTIME_ERROR;
+    } catch(...) {
+        last_error = "unknown error";
+        return PLNM_RUNTIME_ERROR;
+    }
+}
+
+static void check_not_null(const void * pointer, const char * name) {
+    if(pointer == nullptr) {
+        throw std::invalid_argument(std::string(name) + ": must not be NULL");
+    }
+}
+
+template <typename Array> static void check_array(const Array & a, const char * name) {
+    if(a.n_rows < 0 || a.n_cols < 0 || a.row_stride <= 0 || a.col_stride <= 0) {
+        throw std::invalid_argument(std::string(name) + ": negative dimensions or non positive strides");
+    }
+    if(a.n_rows > 0 && a.n_cols > 0 && a.data == nullptr) {
+        throw std::invalid_argument(std::string(name) + ": NULL data");
+    }
+}
+
+template <typename Array> static bool is_column_major(const Array & a) {
+    return a.row_stride == 1 && (a.col_stride == a.n_rows || a.n_cols <= 1);
+}
+
+// Column-major array used in place, other layouts gathered into a new matrix
+static arma::mat matrix_from_array(const plnm_array & a, const char * name) {
+    check_array(a, name);
+    const auto n_rows = arma::uword(a.n_rows);
+    const auto n_cols = arma::uword(a.n_cols);
+    if(is_column_major(a)) {
+        return arma::mat(const_cast<double *>(a.data), n_rows, n_cols, false, true);
+    }
+    auto m = arma::mat(n_rows, n_cols);
+    for(arma::uword j = 0; j < n_cols; j += 1) {
+        for(arma::uword i = 0; i < n_rows; i += 1) {
+            m(i, j) = a.data[i * a.row_stride + j * a.col_stride];
+        }
+    }
+    return m;
+}
+
+static arma::vec vector_from_array(const plnm_array & a, const char * name) {
+    if(a.n_cols != 1) {
+        throw std::invalid_argument(std::string(name) + ": must be a (n,1) array");
+    }
+    check_array(a, name);
+    const auto n = arma::uword(a.n_rows);
+    if(a.row_stride == 1) {
+        return arma::vec(const_cast<double *>(a.data), n, false, true);
+    }
+    auto v = arma::vec(n);
+    for(arma::uword i = 0; i < n; i += 1) {
+        v[i] = a.data[i * a.row_stride];
+    }
+    return v;
+}
+
+static void write_to_buffer(const arma::mat & m, const plnm_buffer & output, const char * name) {
+    check_array(output, name);
+    if(arma::uword(output.n_rows) != m.n_rows || arma::uword(output.n_cols) != m.n_cols) {
+        throw std::invalid_argument(std::string(name) + ": output dimensions mismatch");
+    }
+    for(arma::uword j = 0; j < m.n_cols; j += 1) {
+        for(arma::uword i = 0; i < m.n_rows; i += 1) {
+            output.data[i * output.row_stride + j * output.col_stride] = m(i, j);
+        }
+    }
+}
+
+static ModelParameters parameters_from_c(const plnm_parameters * parameters) {
+    ModelParameters converted;
+    if(parameters != nullptr) {
+        if(parameters->Theta != nullptr) {
+            converted.Theta = matrix_from_array(*parameters->Theta, "Theta");
+        }
+        if(parameters->B != nullptr) {
+            converted.B = matrix_from_array(*parameters->B, "B");
+        }
+        if(parameters->M != nullptr) {
+            converted.M = matrix_from_array(*parameters->M, "M");
+        }
+        if(parameters->S != nullptr) {
+            converted.S = matrix_from_array(*parameters->S, "S");
+        }
+    }
+    return converted;
+}
+
+static const char * covariance_name(plnm_covariance covariance) {
+    switch(covariance) {
+    case PLNM_FULL:
+        return "full";
+    case PLNM_DIAGONAL:
+        return "diagonal";
+    case PLNM_SPHERICAL:
+        return "spherical";
+    case PLNM_RANK:
+        return "rank";
+    case PLNM_SPARSE:
+        return "sparse";
+    }
+    throw std::invalid_argument("unknown covariance model");
+}
+
+static const arma::mat & model_quantity(const plnm_model & model, const std::string & name) {
+    const ModelFit & fit = model.fit;
+    if(name == "Theta") {
+        return fit.Theta;
+    } else if(name == "B") {
+        return fit.B;
+    } else if(name == "M") {
+        return fit.M;
+    } else if(name == "S") {
+        return fit.S;
+    } else if(name == "Z") {
+        return fit.Z;
+    } else if(name == "A") {
+        return fit.A;
+    } else if(name == "Sigma") {
+        return fit.Sigma;
+    } else if(name == "Omega") {
+        return fit.Omega;
+    } else if(name == "loglik") {
+        return fit.loglik;
+    } else if(name == "perf_counters") {
+        return model.perf_counts;
+    } else if(name == "memory") {
+        return model.memory;
+    }
+    throw std::invalid_argument("unknown model quantity: " + name);
+}
+
+// ---------------------------------------------------------------------------------------
+// C interface
+
+extern "C" {
+
+int plnm_abi_version(void) {
+    return PLNM_ABI_VERSION;
+}
+
+const char * plnm_last_error(void) {
+    return last_error.c_str();
+}
+
+plnm_status plnm_dataset_create(
+    const plnm_array * Y, const plnm_array * X, const plnm_array * O, const plnm_array * w, plnm_dataset ** dataset) {
+    return guarded([&]() {
+        check_not_null(Y, "Y");
+        check_not_null(X, "X");
+        check_not_null(dataset, "dataset");
+        check_array(*Y, "Y");
+        if(X->n_rows != Y->n_rows) {
+            throw std::invalid_argument("X: dimension mismatch with Y");
+        }
+        const auto n = arma::uword(Y->n_rows);
+        const auto p = arma::uword(Y->n_cols);
+        std::unique_ptr<plnm_dataset> d(new plnm_dataset());
+        d->Y = CountMatrix::from_strided(Y->data, n, p, arma::uword(Y->row_stride), arma::uword(Y->col_stride));
+        d->X = matrix_from_array(*X, "X");
+        if(O == nullptr) {
+            d->O.rows = arma::vec(n, arma::fill::zeros);
+        } else if(O->n_cols == 1 && p != 1) {
+            d->O.rows = vector_from_array(*O, "O");
+        } else {
+            d->O.dense = matrix_from_array(*O, "O");
+        }
+        d->O.check_dimensions(n, p);
+        if(w == nullptr) {
+            d->w = arma::vec(n, arma::fill::ones);
+        } else {
+            d->w = vector_from_array(*w, "w");
+            if(d->w.n_elem != n) {
+                throw std::invalid_argument("w: dimension mismatch with Y");
+            }
+        }
+        *dataset = d.release();
+    });
+}
+
+void plnm_dataset_free(plnm_dataset * dataset) {
+    delete dataset;
+}
+
+plnm_status plnm_options_create(plnm_options ** options) {
+    return guarded([&]() {
+        check_not_null(options, "options");
+        *options = new plnm_options{FitOptions::defaults()};
+    });
+}
+
+plnm_status plnm_options_set_number(plnm_options * options, const char * name, double value) {
+    return guarded([&]() {
+        check_not_null(options, "options");
+        check_not_null(name, "name");
+        const std::string key = name;
+        FitOptions & o = options->options;
+        if(key == "xtol_abs") {
+            o.parameter_xtol_abs.value = value;
+        } else if(key == "xtol_rel") {
+            o.optimizer.xtol_rel = o.ve_newton.xtol_rel = o.lbfgs.xtol_rel = value;
+        } else if(key == "ftol_abs") {
+            o.optimizer.ftol_abs = value;
+        } else if(key == "ftol_rel") {
+            o.optimizer.ftol_rel = o.ve_newton.ftol_rel = o.lbfgs.ftol_rel = value;
+        } else if(key == "maxeval") {
+            o.optimizer.maxeval = o.ve_newton.maxiter = o.lbfgs.maxeval = int(value);
+        } else if(key == "maxtime") {
+            o.optimizer.maxtime = value;
+        } else if(key == "row_weight_threshold") {
+            o.row_weight_threshold = value;
+        } else if(key == "log_S") {
+            o.log_S = value != 0.;
+        } else if(key == "diagonal_scaling") {
+            o.optimizer.diagonal_scaling = value != 0.;
+        } else if(key == "scaling_refresh") {
+            o.optimizer.scaling_refresh = int(value);
+        } else if(key == "ve_block_size") {
+            if(!(value >= 1.)) {
+                throw std::invalid_argument("ve_block_size must be positive");
+            }
+            o.ve_newton.block_size = arma::uword(value);
+        } else if(key == "lbfgs_memory") {
+            o.lbfgs.memory = arma::uword(value);
+        } else if(key == "gtol_abs") {
+            o.lbfgs.gtol_abs = value;
+        } else if(key == "numa_workers") {
+            if(!(value >= 0.)) {
+                throw std::invalid_argument("numa_workers must be non negative");
+            }
+            o.numa.nb_workers = int(value);
+        } else if(key == "numa_pin") {
+            o.numa.pin = value != 0.;
+        } else if(key == "perf_counters") {
+            o.perf_counters = value != 0.;
+        } else {
+            throw std::invalid_argument("unknown numeric option: " + key);
+        }
+    });
+}
+
+plnm_status plnm_options_set_string(plnm_options * options, const char * name, const char * value) {
+    return guarded([&]() {
+        check_not_null(options, "options");
+        check_not_null(name, "name");
+        check_not_null(value, "value");
+        const std::string key = name;
+        FitOptions & o = options->options;
+        if(key == "algorithm") {
+            const OptimizerEngine engine = engine_from_name(value);
+            o.optimizer.algorithm = engine == OptimizerEngine::Nlopt ? algorithm_from_name(value) : NLOPT_LD_LBFGS;
+            o.optimizer.engine = engine;
+        } else if(key == "precision") {
+            o.precision = precision_from_name(value);
+        } else if(key == "ve_engine") {
+            o.ve_engine = ve_engine_from_name(value);
+        } else {
+            throw std::invalid_argument("unknown string option: " + key);
+        }
+    });
+}
+
+void plnm_options_free(plnm_options * options) {
+    delete options;
+}
+
+plnm_status plnm_fit(
+    const plnm_dataset * dataset,
+    plnm_covariance covariance,
+    const plnm_parameters * init,
+    const plnm_array * Omega,
+    const plnm_options * options,
+    plnm_model ** model) {
+    return guarded([&]() {
+        check_not_null(dataset, "dataset");
+        check_not_null(init, "init");
+        check_not_null(model, "model");
+        FitOptions fit_options = options != nullptr ? options->options : FitOptions::defaults();
+        fit_options.optimizer.shape_key = covariance_name(covariance);
+        const ModelParameters init_parameters = parameters_from_c(init);
+        const plnm_dataset & d = *dataset;
+
+        std::unique_ptr<plnm_model> m(new plnm_model());
+        m->covariance = covariance;
+        switch(covariance) {
+        case PLNM_FULL:
+            m->fit = optimize_full(init_parameters, d.Y, d.X, d.O, d.w, fit_options);
+            break;
+        case PLNM_DIAGONAL:
+            m->fit = optimize_diagonal(init_parameters, d.Y, d.X, d.O, d.w, fit_options);
+            break;
+        case PLNM_SPHERICAL:
+            m->fit = optimize_spherical(init_parameters, d.Y, d.X, d.O, d.w, fit_options);
+            break;
+        case PLNM_RANK:
+            m->fit = optimize_rank(init_parameters, std::vector<ModelParameters>(), d.Y, d.X, d.O, d.w, fit_options);
+            break;
+        case PLNM_SPARSE: {
+            check_not_null(Omega, "Omega");
+            const arma::mat fixed_Omega = matrix_from_array(*Omega, "Omega");
+            m->fit = optimize_sparse(init_parameters, d.Y, d.X, d.O, d.w, fixed_Omega, fit_options);
+            m->fixed_Omega = fixed_Omega; // Copy: the caller array is only borrowed during the call
+        } break;
+        default:
+            throw std::invalid_argument("unknown covariance model");
+        }
+        if(!m->fit.perf_counts.empty()) {
+            const PerfCounts & c = m->fit.perf_counts.front();
+            m->perf_counts = arma::vec{
+                c.cycles,
+                c.instructions,
+                c.cache_references,
+                c.cache_misses,
+                c.branch_misses,
+                c.flops,
+                c.seconds,
+                double(c.nb_measures)};
+        }
+        const MemoryUsage & usage = m->fit.memory;
+        m->memory = arma::vec{usage.peak_bytes, usage.allocated_bytes, usage.nb_allocations};
+        *model = m.release();
+    });
+}
+
+void plnm_model_free(plnm_model * model) {
+    delete model;
+}
+
+plnm_status plnm_model_result(const plnm_model * model, int * status, double * objective, int * nb_iterations) {
+    return guarded([&]() {
+        check_not_null(model, "model");
+        const OptimizerResult & result = model->fit.result;
+        if(status != nullptr) {
+            *status = static_cast<int>(result.status);
+        }
+        if(objective != nullptr) {
+            *objective = result.objective;
+        }
+        if(nb_iterations != nullptr) {
+            *nb_iterations = result.nb_iterations;
+        }
+    });
+}
+
+plnm_status plnm_estimate_memory(
+    int64_t n, int64_t p, int64_t d, int64_t q, plnm_covariance covariance, plnm_memory_estimate * estimate) {
+    return guarded([&]() {
+        check_not_null(estimate, "estimate");
+        if(n < 0 || p < 0 || d < 0 || q < 0) {
+            throw std::invalid_argument("dimensions must be non negative");
+        }
+        const std::string model = covariance_name(covariance);
+        const MemoryEstimate e =
+            estimate_fit_memory(arma::uword(n), arma::uword(p), arma::uword(d), arma::uword(q), model);
+        *estimate = plnm_memory_estimate{e.inputs, e.engine, e.optimizer, e.outputs, e.total};
+    });
+}
+
+plnm_status plnm_model_dimensions(const plnm_model * model, const char * name, int64_t * n_rows, int64_t * n_cols) {
+    return guarded([&]() {
+        check_not_null(model, "model");
+        check_not_null(name, "name");
+        const arma::mat & quantity = model_quantity(*model, name);
+        if(n_rows != nullptr) {
+            *n_rows = int64_t(quantity.n_rows);
+        }
+        if(n_cols != nullptr) {
+            *n_cols = int64_t(quantity.n_cols);
+        }
+    });
+}
+
+plnm_status plnm_model_copy(const plnm_model * model, const char * name, const plnm_buffer * output) {
+    return guarded([&]() {
+        check_not_null(model, "model");
+        check_not_null(name, "name");
+        check_not_null(output, "output");
+        write_to_buffer(model_quantity(*model, name), *output, name);
+    });
+}
+
+plnm_status plnm_session_create(const plnm_model * model, const plnm_options * options, plnm_session ** session) {
+    return guarded([&]() {
+        check_not_null(model, "model");
+        check_not_null(session, "session");
+        std::unique_ptr<plnm_session> s(new plnm_session());
+        s->covariance = model->covariance;
+        s->Theta = model->fit.Theta;
+        s->options = options != nullptr ? options->options : FitOptions::defaults();
+        s->options.optimizer.shape_key = std::string(covariance_name(model->covariance)) + "_vestep";
+        switch(model->covariance) {
+        case PLNM_FULL:
+        case PLNM_DIAGONAL:
+        case PLNM_SPHERICAL:
+            s->Omega = model->fit.Omega;
+            break;
+        case PLNM_SPARSE:
+            s->covariance = PLNM_FULL;
+            s->Omega = model->fixed_Omega;
+            break;
+        default:
+            throw std::invalid_argument("scoring sessions require a full, diagonal, spherical or sparse model");
+        }
+        *session = s.release();
+    });
+}
+
+void plnm_session_free(plnm_session * session) {
+    delete session;
+}
+
+plnm_status plnm_session_score(
+    const plnm_session * session,
+    const plnm_dataset * dataset,
+    const plnm_parameters * init,
+    const plnm_buffer * M,
+    const plnm_buffer * S,
+    const plnm_buffer * loglik,
+    double * objective) {
+    return guarded([&]() {
+        check_not_null(session, "session");
+        check_not_null(dataset, "dataset");
+        const plnm_session & s = *session;
+        const plnm_dataset & d = *dataset;
+        const arma::uword n = d.Y.n_rows;
+        const arma::uword p = d.Y.n_cols;
+        const arma::uword S_cols = s.covariance == PLNM_SPHERICAL ? 1 : p;
+
+        ModelParameters init_parameters = parameters_from_c(init);
+        if(init_parameters.M.n_elem == 0) {
+            init_parameters.M = arma::mat(n, p, arma::fill::zeros);
+        }
+        if(init_parameters.S.n_elem == 0) {
+            init_parameters.S = arma::mat(n, S_cols, arma::fill::ones);
+        }
+
+        ModelFit fit;
+        switch(s.covariance) {
+        case PLNM_FULL:
+            fit = optimize_vestep_full(init_parameters, d.Y, d.X, d.O, d.w, s.Theta, s.Omega, s.options);
+            break;
+        case PLNM_DIAGONAL:
+            fit = optimize_vestep_diagonal(init_parameters, d.Y, d.X, d.O, d.w, s.Theta, s.Omega, s.options);
+            break;
+        default:
+            fit = optimize_vestep_spherical(init_parameters, d.Y, d.X, d.O, d.w, s.Theta, s.Omega, s.options);
+            break;
+        }
+        if(M != nullptr) {
+            write_to_buffer(fit.M, *M, "M");
+        }
+        if(S != nullptr) {
+            write_to_buffer(fit.S, *S, "S");
+        }
+        if(loglik != nullptr) {
+            write_to_buffer(fit.loglik, *loglik, "loglik");
+        }
+        if(objective != nullptr) {
+            *objective = fit.result.objective;
+        }
+    });
+}
+
+} // extern "C"
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_c_api() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    const arma::uword n = 30;
+    const arma::uword p = 3;
+    arma::mat Y(n, p);
+    arma::mat X(n, 2);
+    for(arma::uword i = 0; i < n; i += 1) {
+        for(arma::uword j = 0; j < p; j += 1) {
+            Y(i, j) = double((i * 7 + j * 3) % 5 + j);
+        }
+        X(i, 0) = 1.;
+        X(i, 1) = double(i % 4) / 4.;
+    }
+    // Same data in row-major order
+    const arma::mat Y_t = Y.t();
+    const arma::mat X_t = X.t();
+
+    const plnm_array Y_c = plnm_column_major(Y.memptr(), n, p);
+    const plnm_array X_c = plnm_column_major(X.memptr(), n, 2);
+    const plnm_array Y_r = plnm_row_major(Y_t.memptr(), n, p);
+    const plnm_array X_r = plnm_row_major(X_t.memptr(), n, 2);
+
+    plnm_dataset * by_columns = nullptr;
+    plnm_dataset * by_rows = nullptr;
+    check(plnm_dataset_create(&Y_c, &X_c, nullptr, nullptr, &by_columns) == PLNM_OK, "c api dataset (columns)");
+    check(plnm_dataset_create(&Y_r, &X_r, nullptr, nullptr, &by_rows) == PLNM_OK, "c api dataset (rows)");
+    if(by_columns == nullptr || by_rows == nullptr) {
+        return false;
+    }
+    check(by_columns->X.memptr() == X.memptr(), "c api column-major X used in place");
+    check(arma::approx_equal(by_rows->X, X, "absdiff", 0.), "c api row-major X");
+    check(arma::approx_equal(by_rows->Y.to_mat(), Y, "absdiff", 0.), "c api row-major Y");
+
+    // Invalid dimensions are reported with a message
+    const plnm_array X_short = plnm_column_major(X.memptr(), n - 1, 2);
+    plnm_dataset * invalid = nullptr;
+    check(plnm_dataset_create(&Y_c, &X_short, nullptr, nullptr, &invalid) == PLNM_INVALID_ARGUMENT,
+          "c api invalid dimensions");
+    check(invalid == nullptr && std::string(plnm_last_error()).size() > 0, "c api error message");
+
+    plnm_options * options = nullptr;
+    check(plnm_options_create(&options) == PLNM_OK, "c api options");
+    check(plnm_options_set_string(options, "algorithm", "LBFGS") == PLNM_OK, "c api algorithm option");
+    check(plnm_options_set_number(options, "maxeval", 500.) == PLNM_OK, "c api maxeval option");
+    check(plnm_options_set_number(options, "unknown", 1.) == PLNM_INVALID_ARGUMENT, "c api unknown option");
+
+    const arma::mat Theta0(p, 2, arma::fill::zeros);
+    const arma::mat M0(n, p, arma::fill::zeros);
+    const arma::mat S0 = 0.5 * arma::ones<arma::mat>(n, p);
+    const plnm_array Theta0_c = plnm_column_major(Theta0.memptr(), p, 2);
+    const plnm_array M0_c = plnm_column_major(M0.memptr(), n, p);
+    const plnm_array S0_c = plnm_column_major(S0.memptr(), n, p);
+    const plnm_parameters init = {&Theta0_c, nullptr, &M0_c, &S0_c};
+
+    plnm_model * fit_columns = nullptr;
+    plnm_model * fit_rows = nullptr;
+    check(plnm_fit(by_columns, PLNM_DIAGONAL, &init, nullptr, options, &fit_columns) == PLNM_OK, "c api fit");
+    check(plnm_fit(by_rows, PLNM_DIAGONAL, &init, nullptr, options, &fit_rows) == PLNM_OK, "c api fit (rows)");
+    if(fit_columns != nullptr && fit_rows != nullptr) {
+        double objective_columns = 0.;
+        double objective_rows = 0.;
+        plnm_model_result(fit_columns, nullptr, &objective_columns, nullptr);
+        plnm_model_result(fit_rows, nullptr, &objective_rows, nullptr);
+        check(objective_columns == objective_rows, "c api fit independent of layout");
+
+        // Theta written into a row-major caller buffer
+        int64_t rows = 0;
+        int64_t cols = 0;
+        check(plnm_model_dimensions(fit_columns, "Theta", &rows, &cols) == PLNM_OK, "c api dimensions");
+        check(rows == int64_t(p) && cols == 2, "c api Theta dimensions");
+        arma::mat Theta_t(2, p);
+        const plnm_buffer Theta_out = plnm_row_major_buffer(Theta_t.memptr(), p, 2);
+        check(plnm_model_copy(fit_columns, "Theta", &Theta_out) == PLNM_OK, "c api copy");
+        check(arma::approx_equal(Theta_t.t(), fit_columns->fit.Theta, "absdiff", 0.), "c api row-major output");
+
+        // Memory of the fit, and a priori estimate
+        check(plnm_model_dimensions(fit_columns, "memory", &rows, &cols) == PLNM_OK && rows == 3 && cols == 1,
+              "c api memory dimensions");
+        plnm_memory_estimate estimate;
+        check(plnm_estimate_memory(n, p, 2, 0, PLNM_FULL, &estimate) == PLNM_OK, "c api memory estimate");
+        check(estimate.engine > 0. && estimate.total > estimate.engine, "c api memory estimate values");
+
+        // Scoring the training samples from the fitted variational parameters changes little
+        plnm_session * session = nullptr;
+        check(plnm_session_create(fit_columns, options, &session) == PLNM_OK, "c api session");
+        arma::vec loglik(n);
+        const plnm_buffer loglik_out = plnm_column_major_buffer(loglik.memptr(), n, 1);
+        check(plnm_session_score(session, by_rows, nullptr, nullptr, nullptr, &loglik_out, nullptr) == PLNM_OK,
+              "c api score");
+        check(loglik.is_finite(), "c api score finite");
+        check(std::abs(arma::accu(loglik) - arma::accu(fit_columns->fit.loglik)) <
+                  5e-2 * std::abs(arma::accu(fit_columns->fit.loglik)),
+              "c api score matches fit");
+        plnm_session_free(session);
+    }
+    plnm_model_free(fit_columns);
+    plnm_model_free(fit_rows);
+    plnm_options_free(options);
+    plnm_dataset_free(by_columns);
+    plnm_dataset_free(by_rows);
+    return success;
+}
+
+#endif
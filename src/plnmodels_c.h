@@ -0,0 +1,184 @@
+/* C interface of the numerical core (see models.h), for other runtimes (Python, Go, ...) through their C FFI.
+ *
+ * Objects are opaque handles created and freed by the library. Arrays are owned by the caller and described by a
+ * pointer, a shape and strides in elements: element (i,j) is data[i * row_stride + j * col_stride], so column-major
+ * (row_stride = 1, col_stride = n_rows, as in R, Fortran or numpy order='F') and row-major (row_stride = n_cols,
+ * col_stride = 1, numpy order='C', Go slices) arrays are both accepted without conversion by the caller.
+ *
+ * Inputs are not copied when the core can use them in place:
+ * - column-major X, O, w and Omega are used in place by datasets and fits, so they must stay alive and unchanged as
+ *   long as the dataset (or the fit call) that references them;
+ * - Y is read once into the compact count storage of the core (see CountMatrix), whatever its layout;
+ * - other layouts of X, O, w and Omega are gathered once into column-major storage owned by the dataset.
+ * Outputs are written directly into caller buffers with their own strides.
+ *
+ * Functions return PLNM_OK or an error status, with the error message available from plnm_last_error() in the same
+ * thread. Handles are read-only after creation and may be shared between threads; freeing NULL is a no-op.
+ */
+#ifndef PLNMODELS_C_H
+#define PLNMODELS_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremented on incompatible changes of this interface */
+#define PLNM_ABI_VERSION 1
+
+typedef enum {
+    PLNM_OK = 0,
+    PLNM_INVALID_ARGUMENT = 1, /* wrong dimensions, unknown names or values */
+    PLNM_RUNTIME_ERROR = 2,    /* optimizer failures */
+    PLNM_OUT_OF_MEMORY = 3
+} plnm_status;
+
+typedef enum {
+    PLNM_FULL = 0,
+    PLNM_DIAGONAL = 1,
+    PLNM_SPHERICAL = 2,
+    PLNM_RANK = 3,
+    PLNM_SPARSE = 4
+} plnm_covariance;
+
+/* Input array (n_rows, n_cols); vectors are (n, 1) arrays */
+typedef struct {
+    const double * data;
+    int64_t n_rows;
+    int64_t n_cols;
+    int64_t row_stride;
+    int64_t col_stride;
+} plnm_array;
+
+/* Output buffer (n_rows, n_cols), with dimensions matching the written quantity */
+typedef struct {
+    double * data;
+    int64_t n_rows;
+    int64_t n_cols;
+    int64_t row_stride;
+    int64_t col_stride;
+} plnm_buffer;
+
+static inline plnm_array plnm_column_major(const double * data, int64_t n_rows, int64_t n_cols) {
+    plnm_array a = {data, n_rows, n_cols, 1, n_rows};
+    return a;
+}
+static inline plnm_array plnm_row_major(const double * data, int64_t n_rows, int64_t n_cols) {
+    plnm_array a = {data, n_rows, n_cols, n_cols, 1};
+    return a;
+}
+static inline plnm_buffer plnm_column_major_buffer(double * data, int64_t n_rows, int64_t n_cols) {
+    plnm_buffer b = {data, n_rows, n_cols, 1, n_rows};
+    return b;
+}
+static inline plnm_buffer plnm_row_major_buffer(double * data, int64_t n_rows, int64_t n_cols) {
+    plnm_buffer b = {data, n_rows, n_cols, n_cols, 1};
+    return b;
+}
+
+/* Parameters, NULL if absent. With n samples, p species, d covariates and q the rank:
+ * Theta (p,d), B (p,q), M (n,p) or (n,q), S (n,p) or (n,q), or (n,1) for the spherical model. */
+typedef struct {
+    const plnm_array * Theta;
+    const plnm_array * B;
+    const plnm_array * M;
+    const plnm_array * S;
+} plnm_parameters;
+
+typedef struct plnm_dataset plnm_dataset;
+typedef struct plnm_options plnm_options;
+typedef struct plnm_model plnm_model;
+typedef struct plnm_session plnm_session;
+
+int plnm_abi_version(void);
+
+/* Message of the last error returned in the calling thread, empty string if none */
+const char * plnm_last_error(void);
+
+/* ---------------------------------------------------------------------------------------
+ * Datasets: responses Y (n,p), covariates X (n,d), offsets O (n,p), or (n,1) row offsets, or NULL for zero offsets,
+ * sample weights w (n,1), or NULL for unit weights.
+ */
+plnm_status plnm_dataset_create(
+    const plnm_array * Y, const plnm_array * X, const plnm_array * O, const plnm_array * w, plnm_dataset ** dataset);
+void plnm_dataset_free(plnm_dataset * dataset);
+
+/* ---------------------------------------------------------------------------------------
+ * Options, with the names and defaults of the R control lists (see PLN_param() and the other *_param functions).
+ * Numbers: xtol_abs, xtol_rel, ftol_abs, ftol_rel, maxeval, maxtime, row_weight_threshold, log_S, diagonal_scaling,
+ *   scaling_refresh, ve_block_size, lbfgs_memory, gtol_abs, numa_workers, numa_pin, perf_counters (booleans are 0
+ *   or 1).
+ * Strings: algorithm, precision ("double" or "float"), ve_engine ("nlopt", "batched_newton" or "coordinate_ascent").
+ */
+plnm_status plnm_options_create(plnm_options ** options);
+plnm_status plnm_options_set_number(plnm_options * options, const char * name, double value);
+plnm_status plnm_options_set_string(plnm_options * options, const char * name, const char * value);
+void plnm_options_free(plnm_options * options);
+
+/* ---------------------------------------------------------------------------------------
+ * Fits, from initial parameters: Theta, M and S, plus B for the rank model.
+ * The sparse model takes its fixed precision Omega (p,p), NULL for the other models.
+ * options may be NULL for the defaults.
+ */
+plnm_status plnm_fit(
+    const plnm_dataset * dataset,
+    plnm_covariance covariance,
+    const plnm_parameters * init,
+    const plnm_array * Omega,
+    const plnm_options * options,
+    plnm_model ** model);
+void plnm_model_free(plnm_model * model);
+
+/* Outcome of the optimizer: nlopt status code, final objective and number of iterations (pointers may be NULL) */
+plnm_status plnm_model_result(const plnm_model * model, int * status, double * objective, int * nb_iterations);
+
+/* Fitted quantities by name: Theta, B, M, S, Z, A, Sigma, Omega, loglik (n,1), memory (3,1): peak bytes, allocated
+ * bytes and number of allocations of the core during the fit, and perf_counters (8,1) with option perf_counters:
+ * cycles, instructions, cache references, cache misses, branch misses, FLOPs (NaN if not available), seconds and
+ * number of measured regions.
+ * Dimensions are (0,0) for quantities not computed by the model. */
+plnm_status plnm_model_dimensions(const plnm_model * model, const char * name, int64_t * n_rows, int64_t * n_cols);
+plnm_status plnm_model_copy(const plnm_model * model, const char * name, const plnm_buffer * output);
+
+/* ---------------------------------------------------------------------------------------
+ * A priori memory of a fit in bytes, for n samples, p species, d covariates and rank q (rank model only): data held
+ * by the caller, peak of the core (the peak bytes of the "memory" quantity), nlopt working vectors and outputs.
+ */
+typedef struct {
+    double inputs;
+    double engine;
+    double optimizer;
+    double outputs;
+    double total;
+} plnm_memory_estimate;
+
+plnm_status plnm_estimate_memory(
+    int64_t n, int64_t p, int64_t d, int64_t q, plnm_covariance covariance, plnm_memory_estimate * estimate);
+
+/* ---------------------------------------------------------------------------------------
+ * Scoring sessions: VE steps on new samples for fixed Theta and Omega of a full, diagonal, spherical or sparse model
+ * (the sparse model is scored as a full model with its fixed Omega). The session copies what it needs from the model,
+ * which may be freed afterwards.
+ */
+plnm_status plnm_session_create(const plnm_model * model, const plnm_options * options, plnm_session ** session);
+void plnm_session_free(plnm_session * session);
+
+/* Variational parameters M, S and element-wise log-likelihood (n,1) of the samples of dataset.
+ * init gives the initial M and S (NULL, or NULL members: M = 0 and S = 1). Outputs may be NULL.
+ * objective may be NULL. */
+plnm_status plnm_session_score(
+    const plnm_session * session,
+    const plnm_dataset * dataset,
+    const plnm_parameters * init,
+    const plnm_buffer * M,
+    const plnm_buffer * S,
+    const plnm_buffer * loglik,
+    double * objective);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+// Mixed precision evaluation helpers.
+//
+// In single precision mode, data and variational parameters are converted to float (arma::fmat) for the element-wise
+// parts of objectives and gradients, which are memory bandwidth bound.
+// Reductions (objective value, sums over samples for Theta and covariance parameters) are accumulated in double,
+// so that the precision loss stays at the level of the individual float values.
+// The packed parameter vector seen by the optimizer is always in double.
+#pragma once
+
+#include "arma_backend.h"
+#include <cmath>  // abs
+#include <stdexcept>
+#include <string>
+
+// Floating point type used for evaluation of objective and gradients.
+enum class Precision { Double, Single };
+
+// From its name in configuration["precision"]: "double" or "float"
+inline Precision precision_from_name(const std::string & name) {
+    if(name == "double") {
+        return Precision::Double;
+    } else if(name == "float") {
+        return Precision::Single;
+    } else {
+        throw std::invalid_argument("unsupported config[precision]: must be \"double\" or \"float\"");
+    }
+}
+
+// Neumaier compensated summation, for sums of many values with different magnitudes.
+struct CompensatedSum {
+    double sum = 0.;
+    double compensation = 0.;
+
+    void add(double value) {
+        double t = sum + value;
+        if(std::abs(sum) >= std::abs(value)) {
+            compensation += (sum - t) + value;
+        } else {
+            compensation += (value - t) + sum;
+        }
+        sum = t;
+    }
+    double value() const { return sum + compensation; }
+};
+
+// sum_{i,j} w_i x_{i,j}, accumulated in double.
+// Column sums are plain double sums (vectorizable), combined across columns with compensation.
+template <typename eT> double weighted_accu(const arma::vec & w, const arma::Mat<eT> & x) {
+    CompensatedSum total;
+    for(arma::uword j = 0; j < x.n_cols; j += 1) {
+        const eT * column = x.colptr(j);
+        double column_sum = 0.;
+        for(arma::uword i = 0; i < x.n_rows; i += 1) {
+            column_sum += w[i] * double(column[i]);
+        }
+        total.add(column_sum);
+    }
+    return total.value();
+}
+
+// w' x as a double row vector (weighted column sums).
+template <typename eT> arma::rowvec weighted_colsums(const arma::vec & w, const arma::Mat<eT> & x) {
+    auto sums = arma::rowvec(x.n_cols);
+    for(arma::uword j = 0; j < x.n_cols; j += 1) {
+        const eT * column = x.colptr(j);
+        double column_sum = 0.;
+        for(arma::uword i = 0; i < x.n_rows; i += 1) {
+            column_sum += w[i] * double(column[i]);
+        }
+        sums[j] = column_sum;
+    }
+    return sums;
+}
+
+// sum(x, 1) as a double column vector (row sums).
+template <typename eT> arma::vec rowsums_double(const arma::Mat<eT> & x) {
+    auto sums = arma::vec(x.n_rows, arma::fill::zeros);
+    for(arma::uword j = 0; j < x.n_cols; j += 1) {
+        const eT * column = x.colptr(j);
+        for(arma::uword i = 0; i < x.n_rows; i += 1) {
+            sums[i] += double(column[i]);
+        }
+    }
+    return sums;
+}
+
+// x' y accumulated in double, for x (n,p1) and y (n,p2) with possibly different element types.
+// Used for reductions over samples: Theta gradient (A - Y)' (w X), rank model loadings gradient.
+template <typename eT1, typename eT2> arma::mat crossprod_double(const arma::Mat<eT1> & x, const arma::Mat<eT2> & y) {
+    if(x.n_rows != y.n_rows) {
+        throw std::invalid_argument("crossprod_double: row count mismatch");
+    }
+    auto product = arma::mat(x.n_cols, y.n_cols);
+    for(arma::uword k = 0; k < y.n_cols; k += 1) {
+        const eT2 * y_column = y.colptr(k);
+        for(arma::uword j = 0; j < x.n_cols; j += 1) {
+            const eT1 * x_column = x.colptr(j);
+            double sum = 0.;
+            for(arma::uword i = 0; i < x.n_rows; i += 1) {
+                sum += double(x_column[i]) * double(y_column[i]);
+            }
+            product(j, k) = sum;
+        }
+    }
+    return product;
+}
@@ -0,0 +1,233 @@
+#include "r_adapter.h"
+
+#include <stdexcept>
+#include <string>
+
+// Set value from list[name] if present
+template <typename T> static void read_optional(const Rcpp::List & list, const char * name, T & value) {
+    if(list.containsElementNamed(name)) {
+        value = Rcpp::as<T>(list[name]);
+    }
+}
+
+// Matrix, or column matrix from a vector (S of the spherical model)
+static arma::mat matrix_from_r(SEXP r_value) {
+    if(TYPEOF(r_value) == REALSXP) {
+        // Alias R memory, R keeps the object alive for the duration of the call
+        const bool is_matrix = Rf_isMatrix(r_value);
+        const auto n_rows = arma::uword(is_matrix ? Rf_nrows(r_value) : Rf_xlength(r_value));
+        const auto n_cols = arma::uword(is_matrix ? Rf_ncols(r_value) : 1);
+        return arma::mat(REAL(r_value), n_rows, n_cols, false, true);
+    }
+    if(Rf_isMatrix(r_value)) {
+        return Rcpp::as<arma::mat>(r_value);
+    }
+    return arma::mat(Rcpp::as<arma::vec>(r_value));
+}
+
+CountMatrix count_matrix_from_r(SEXP r_value) {
+    if(!Rf_isMatrix(r_value)) {
+        throw std::invalid_argument("responses must be a matrix");
+    }
+    if(TYPEOF(r_value) == INTSXP) {
+        Rcpp::IntegerMatrix m(r_value);
+        return CountMatrix::from_values(m.begin(), m.nrow(), m.ncol());
+    } else {
+        Rcpp::NumericMatrix m(r_value);
+        return CountMatrix::from_values(m.begin(), m.nrow(), m.ncol());
+    }
+}
+
+Offsets<double> offsets_from_r(SEXP r_value, arma::uword n, arma::uword p) {
+    Offsets<double> o;
+    if(Rf_isNewList(r_value)) {
+        const auto list = Rcpp::List(r_value);
+        if(!list.containsElementNamed("row")) {
+            throw std::invalid_argument("offsets: structured offsets must contain a row element");
+        }
+        o.rows = Rcpp::as<arma::vec>(list["row"]);
+        if(list.containsElementNamed("col") && !Rf_isNull(list["col"])) {
+            o.cols = Rcpp::as<arma::rowvec>(list["col"]);
+        }
+    } else if(Rf_isMatrix(r_value)) {
+        if(TYPEOF(r_value) == REALSXP) {
+            // Alias R memory, R keeps the object alive for the duration of the call
+            o.dense = arma::mat(REAL(r_value), Rf_nrows(r_value), Rf_ncols(r_value), false, true);
+        } else {
+            o.dense = Rcpp::as<arma::mat>(r_value);
+        }
+    } else {
+        o.rows = Rcpp::as<arma::vec>(r_value);
+    }
+    o.check_dimensions(n, p);
+    return o;
+}
+
+FitOptions fit_options_from_r(const Rcpp::List & list) {
+    FitOptions options = FitOptions::defaults();
+
+    OptimizerConfiguration & optimizer = options.optimizer;
+    const auto name = Rcpp::as<std::string>(list["algorithm"]);
+    optimizer.engine = engine_from_name(name);
+    optimizer.algorithm = optimizer.engine == OptimizerEngine::Nlopt ? algorithm_from_name(name) : NLOPT_LD_LBFGS;
+    optimizer.xtol_rel = Rcpp::as<double>(list["xtol_rel"]);
+    optimizer.ftol_abs = Rcpp::as<double>(list["ftol_abs"]);
+    optimizer.ftol_rel = Rcpp::as<double>(list["ftol_rel"]);
+    optimizer.maxeval = Rcpp::as<int>(list["maxeval"]);
+    optimizer.maxtime = Rcpp::as<double>(list["maxtime"]);
+    read_optional(list, "diagonal_scaling", optimizer.diagonal_scaling);
+    read_optional(list, "scaling_refresh", optimizer.scaling_refresh);
+    read_optional(list, "auto_probe_maxeval", optimizer.auto_probe_maxeval);
+    read_optional(list, "auto_probe_maxtime", optimizer.auto_probe_maxtime);
+    read_optional(list, "covariance", optimizer.shape_key);
+
+    // xtol_abs: single value, or list of by-parameter values
+    SEXP xtol_abs = list["xtol_abs"];
+    if(Rcpp::is<double>(xtol_abs)) {
+        options.parameter_xtol_abs.value = Rcpp::as<double>(xtol_abs);
+    } else if(Rcpp::is<Rcpp::List>(xtol_abs)) {
+        const auto by_parameter = Rcpp::List(xtol_abs);
+        const Rcpp::CharacterVector names = by_parameter.names();
+        for(R_xlen_t i = 0; i < by_parameter.size(); i += 1) {
+            options.parameter_xtol_abs.by_parameter[Rcpp::as<std::string>(names[i])] =
+                Rcpp::as<arma::vec>(by_parameter[i]);
+        }
+    } else {
+        throw std::invalid_argument("unsupported config[xtol_abs] type: must be double or list of by-parameter values");
+    }
+
+    read_optional(list, "row_weight_threshold", options.row_weight_threshold);
+    if(list.containsElementNamed("precision")) {
+        options.precision = precision_from_name(Rcpp::as<std::string>(list["precision"]));
+    }
+    read_optional(list, "log_S", options.log_S);
+
+    if(list.containsElementNamed("ve_engine")) {
+        options.ve_engine = ve_engine_from_name(Rcpp::as<std::string>(list["ve_engine"]));
+    }
+    options.ve_newton.ftol_rel = optimizer.ftol_rel;
+    options.ve_newton.xtol_rel = optimizer.xtol_rel;
+    options.ve_newton.maxiter = optimizer.maxeval;
+    if(list.containsElementNamed("ve_block_size")) {
+        const int block_size = Rcpp::as<int>(list["ve_block_size"]);
+        if(block_size <= 0) {
+            throw std::invalid_argument("config[ve_block_size] must be positive");
+        }
+        options.ve_newton.block_size = arma::uword(block_size);
+    }
+
+    if(list.containsElementNamed("lbfgs_memory")) {
+        options.lbfgs.memory = arma::uword(Rcpp::as<int>(list["lbfgs_memory"]));
+    }
+    options.lbfgs.xtol_rel = optimizer.xtol_rel;
+    options.lbfgs.ftol_rel = optimizer.ftol_rel;
+    read_optional(list, "gtol_abs", options.lbfgs.gtol_abs);
+    options.lbfgs.maxeval = optimizer.maxeval;
+
+    read_optional(list, "multistart_round", options.multistart.round_evaluations);
+    read_optional(list, "multistart_threads", options.multistart.nb_threads);
+    if(options.multistart.round_evaluations <= 0 || options.multistart.nb_threads <= 0) {
+        throw std::invalid_argument("config[multistart_round] and config[multistart_threads] must be positive");
+    }
+
+    read_optional(list, "numa_workers", options.numa.nb_workers);
+    read_optional(list, "numa_pin", options.numa.pin);
+    if(options.numa.nb_workers < 0) {
+        throw std::invalid_argument("config[numa_workers] must be non negative");
+    }
+
+    read_optional(list, "perf_counters", options.perf_counters);
+    return options;
+}
+
+ModelParameters model_parameters_from_r(const Rcpp::List & list) {
+    ModelParameters parameters;
+    if(list.containsElementNamed("Theta")) {
+        parameters.Theta = matrix_from_r(list["Theta"]);
+    }
+    if(list.containsElementNamed("B")) {
+        parameters.B = matrix_from_r(list["B"]);
+    }
+    if(list.containsElementNamed("M")) {
+        parameters.M = matrix_from_r(list["M"]);
+    }
+    if(list.containsElementNamed("S")) {
+        parameters.S = matrix_from_r(list["S"]);
+    }
+    return parameters;
+}
+
+// (n_rows, n_cols) matrix using the memory of m (no copy)
+static arma::mat alias_of(Rcpp::NumericMatrix & m) {
+    return arma::mat(m.begin(), arma::uword(m.nrow()), arma::uword(m.ncol()), false, true);
+}
+
+RFitOutputs::RFitOutputs(const ModelParameters & init)
+    : M_(int(init.M.n_rows), int(init.M.n_cols)),
+      S_(int(init.S.n_rows), int(init.S.n_cols)),
+      storage_{arma::mat(), arma::mat(), alias_of(M_), alias_of(S_)} {}
+
+SEXP RFitOutputs::M(const ModelFit & fit) const {
+    return fit.M.is_empty() ? SEXP(M_) : Rcpp::wrap(fit.M);
+}
+
+SEXP RFitOutputs::S(const ModelFit & fit) const {
+    return fit.S.is_empty() ? SEXP(S_) : Rcpp::wrap(fit.S);
+}
+
+std::vector<ModelParameters> model_starts_from_r(const Rcpp::List & init_parameters) {
+    auto starts = std::vector<ModelParameters>();
+    if(init_parameters.containsElementNamed("starts")) {
+        const auto start_list = Rcpp::List(init_parameters["starts"]);
+        for(R_xlen_t i = 0; i < start_list.size(); i += 1) {
+            starts.push_back(model_parameters_from_r(Rcpp::List(start_list[i])));
+        }
+    }
+    return starts;
+}
+
+Rcpp::RObject multistart_report_to_r(const std::vector<MultistartCandidate> & candidates) {
+    if(candidates.empty()) {
+        return R_NilValue;
+    }
+    const auto nb_starts = candidates.size();
+    auto objective = Rcpp::NumericVector(nb_starts);
+    auto evaluations = Rcpp::IntegerVector(nb_starts);
+    auto eliminated_round = Rcpp::IntegerVector(nb_starts);
+    auto status = Rcpp::IntegerVector(nb_starts);
+    for(std::size_t k = 0; k < nb_starts; k += 1) {
+        objective[k] = candidates[k].objective;
+        evaluations[k] = candidates[k].nb_evaluations;
+        eliminated_round[k] = candidates[k].eliminated_round;
+        status[k] = static_cast<int>(candidates[k].status);
+    }
+    return Rcpp::DataFrame::create(
+        Rcpp::Named("start") = Rcpp::seq_len(nb_starts),
+        Rcpp::Named("objective") = objective,
+        Rcpp::Named("evaluations") = evaluations,
+        Rcpp::Named("eliminated_round") = eliminated_round,
+        Rcpp::Named("status") = status);
+}
+
+Rcpp::RObject perf_counts_to_r(const std::vector<PerfCounts> & counts) {
+    if(counts.empty()) {
+        return R_NilValue;
+    }
+    const PerfCounts & c = counts.front();
+    return Rcpp::NumericVector::create(
+        Rcpp::Named("cycles") = c.cycles,
+        Rcpp::Named("instructions") = c.instructions,
+        Rcpp::Named("cache_references") = c.cache_references,
+        Rcpp::Named("cache_misses") = c.cache_misses,
+        Rcpp::Named("branch_misses") = c.branch_misses,
+        Rcpp::Named("flops") = c.flops,
+        Rcpp::Named("seconds") = c.seconds,
+        Rcpp::Named("measures") = double(c.nb_measures));
+}
+
+Rcpp::NumericVector memory_usage_to_r(const MemoryUsage & usage) {
+    return Rcpp::NumericVector::create(
+        Rcpp::Named("peak_bytes") = usage.peak_bytes,
+        Rcpp::Named("allocated_bytes") = usage.allocated_bytes,
+        Rcpp::Named("allocations") = usage.nb_allocations);
+}
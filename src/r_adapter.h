@@ -0,0 +1,63 @@
+// Conversions between R values and the plain C++ types of the numerical core (see arma_backend.h and models.h).
+// Only used by the R package.
+#pragma once
+
+#include "arma_backend.h"
+
+#include <vector>
+
+#include "data.h"
+#include "models.h"
+
+// Responses from an R numeric or integer matrix
+CountMatrix count_matrix_from_r(SEXP r_value);
+
+// Offsets from a (n,p) matrix, a (n) vector of row offsets, or a list(row = (n), col = (p)).
+// Dense double matrices are used in place (no copy).
+Offsets<double> offsets_from_r(SEXP r_value, arma::uword n, arma::uword p);
+
+// Options from the configuration list built by the *_param functions (R/utils.R).
+// Required elements: algorithm, xtol_abs, xtol_rel, ftol_abs, ftol_rel, maxeval, maxtime.
+// Other elements are optional, with the values of FitOptions::defaults() if absent:
+// - diagonal_scaling, scaling_refresh, auto_probe_maxeval, auto_probe_maxtime, covariance (see OptimizerConfiguration)
+// - row_weight_threshold, precision ("double" or "float"), log_S
+// - ve_engine ("nlopt", "batched_newton" or "coordinate_ascent"), ve_block_size
+// - lbfgs_memory, gtol_abs, multistart_round, multistart_threads (multistart races)
+// - numa_workers, numa_pin
+// - perf_counters
+// xtol_abs is either a single value, or a named list of values by parameter (single value or array).
+FitOptions fit_options_from_r(const Rcpp::List & configuration);
+
+// Parameters from a list with elements among Theta, B, M, S. Missing elements are left empty.
+// Double values are used in place (no copy): they must not be modified, and list must outlive the parameters.
+ModelParameters model_parameters_from_r(const Rcpp::List & list);
+
+// R matrices receiving the fitted M and S of a fit in place, with the dimensions of the initial values: storage() is
+// given as the outputs argument of the fit (see output_for in models.h), and M(fit), S(fit) returned to R.
+class RFitOutputs {
+  public:
+    explicit RFitOutputs(const ModelParameters & init);
+
+    ModelParameters * storage() { return &storage_; }
+
+    // The R matrix written by the fit, or a copy of the fitted value if the fit did not use it
+    SEXP M(const ModelFit & fit) const;
+    SEXP S(const ModelFit & fit) const;
+
+  private:
+    Rcpp::NumericMatrix M_;
+    Rcpp::NumericMatrix S_;
+    ModelParameters storage_; // M and S using the memory of M_ and S_
+};
+
+// Optional element "starts" of the initial parameters: list of additional starts list(Theta, B, M, S)
+std::vector<ModelParameters> model_starts_from_r(const Rcpp::List & init_parameters);
+
+// Outcome of multistart races as a data.frame(start, objective, evaluations, eliminated_round, status), NULL if empty
+Rcpp::RObject multistart_report_to_r(const std::vector<MultistartCandidate> & candidates);
+
+// Hardware counts of a fit as a named numeric vector (see PerfCounts), NULL if empty (counters not requested)
+Rcpp::RObject perf_counts_to_r(const std::vector<PerfCounts> & counts);
+
+// Memory of a fit as a named numeric vector (peak_bytes, allocated_bytes, allocations)
+Rcpp::NumericVector memory_usage_to_r(const MemoryUsage & usage);
@@ -0,0 +1,391 @@
+#include "simd.h"
+
+#include <cmath>   // exp, log
+#include <cstdint> // int64_t, uint64_t
+#include <cstdlib> // getenv
+#include <cstring> // memcpy, strcmp
+#include <limits>
+#include <vector>
+
+#if(defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define PLNMODELS_SIMD_DISPATCH 1
+#define PLNMODELS_TARGET(isa) __attribute__((target(isa)))
+#define PLNMODELS_ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+// Kernel implementations of a target
+struct SimdKernels {
+    void (*exp)(const double *, double *, std::size_t);
+    void (*log)(const double *, double *, std::size_t);
+    double (*exp_weighted_sum)(const double *, double *, const double *, std::size_t, std::size_t);
+};
+
+// ---------------------------------------------------------------------------------------
+// Baseline: libm, with the weighted sum fused in the exp pass
+
+static void exp_baseline(const double * x, double * y, std::size_t n) {
+    for(std::size_t i = 0; i < n; i += 1) {
+        y[i] = std::exp(x[i]);
+    }
+}
+
+static void log_baseline(const double * x, double * y, std::size_t n) {
+    for(std::size_t i = 0; i < n; i += 1) {
+        y[i] = std::log(x[i]);
+    }
+}
+
+static double exp_weighted_sum_baseline(
+    const double * x, double * y, const double * w, std::size_t n_rows, std::size_t n_cols) {
+    double sum = 0.;
+    for(std::size_t j = 0; j < n_cols; j += 1) {
+        for(std::size_t i = 0; i < n_rows; i += 1) {
+            const std::size_t k = j * n_rows + i;
+            y[k] = std::exp(x[k]);
+            sum += w[i] * y[k];
+        }
+    }
+    return sum;
+}
+
+#ifdef PLNMODELS_SIMD_DISPATCH
+
+// ---------------------------------------------------------------------------------------
+// Vector kernels on 4 doubles, inlined in each target variant.
+// The AVX-512 variant also uses 256 bits vectors, with the AVX-512 encoding (mask registers, 32 registers): compilers
+// generate poor code for comparisons of 512 bits generic vectors, and 256 bits avoid the frequency drop of some CPUs.
+
+#if defined(__GNUC__) && !defined(__clang__)
+// Vectors are returned in AVX registers only with AVX enabled: harmless here, as all vector functions are inlined
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace {
+typedef double v4d __attribute__((vector_size(32)));
+typedef std::int64_t v4i __attribute__((vector_size(32))); // Comparison results: all ones or zero per lane
+typedef std::uint64_t v4u __attribute__((vector_size(32)));
+
+PLNMODELS_ALWAYS_INLINE v4d load(const double * p) {
+    v4d v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+PLNMODELS_ALWAYS_INLINE void store(double * p, const v4d & v) {
+    std::memcpy(p, &v, sizeof(v));
+}
+PLNMODELS_ALWAYS_INLINE v4d splat(double value) {
+    return v4d{} + value;
+}
+PLNMODELS_ALWAYS_INLINE v4d select(const v4i & mask, const v4d & a, const v4d & b) {
+    return (v4d)(((v4i)a & mask) | ((v4i)b & ~mask));
+}
+PLNMODELS_ALWAYS_INLINE bool any(const v4i & mask) {
+    return (mask[0] | mask[1] | mask[2] | mask[3]) != 0;
+}
+
+// exp(x) = 2^k exp(r), x = k ln2 + r, |r| <= ln2 / 2, exp(r) by its Taylor polynomial of degree 13.
+// 2^k is built in the exponent bits; it is applied as 2^(k-1) * 2 to cover k = 1024.
+PLNMODELS_ALWAYS_INLINE v4d exp_vector(const v4d & x) {
+    const double shifter = 6755399441055744.; // 1.5 * 2^52: adding it rounds to an integer, stored in the low bits
+    const v4i nan = x != x;
+    const v4i overflow = x > 709.782712893384;
+    const v4i underflow = x < -708.;
+    const v4d xc = select(nan | overflow | underflow, splat(0.), x);
+
+    const v4d t = xc * 1.4426950408889634 + shifter;
+    const v4d k = t - shifter;
+    const v4d r = (xc - k * 6.93147180369123816490e-01) - k * 1.90821492927058770002e-10;
+    v4d p = splat(1. / 6227020800.);
+    p = p * r + 1. / 479001600.;
+    p = p * r + 1. / 39916800.;
+    p = p * r + 1. / 3628800.;
+    p = p * r + 1. / 362880.;
+    p = p * r + 1. / 40320.;
+    p = p * r + 1. / 5040.;
+    p = p * r + 1. / 720.;
+    p = p * r + 1. / 120.;
+    p = p * r + 1. / 24.;
+    p = p * r + 1. / 6.;
+    p = p * r + 0.5;
+    p = p * r + 1.;
+    p = p * r + 1.;
+    const v4d scale = (v4d)(((v4u)t + std::uint64_t(1022)) << 52);
+    v4d y = p * scale * 2.;
+
+    y = select(overflow, splat(std::numeric_limits<double>::infinity()), y);
+    y = select(underflow, splat(0.), y); // Patched by the loops
+    return select(nan, x, y);
+}
+
+// log(x) = e ln2 + log(m), x = 2^e m, m in [sqrt(2)/2, sqrt(2)), log(m) = 2 atanh(s), s = (m-1)/(m+1), |s| < 0.172,
+// atanh by its series up to s^19
+PLNMODELS_ALWAYS_INLINE v4d log_vector(const v4d & x) {
+    const v4i subnormal = (x < 2.2250738585072014e-308) & (x > 0.);
+    const v4d xs = select(subnormal, x * 4503599627370496., x); // 2^52
+    const v4u bits = (v4u)xs;
+    const v4u exponent_field = (bits >> 52) & std::uint64_t(0x7ff);
+    v4d m = (v4d)((bits & std::uint64_t(0x000fffffffffffff)) | std::uint64_t(0x3ff0000000000000));
+    const v4i big = m > 1.4142135623730951;
+    m = select(big, m * 0.5, m);
+    // exponent_field as a double: exact conversion through the bits of 2^52 + exponent_field
+    v4d e = (v4d)(exponent_field | std::uint64_t(0x4330000000000000)) - 4503599627370496. - 1023.;
+    e = e + select(big, splat(1.), splat(0.)) + select(subnormal, splat(-52.), splat(0.));
+
+    const v4d s = (m - 1.) / (m + 1.);
+    const v4d s2 = s * s;
+    v4d p = splat(2. / 19.);
+    p = p * s2 + 2. / 17.;
+    p = p * s2 + 2. / 15.;
+    p = p * s2 + 2. / 13.;
+    p = p * s2 + 2. / 11.;
+    p = p * s2 + 2. / 9.;
+    p = p * s2 + 2. / 7.;
+    p = p * s2 + 2. / 5.;
+    p = p * s2 + 2. / 3.;
+    p = p * s2 + 2.;
+    v4d y = e * 6.93147180369123816490e-01 + (s * p + e * 1.90821492927058770002e-10);
+
+    y = select(x == std::numeric_limits<double>::infinity(), x, y);
+    y = select(x == 0., splat(-std::numeric_limits<double>::infinity()), y);
+    y = select(x < 0., splat(std::numeric_limits<double>::quiet_NaN()), y);
+    return select(x != x, x, y);
+}
+
+// Results below the normal range, set to 0 by exp_vector, recomputed by libm
+PLNMODELS_ALWAYS_INLINE void patch_exp_underflow(const double * x, double * y, std::size_t n) {
+    for(std::size_t i = 0; i < n; i += 1) {
+        if(x[i] < -708.) {
+            y[i] = std::exp(x[i]);
+        }
+    }
+}
+
+// Loops over full vectors, then the padded tail
+PLNMODELS_ALWAYS_INLINE void exp_loop(const double * x, double * y, std::size_t n) {
+    const std::size_t width = sizeof(v4d) / sizeof(double);
+    std::size_t i = 0;
+    for(; i + width <= n; i += width) {
+        const v4d values = load(x + i);
+        store(y + i, exp_vector(values));
+        if(any(values < -708.)) {
+            patch_exp_underflow(x + i, y + i, width);
+        }
+    }
+    if(i < n) {
+        double tail[4] = {0., 0., 0., 0.};
+        std::memcpy(tail, x + i, (n - i) * sizeof(double));
+        store(tail, exp_vector(load(tail)));
+        std::memcpy(y + i, tail, (n - i) * sizeof(double));
+        patch_exp_underflow(x + i, y + i, n - i);
+    }
+}
+
+PLNMODELS_ALWAYS_INLINE void log_loop(const double * x, double * y, std::size_t n) {
+    const std::size_t width = sizeof(v4d) / sizeof(double);
+    std::size_t i = 0;
+    for(; i + width <= n; i += width) {
+        store(y + i, log_vector(load(x + i)));
+    }
+    if(i < n) {
+        double tail[4] = {1., 1., 1., 1.};
+        std::memcpy(tail, x + i, (n - i) * sizeof(double));
+        store(tail, log_vector(load(tail)));
+        std::memcpy(y + i, tail, (n - i) * sizeof(double));
+    }
+}
+
+PLNMODELS_ALWAYS_INLINE double exp_weighted_sum_loop(
+    const double * x, double * y, const double * w, std::size_t n_rows, std::size_t n_cols) {
+    const std::size_t width = sizeof(v4d) / sizeof(double);
+    v4d sums = splat(0.);
+    double tail_sum = 0.;
+    for(std::size_t j = 0; j < n_cols; j += 1) {
+        const double * x_col = x + j * n_rows;
+        double * y_col = y + j * n_rows;
+        std::size_t i = 0;
+        for(; i + width <= n_rows; i += width) {
+            const v4d values = load(x_col + i);
+            v4d exp_values = exp_vector(values);
+            if(any(values < -708.)) {
+                store(y_col + i, exp_values);
+                patch_exp_underflow(x_col + i, y_col + i, width);
+                exp_values = load(y_col + i);
+            }
+            store(y_col + i, exp_values);
+            sums += load(w + i) * exp_values;
+        }
+        if(i < n_rows) {
+            exp_loop(x_col + i, y_col + i, n_rows - i);
+            for(; i < n_rows; i += 1) {
+                tail_sum += w[i] * y_col[i];
+            }
+        }
+    }
+    double total = tail_sum;
+    for(std::size_t k = 0; k < width; k += 1) {
+        total += sums[k];
+    }
+    return total;
+}
+} // namespace
+
+
+// ---------------------------------------------------------------------------------------
+// Target variants
+
+#define PLNMODELS_DEFINE_KERNELS(suffix, isa)                                                                          \
+    PLNMODELS_TARGET(isa) static void exp_##suffix(const double * x, double * y, std::size_t n) {                      \
+        exp_loop(x, y, n);                                                                                             \
+    }                                                                                                                  \
+    PLNMODELS_TARGET(isa) static void log_##suffix(const double * x, double * y, std::size_t n) {                      \
+        log_loop(x, y, n);                                                                                             \
+    }                                                                                                                  \
+    PLNMODELS_TARGET(isa) static double exp_weighted_sum_##suffix(                                                     \
+        const double * x, double * y, const double * w, std::size_t n_rows, std::size_t n_cols) {                      \
+        return exp_weighted_sum_loop(x, y, w, n_rows, n_cols);                                                         \
+    }
+
+PLNMODELS_DEFINE_KERNELS(avx2, "avx2,fma")
+PLNMODELS_DEFINE_KERNELS(avx512, "avx512f,avx512dq,avx512vl")
+#endif
+
+static SimdKernels kernels_for(SimdLevel level) {
+#ifdef PLNMODELS_SIMD_DISPATCH
+    if(level == SimdLevel::Avx512) {
+        return {exp_avx512, log_avx512, exp_weighted_sum_avx512};
+    }
+    if(level == SimdLevel::Avx2) {
+        return {exp_avx2, log_avx2, exp_weighted_sum_avx2};
+    }
+#endif
+    (void) level;
+    return {exp_baseline, log_baseline, exp_weighted_sum_baseline};
+}
+
+// ---------------------------------------------------------------------------------------
+// Dispatch
+
+const char * simd_level_name(SimdLevel level) {
+    switch(level) {
+    case SimdLevel::Avx512:
+        return "avx512";
+    case SimdLevel::Avx2:
+        return "avx2";
+    default:
+        return "baseline";
+    }
+}
+
+SimdLevel simd_detected_level() {
+#ifdef PLNMODELS_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) {
+        return SimdLevel::Avx512;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SimdLevel::Avx2;
+    }
+#endif
+    return SimdLevel::Baseline;
+}
+
+static SimdLevel select_level() {
+    SimdLevel level = simd_detected_level();
+    const char * cap = std::getenv("PLNMODELS_SIMD");
+    if(cap != nullptr) {
+        if(std::strcmp(cap, "baseline") == 0) {
+            level = SimdLevel::Baseline;
+        } else if(std::strcmp(cap, "avx2") == 0 && level == SimdLevel::Avx512) {
+            level = SimdLevel::Avx2;
+        }
+    }
+    return level;
+}
+
+SimdLevel simd_level() {
+    static const SimdLevel level = select_level();
+    return level;
+}
+
+static const SimdKernels & kernels() {
+    static const SimdKernels selected = kernels_for(simd_level());
+    return selected;
+}
+
+void simd_exp(const double * x, double * y, std::size_t n) {
+    kernels().exp(x, y, n);
+}
+
+void simd_log(const double * x, double * y, std::size_t n) {
+    kernels().log(x, y, n);
+}
+
+double simd_exp_weighted_sum(const double * x, double * y, const double * w, std::size_t n_rows, std::size_t n_cols) {
+    return kernels().exp_weighted_sum(x, y, w, n_rows, n_cols);
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// R interface and sanity test
+
+// [[Rcpp::export]]
+Rcpp::List cpp_simd_info() {
+    return Rcpp::List::create(
+        Rcpp::Named("detected", simd_level_name(simd_detected_level())),
+        Rcpp::Named("selected", simd_level_name(simd_level())));
+}
+
+// [[Rcpp::export]]
+bool cpp_test_simd() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    const double inf = std::numeric_limits<double>::infinity();
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    // Every variant supported by the CPU, not only the selected one
+    auto levels = std::vector<SimdLevel>{SimdLevel::Baseline};
+    if(simd_detected_level() != SimdLevel::Baseline) {
+        levels.push_back(SimdLevel::Avx2);
+    }
+    if(simd_detected_level() == SimdLevel::Avx512) {
+        levels.push_back(SimdLevel::Avx512);
+    }
+    const arma::vec exp_inputs = arma::join_cols(
+        arma::vec{0., -0., 1e-300, -708.5, -745.2, -746., 709.78, 709.79, 710., -inf, inf, nan},
+        arma::linspace<arma::vec>(-700., 700., 1001)); // Odd size: exercises the tails
+    const arma::vec log_inputs = arma::join_cols(
+        arma::vec{0., 1e-310, 4.9e-324, -1., inf, -inf, nan, 1., 2., 1.4142135623730951, 1e308},
+        arma::exp(arma::linspace<arma::vec>(-700., 700., 1001)));
+    auto matches = [](const arma::vec & values, const arma::vec & reference) -> bool {
+        for(arma::uword i = 0; i < values.n_elem; i += 1) {
+            const double v = values[i];
+            const double r = reference[i];
+            if(std::isnan(r) ? !std::isnan(v) : !(v == r || std::abs(v - r) <= 1e-15 * std::abs(r))) {
+                return false;
+            }
+        }
+        return true;
+    };
+    const arma::mat X = arma::randn<arma::mat>(37, 5) * 10.;
+    const arma::vec w = arma::randu<arma::vec>(37);
+    for(SimdLevel level : levels) {
+        const SimdKernels kernels = kernels_for(level);
+        arma::vec y(exp_inputs.n_elem);
+        kernels.exp(exp_inputs.memptr(), y.memptr(), y.n_elem);
+        check(matches(y, arma::exp(exp_inputs)), "simd exp");
+        y.set_size(log_inputs.n_elem);
+        kernels.log(log_inputs.memptr(), y.memptr(), y.n_elem);
+        check(matches(y, arma::log(log_inputs)), "simd log");
+        arma::mat A(arma::size(X));
+        const double sum = kernels.exp_weighted_sum(X.memptr(), A.memptr(), w.memptr(), X.n_rows, X.n_cols);
+        check(arma::approx_equal(A, arma::exp(X), "reldiff", 1e-15), "simd exp weighted sum values");
+        check(std::abs(sum - accu(diagmat(w) * arma::exp(X))) <= 1e-13 * std::abs(sum), "simd exp weighted sum");
+    }
+    return success;
+}
+
+#endif
@@ -0,0 +1,48 @@
+// Elementwise kernels compiled for several x86-64 instruction sets, selected at runtime.
+//
+// Packages are built for baseline x86-64 (SSE2), where exp and log are scalar libm calls. The vectorized kernels are
+// written once with generic vectors (GCC / Clang extensions), compiled for the AVX2+FMA and AVX-512 targets, and the
+// widest variant supported by the CPU (cpuid) is selected at first use; other CPUs use libm.
+// The environment variable PLNMODELS_SIMD ("baseline", "avx2") caps the selection.
+//
+// exp and log are accurate to a couple of ulps, with libm special values (infinities, NaN, zero, subnormals).
+// Matrix products (Gram matrices, crossproducts) are left to the BLAS, which has its own runtime dispatch.
+#pragma once
+
+#include "arma_backend.h"
+
+#include <cstddef>
+
+enum class SimdLevel { Baseline, Avx2, Avx512 };
+
+const char * simd_level_name(SimdLevel level);
+SimdLevel simd_detected_level(); // Widest level supported by the CPU
+SimdLevel simd_level();          // Level used by the kernels
+
+// y[i] = exp(x[i]), y[i] = log(x[i]) ; x and y may alias
+void simd_exp(const double * x, double * y, std::size_t n);
+void simd_log(const double * x, double * y, std::size_t n);
+// Y = exp(X) for column-major (n_rows, n_cols) matrices, returning sum_ij w_i Y_ij in the same pass
+double simd_exp_weighted_sum(const double * x, double * y, const double * w, std::size_t n_rows, std::size_t n_cols);
+
+// Armadillo wrappers, for the objectives of optimize.cpp and optimize_ve.cpp
+inline arma::mat fast_exp(const arma::mat & x) {
+    arma::mat y(x.n_rows, x.n_cols);
+    simd_exp(x.memptr(), y.memptr(), x.n_elem);
+    return y;
+}
+inline arma::mat fast_log(const arma::mat & x) {
+    arma::mat y(x.n_rows, x.n_cols);
+    simd_log(x.memptr(), y.memptr(), x.n_elem);
+    return y;
+}
+inline arma::vec fast_log(const arma::vec & x) {
+    arma::vec y(x.n_elem);
+    simd_log(x.memptr(), y.memptr(), x.n_elem);
+    return y;
+}
+// A = exp(x), returns accu(diagmat(w) * A)
+inline double fast_exp_weighted_sum(const arma::mat & x, const arma::vec & w, arma::mat & A) {
+    A.set_size(x.n_rows, x.n_cols);
+    return simd_exp_weighted_sum(x.memptr(), A.memptr(), w.memptr(), x.n_rows, x.n_cols);
+}
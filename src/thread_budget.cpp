@@ -0,0 +1,138 @@
+#include "thread_budget.h"
+
+#include <algorithm> // max, min
+#include <cstdint>   // int64_t
+#include <cstdlib>   // getenv, strtol
+#include <thread>
+
+#ifndef _WIN32
+#include <dlfcn.h> // dlsym
+#endif
+
+int available_cores() {
+    const char * env = std::getenv("PLNMODELS_NUM_THREADS");
+    if(env != nullptr) {
+        const long value = std::strtol(env, nullptr, 10);
+        if(value > 0) {
+            return int(value);
+        }
+    }
+    return std::max(int(std::thread::hardware_concurrency()), 1);
+}
+
+ThreadBudget ThreadBudget::partition(int nb_tasks, int requested_outer, int total_cores) {
+    total_cores = std::max(total_cores, 1);
+    ThreadBudget budget;
+    budget.outer = std::max(std::min(std::min(requested_outer, nb_tasks), total_cores), 1);
+    budget.inner = std::max(total_cores / budget.outer, 1);
+    return budget;
+}
+
+// ---------------------------------------------------------------------------------------
+// BLAS control, symbols looked up in the whole process
+
+#ifndef _WIN32
+template <typename F> static F lookup(const char * name) {
+    return reinterpret_cast<F>(dlsym(RTLD_DEFAULT, name));
+}
+#else
+template <typename F> static F lookup(const char *) {
+    return nullptr;
+}
+#endif
+
+int blas_get_num_threads() {
+    if(auto openblas = lookup<int (*)()>("openblas_get_num_threads")) {
+        return openblas();
+    }
+    if(auto mkl = lookup<int (*)()>("MKL_Get_Max_Threads")) {
+        return mkl();
+    }
+    if(auto blis = lookup<std::int64_t (*)()>("bli_thread_get_num_threads")) {
+        return int(blis());
+    }
+    if(auto omp = lookup<int (*)()>("omp_get_max_threads")) {
+        return omp();
+    }
+    return -1;
+}
+
+bool blas_set_num_threads(int nb_threads) {
+    bool found = false;
+    if(auto openblas = lookup<void (*)(int)>("openblas_set_num_threads")) {
+        openblas(nb_threads);
+        found = true;
+    }
+    if(auto mkl = lookup<void (*)(int)>("MKL_Set_Num_Threads")) {
+        mkl(nb_threads);
+        found = true;
+    }
+    if(auto blis = lookup<void (*)(std::int64_t)>("bli_thread_set_num_threads")) {
+        blis(nb_threads);
+        found = true;
+    }
+    // Threaded BLAS built on OpenMP (OpenBLAS-openmp, MKL gnu_thread) also follow the OpenMP runtime
+    if(auto omp = lookup<void (*)(int)>("omp_set_num_threads")) {
+        omp(nb_threads);
+        found = true;
+    }
+    return found;
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// R interface
+
+// [[Rcpp::export]]
+Rcpp::List cpp_thread_budget(int nb_tasks, int requested_outer) {
+    const int total = available_cores();
+    const auto budget = ThreadBudget::partition(nb_tasks, requested_outer, total);
+    return Rcpp::List::create(
+        Rcpp::Named("outer", budget.outer), Rcpp::Named("inner", budget.inner), Rcpp::Named("total", total));
+}
+
+// Returns the previous BLAS thread count, -1 if unknown
+// [[Rcpp::export]]
+int cpp_set_blas_threads(int nb_threads) {
+    const int previous = blas_get_num_threads();
+    if(nb_threads > 0) {
+        blas_set_num_threads(nb_threads);
+    }
+    return previous;
+}
+
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_thread_budget() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    check(available_cores() >= 1, "thread budget cores");
+
+    const auto families = ThreadBudget::partition(5, 64, 64);
+    check(families.outer == 5 && families.inner == 12, "thread budget few tasks");
+    const auto replicates = ThreadBudget::partition(100, 64, 64);
+    check(replicates.outer == 64 && replicates.inner == 1, "thread budget many tasks");
+    const auto sequential = ThreadBudget::partition(10, 1, 8);
+    check(sequential.outer == 1 && sequential.inner == 8, "thread budget sequential");
+    const auto oversubscribed = ThreadBudget::partition(10, 16, 4);
+    check(oversubscribed.outer == 4 && oversubscribed.inner == 1, "thread budget capped outer");
+    const auto degenerate = ThreadBudget::partition(0, 0, 0);
+    check(degenerate.outer == 1 && degenerate.inner == 1, "thread budget degenerate");
+
+    // Round trip of the BLAS setting, if controllable
+    const int previous = blas_get_num_threads();
+    if(previous > 0 && blas_set_num_threads(1)) {
+        check(blas_get_num_threads() == 1, "thread budget blas set");
+        blas_set_num_threads(previous);
+    }
+    return success;
+}
+
+#endif
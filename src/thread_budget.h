@@ -0,0 +1,28 @@
+// Global thread budget shared between outer task parallelism and inner (BLAS, kernel) parallelism.
+//
+// Families, mixture smoothing and stability selection fork one R worker per task (mclapply), and each worker calls
+// a multithreaded BLAS through Armadillo. Left alone, both levels use all the cores, which oversubscribes the machine
+// by the number of workers. The budget splits the available cores between the two levels, and each worker restricts
+// its BLAS to its inner share before running its task.
+#pragma once
+
+#include "arma_backend.h"
+
+// Number of cores the package may use: environment variable PLNMODELS_NUM_THREADS if set to a positive integer,
+// hardware concurrency otherwise (1 if unknown).
+int available_cores();
+
+struct ThreadBudget {
+    int outer; // Number of concurrent tasks (forked workers, threads)
+    int inner; // Number of threads of each task (BLAS, kernels)
+
+    // At most requested_outer concurrent tasks, never more than nb_tasks nor total_cores.
+    // The remaining cores are given to each task: outer * inner <= total_cores, inner >= 1.
+    static ThreadBudget partition(int nb_tasks, int requested_outer, int total_cores);
+};
+
+// Thread count of the BLAS (and OpenMP runtime) linked into the process, resolved at runtime because the BLAS is
+// chosen when R is installed. Supported: OpenBLAS, MKL, BLIS, and the OpenMP runtime. Reference BLAS and Accelerate
+// have no such control.
+int blas_get_num_threads();     // -1 if unknown
+bool blas_set_num_threads(int); // false if no supported BLAS was found
@@ -0,0 +1,201 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio> // snprintf
+#include <mutex>
+#include <sstream>
+
+#include "arma_backend.h"
+
+std::atomic<bool> trace_enabled_flag(false);
+
+static std::mutex trace_mutex;
+static std::vector<TraceEvent> trace_buffer;
+static std::size_t trace_dropped = 0;
+static std::atomic<int> trace_nb_threads(0);
+
+void set_trace_enabled(bool enabled) {
+    trace_enabled_flag.store(enabled, std::memory_order_relaxed);
+}
+
+std::int64_t trace_now_ns() {
+    using Clock = std::chrono::steady_clock;
+    static const Clock::time_point origin = Clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin).count();
+}
+
+std::size_t trace_max_events() {
+    return std::size_t(1) << 20;
+}
+
+void trace_record(const char * name, const char * category, std::int64_t start_ns, std::int64_t end_ns) {
+    static thread_local int thread = trace_nb_threads.fetch_add(1);
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    if(trace_buffer.size() >= trace_max_events()) {
+        trace_dropped += 1;
+        return;
+    }
+    trace_buffer.push_back(TraceEvent{name, category, start_ns, end_ns - start_ns, thread});
+}
+
+std::vector<TraceEvent> trace_events() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    return trace_buffer;
+}
+
+std::size_t trace_dropped_events() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    return trace_dropped;
+}
+
+void clear_trace() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_buffer.clear();
+    trace_buffer.shrink_to_fit();
+    trace_dropped = 0;
+}
+
+// JSON string with escapes
+static void write_json_string(std::ostream & out, const std::string & s) {
+    out << '"';
+    for(const char c : s) {
+        if(c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if(static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(c));
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void write_chrome_trace(std::ostream & out, const std::vector<TraceEvent> & events) {
+    char times[64];
+    out << "{\"traceEvents\":[";
+    for(std::size_t k = 0; k < events.size(); k += 1) {
+        const TraceEvent & e = events[k];
+        out << (k > 0 ? ",\n" : "\n") << "{\"name\":";
+        write_json_string(out, e.name);
+        out << ",\"cat\":";
+        write_json_string(out, e.category);
+        std::snprintf(times, sizeof(times), "%.3f,\"dur\":%.3f", double(e.start_ns) / 1e3, double(e.duration_ns) / 1e3);
+        out << ",\"ph\":\"X\",\"ts\":" << times << ",\"pid\":1,\"tid\":" << e.thread << "}";
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// R interface
+
+// [[Rcpp::export]]
+bool cpp_trace_enable(bool enabled) {
+    const bool previous = trace_enabled();
+    set_trace_enabled(enabled);
+    return previous;
+}
+
+// [[Rcpp::export]]
+bool cpp_trace_enabled() {
+    return trace_enabled();
+}
+
+// [[Rcpp::export]]
+double cpp_trace_now() {
+    return double(trace_now_ns());
+}
+
+// Span from start (cpp_trace_now) to now, for phases implemented in R
+// [[Rcpp::export]]
+void cpp_trace_add(std::string name, std::string category, double start) {
+    if(trace_enabled()) {
+        trace_record(name.c_str(), category.c_str(), std::int64_t(start), trace_now_ns());
+    }
+}
+
+// [[Rcpp::export]]
+void cpp_trace_clear() {
+    clear_trace();
+}
+
+// [[Rcpp::export]]
+Rcpp::List cpp_trace_events() {
+    const std::vector<TraceEvent> events = trace_events();
+    const auto nb_events = events.size();
+    auto name = Rcpp::CharacterVector(nb_events);
+    auto category = Rcpp::CharacterVector(nb_events);
+    auto start = Rcpp::NumericVector(nb_events);
+    auto duration = Rcpp::NumericVector(nb_events);
+    auto thread = Rcpp::IntegerVector(nb_events);
+    for(std::size_t k = 0; k < nb_events; k += 1) {
+        name[k] = events[k].name;
+        category[k] = events[k].category;
+        start[k] = double(events[k].start_ns) / 1e9;
+        duration[k] = double(events[k].duration_ns) / 1e9;
+        thread[k] = events[k].thread;
+    }
+    return Rcpp::List::create(
+        Rcpp::Named("spans") = Rcpp::DataFrame::create(
+            Rcpp::Named("name") = name,
+            Rcpp::Named("category") = category,
+            Rcpp::Named("start") = start,
+            Rcpp::Named("duration") = duration,
+            Rcpp::Named("thread") = thread,
+            Rcpp::Named("stringsAsFactors") = false),
+        Rcpp::Named("dropped") = double(trace_dropped_events()));
+}
+
+// [[Rcpp::export]]
+std::string cpp_trace_chrome_json() {
+    std::ostringstream out;
+    write_chrome_trace(out, trace_events());
+    return out.str();
+}
+
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_trace() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    const bool previous = trace_enabled();
+    set_trace_enabled(false);
+    const std::size_t nb_before = trace_events().size();
+    {
+        TraceSpan disabled("disabled");
+    }
+    check(trace_events().size() == nb_before, "trace disabled");
+
+    set_trace_enabled(true);
+    {
+        TraceSpan outer("outer \"quoted\"", "test");
+        TraceSpan inner("inner", "test");
+        inner.end();
+    }
+    set_trace_enabled(previous);
+    const std::vector<TraceEvent> events = trace_events();
+    check(events.size() == nb_before + 2, "trace spans recorded");
+    if(events.size() == nb_before + 2) {
+        const TraceEvent & inner = events[nb_before];
+        const TraceEvent & outer = events[nb_before + 1];
+        check(inner.name == "inner" && outer.category == "test", "trace span names");
+        check(inner.start_ns >= outer.start_ns && inner.duration_ns <= outer.duration_ns, "trace span nesting");
+        std::ostringstream out;
+        write_chrome_trace(out, std::vector<TraceEvent>{outer});
+        const std::string json = out.str();
+        check(json.find("\"name\":\"outer \\\"quoted\\\"\"") != std::string::npos, "trace json escapes");
+        check(json.find("\"ph\":\"X\"") != std::string::npos, "trace json complete event");
+    }
+    return success;
+}
+
+#endif
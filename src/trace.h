@@ -0,0 +1,74 @@
+// Lightweight tracing of the phases of the optimizers, exported as Chrome trace-event JSON (Perfetto).
+//
+// A TraceSpan records the interval between its construction and its destruction (or end()) on the calling thread.
+// Tracing is disabled by default: a span then costs one relaxed atomic load and a branch. Defining
+// PLNMODELS_NO_TRACE removes the PLNMODELS_TRACE_SPAN spans at compile time.
+// Spans are kept in memory until cleared, up to trace_max_events() spans; further spans are counted as dropped.
+// Forked R workers (mclapply) record spans in their own copy of the process, which are not seen by the parent.
+#pragma once
+
+#include <atomic>
+#include <cstdint> // int64_t
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+    std::string name;
+    std::string category;
+    std::int64_t start_ns;    // From the first use of the trace clock in the process
+    std::int64_t duration_ns;
+    int thread;               // Small thread index, in order of first recorded span
+};
+
+extern std::atomic<bool> trace_enabled_flag;
+
+inline bool trace_enabled() {
+    return trace_enabled_flag.load(std::memory_order_relaxed);
+}
+void set_trace_enabled(bool enabled);
+
+std::int64_t trace_now_ns(); // Steady clock
+std::size_t trace_max_events();
+void trace_record(const char * name, const char * category, std::int64_t start_ns, std::int64_t end_ns);
+
+// Copy of the recorded spans, and number of dropped spans
+std::vector<TraceEvent> trace_events();
+std::size_t trace_dropped_events();
+void clear_trace();
+
+// {"traceEvents": [...]} with one complete ("ph": "X") event per span, times in microseconds
+void write_chrome_trace(std::ostream & out, const std::vector<TraceEvent> & events);
+
+class TraceSpan {
+  public:
+    // name and category must outlive the span (string literals)
+    explicit TraceSpan(const char * name, const char * category = "cpp")
+        : name_(name), category_(category), start_ns_(trace_enabled() ? trace_now_ns() : -1) {}
+    ~TraceSpan() { end(); }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan & operator=(const TraceSpan &) = delete;
+
+    // Close the span before the end of its scope
+    void end() {
+        if(start_ns_ >= 0) {
+            trace_record(name_, category_, start_ns_, trace_now_ns());
+            start_ns_ = -1;
+        }
+    }
+
+  private:
+    const char * name_;
+    const char * category_;
+    std::int64_t start_ns_; // -1 if not recording
+};
+
+#define PLNMODELS_TRACE_CONCAT_(a, b) a##b
+#define PLNMODELS_TRACE_CONCAT(a, b) PLNMODELS_TRACE_CONCAT_(a, b)
+#ifdef PLNMODELS_NO_TRACE
+#define PLNMODELS_TRACE_SPAN(...)
+#else
+// Span covering the rest of the enclosing scope
+#define PLNMODELS_TRACE_SPAN(...) const TraceSpan PLNMODELS_TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+#endif
@@ -0,0 +1,226 @@
+#include "ve_coordinate.h"
+
+#include <algorithm> // min, max
+#include <cmath>
+#include <stdexcept>
+
+#include "simd.h"
+#include "trace.h"
+
+// ---------------------------------------------------------------------------------------
+// Scalar kernels, elementwise
+
+// Below this argument, W(exp(x)) = exp(x) to double precision
+static const double wright_omega_small = -30.;
+// Newton iterations for w + log(w) = x. The initial guesses are within ~30% of the solution and the iteration
+// converges quadratically (with a contraction factor below 1/2), so 5 iterations reach double precision.
+static const int wright_omega_iterations = 5;
+
+arma::mat wright_omega(const arma::mat & x) {
+    const arma::mat xs = arma::clamp(x, wright_omega_small, arma::datum::inf);
+    // log(1 + exp(x)) for small x, x - log(x) asymptotically
+    arma::mat w = log(1. + exp(arma::clamp(xs, wright_omega_small, 1.)));
+    const arma::uvec large = find(xs > 1.);
+    w.elem(large) = xs.elem(large) - log(xs.elem(large));
+    for(int k = 0; k < wright_omega_iterations; k += 1) {
+        w = w % (1. + xs - fast_log(w)) / (1. + w);
+    }
+    const arma::uvec small = find(x < wright_omega_small);
+    w.elem(small) = exp(x.elem(small));
+    return w;
+}
+
+// Root t of t (a exp(t/2) + omega2) = 1, elementwise (omega2 is an array like a, or a scalar).
+// Newton steps from the upper bound 1 / (a + omega2) decrease monotonically to the root (increasing convex function).
+static const int variance_max_iterations = 50;
+static const double variance_xtol_rel = 1e-12;
+
+template <typename T, typename O> static T solve_variance(const T & a, const O & omega2) {
+    T t = 1. / (a + omega2);
+    for(int k = 0; k < variance_max_iterations; k += 1) {
+        const T e = a % exp(0.5 * t);
+        const T step = (t % (e + omega2) - 1.) / (e % (1. + 0.5 * t) + omega2);
+        t -= step;
+        if(all(vectorise(abs(step) <= variance_xtol_rel * t))) {
+            break;
+        }
+    }
+    return t;
+}
+
+// ---------------------------------------------------------------------------------------
+// Diagonal
+
+OptimizerResult ve_coordinate_diagonal(
+    const arma::mat & Z0,
+    const CountMatrix & Y,
+    const arma::vec & omega2,
+    arma::mat & M,
+    arma::mat & S,
+    const VeNewtonConfiguration & config //
+) {
+    const arma::uword n = Y.n_rows;
+    const arma::uword p = Y.n_cols;
+    if(!(Z0.n_rows == n && Z0.n_cols == p && M.n_rows == n && M.n_cols == p && S.n_rows == n && S.n_cols == p &&
+         omega2.n_elem == p)) {
+        throw std::invalid_argument("ve_coordinate_diagonal: dimension mismatch");
+    }
+    bool maxiter_reached = false;
+    OptimizerResult result = {NLOPT_FTOL_REACHED, 0., 0};
+
+    for(arma::uword first = 0; first < n; first += config.block_size) {
+        PLNMODELS_TRACE_SPAN("ve_coordinate_block", "kernel");
+        const arma::uword last = std::min(n, first + config.block_size) - 1;
+        const arma::mat Yb = Y.to_mat(first, last);
+        const arma::mat Z0b = Z0.rows(first, last);
+        const arma::mat W = arma::repmat(omega2.t(), Yb.n_rows, 1);
+        const arma::mat Y_over_W = Yb / W;
+        const arma::mat log_W = arma::repmat(log(omega2).t(), Yb.n_rows, 1);
+        arma::mat Mb = M.rows(first, last);
+        arma::mat Sb = S.rows(first, last);
+
+        auto objective = [&Yb, &Z0b, &W](const arma::mat & Mt, const arma::mat & St) -> double {
+            const arma::mat Zt = Z0b + Mt;
+            const arma::mat S2 = St % St;
+            return accu(exp(Zt + 0.5 * S2) - Yb % Zt + 0.5 * W % (Mt % Mt + S2) - log(St));
+        };
+        double f = objective(Mb, Sb);
+        bool converged = false;
+        int iteration = 0;
+        for(; iteration < config.maxiter && !converged; iteration += 1) {
+            Mb = Y_over_W - wright_omega(Z0b + 0.5 * (Sb % Sb) + Y_over_W - log_W);
+            Sb = sqrt(solve_variance(arma::mat(exp(Z0b + Mb)), W));
+            const double f_pass = objective(Mb, Sb);
+            converged = std::abs(f - f_pass) <= config.ftol_rel * std::abs(f_pass);
+            f = f_pass;
+        }
+        maxiter_reached = maxiter_reached || !converged;
+        M.rows(first, last) = Mb;
+        S.rows(first, last) = Sb;
+        result.objective += f;
+        result.nb_iterations = std::max(result.nb_iterations, iteration);
+    }
+    result.status = maxiter_reached ? NLOPT_MAXEVAL_REACHED : NLOPT_FTOL_REACHED;
+    return result;
+}
+
+// ---------------------------------------------------------------------------------------
+// Spherical
+
+OptimizerResult ve_coordinate_spherical(
+    const arma::mat & Z0,
+    const CountMatrix & Y,
+    double omega2,
+    arma::mat & M,
+    arma::vec & S,
+    const VeNewtonConfiguration & config //
+) {
+    const arma::uword n = Y.n_rows;
+    const arma::uword p = Y.n_cols;
+    if(!(Z0.n_rows == n && Z0.n_cols == p && M.n_rows == n && M.n_cols == p && S.n_elem == n)) {
+        throw std::invalid_argument("ve_coordinate_spherical: dimension mismatch");
+    }
+    const double dp = double(p);
+    const double log_omega2 = std::log(omega2);
+    bool maxiter_reached = false;
+    OptimizerResult result = {NLOPT_FTOL_REACHED, 0., 0};
+
+    for(arma::uword first = 0; first < n; first += config.block_size) {
+        PLNMODELS_TRACE_SPAN("ve_coordinate_block", "kernel");
+        const arma::uword last = std::min(n, first + config.block_size) - 1;
+        const arma::mat Yb = Y.to_mat(first, last);
+        const arma::mat Z0b = Z0.rows(first, last);
+        const arma::mat Y_over_W = Yb / omega2;
+        arma::mat Mb = M.rows(first, last);
+        arma::vec Sb = S.subvec(first, last);
+
+        auto objective = [&Yb, &Z0b, omega2, dp](const arma::mat & Mt, const arma::vec & St) -> double {
+            const arma::mat Zt = Z0b + Mt;
+            const arma::vec S2 = St % St;
+            const arma::mat A = exp(Zt.each_col() + 0.5 * S2);
+            return accu(A - Yb % Zt + 0.5 * omega2 * Mt % Mt) + accu(0.5 * dp * omega2 * S2 - dp * log(St));
+        };
+        double f = objective(Mb, Sb);
+        bool converged = false;
+        int iteration = 0;
+        for(; iteration < config.maxiter && !converged; iteration += 1) {
+            const arma::mat C = Z0b.each_col() + 0.5 * (Sb % Sb);
+            Mb = Y_over_W - wright_omega(C + Y_over_W - log_omega2);
+            Sb = sqrt(solve_variance(arma::vec(mean(exp(Z0b + Mb), 1)), omega2));
+            const double f_pass = objective(Mb, Sb);
+            converged = std::abs(f - f_pass) <= config.ftol_rel * std::abs(f_pass);
+            f = f_pass;
+        }
+        maxiter_reached = maxiter_reached || !converged;
+        M.rows(first, last) = Mb;
+        S.subvec(first, last) = Sb;
+        result.objective += f;
+        result.nb_iterations = std::max(result.nb_iterations, iteration);
+    }
+    result.status = maxiter_reached ? NLOPT_MAXEVAL_REACHED : NLOPT_FTOL_REACHED;
+    return result;
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_ve_coordinate() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    // Wright omega over its regimes
+    const arma::mat x = arma::vec{-800., -40., -29., -5., -1., 0., 0.5, 1., 1.5, 3., 20., 1e3, 1e8};
+    const arma::mat w = wright_omega(x);
+    check(w(0) == 0. && std::abs(w(1) - std::exp(-40.)) <= 1e-15 * std::exp(-40.), "wright omega small");
+    check(std::abs(w(5) - 0.5671432904097838) < 1e-14, "wright omega W(1)");
+    check(std::abs(w(7) - 1.) < 1e-14, "wright omega W(e)");
+    const arma::mat residual = (w + log(w) - x) / (1. + abs(x));
+    check(abs(residual.rows(1, x.n_rows - 1)).max() < 1e-13, "wright omega residual");
+
+    VeNewtonConfiguration config;
+    config.ftol_rel = 1e-14;
+    config.xtol_rel = 1e-10;
+    config.maxiter = 1000;
+    config.block_size = 7; // Several blocks, the last one incomplete
+
+    const arma::uword n = 20;
+    const arma::uword p = 5;
+    const arma::mat Z0 = arma::randn<arma::mat>(n, p);
+    const auto Y = CountMatrix::from_mat(arma::floor(3. * arma::randu<arma::mat>(n, p)));
+    const arma::mat Yd = Y.to_mat();
+
+    // Solutions must cancel the gradient and match the batched Newton solver, from a poor starting point
+    const auto omega2 = arma::vec{0.5, 1., 2., 1., 4.};
+    arma::mat M(n, p, arma::fill::zeros);
+    arma::mat S(n, p, arma::fill::ones);
+    const OptimizerResult diagonal = ve_coordinate_diagonal(Z0, Y, omega2, M, S, config);
+    arma::mat A = exp(Z0 + M + 0.5 * S % S);
+    const arma::mat W = arma::repmat(omega2.t(), n, 1);
+    check(diagonal.status == NLOPT_FTOL_REACHED, "ve coordinate diagonal status");
+    check(abs(A - Yd + W % M).max() < 1e-5 && abs(S % A + W % S - 1. / S).max() < 1e-5,
+          "ve coordinate diagonal stationarity");
+    arma::mat M_newton(n, p, arma::fill::zeros);
+    arma::mat S_newton(n, p, arma::fill::ones);
+    const OptimizerResult diagonal_newton = ve_newton_diagonal(Z0, Y, omega2, M_newton, S_newton, config);
+    check(std::abs(diagonal.objective - diagonal_newton.objective) < 1e-8 * std::abs(diagonal_newton.objective),
+          "ve coordinate diagonal objective");
+
+    const double omega = 2.;
+    M.zeros();
+    arma::vec s(n, arma::fill::ones);
+    const OptimizerResult spherical = ve_coordinate_spherical(Z0, Y, omega, M, s, config);
+    A = exp((Z0 + M).each_col() + 0.5 * s % s);
+    check(spherical.status == NLOPT_FTOL_REACHED, "ve coordinate spherical status");
+    check(abs(A - Yd + omega * M).max() < 1e-5 &&
+              abs(s % sum(A, 1) + double(p) * omega * s - double(p) / s).max() < 1e-5,
+          "ve coordinate spherical stationarity");
+    return success;
+}
+
+#endif
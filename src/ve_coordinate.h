@@ -0,0 +1,39 @@
+// Coordinate ascent solvers for the VE step of the diagonal and spherical models (ve_engine = "coordinate_ascent").
+//
+// With fixed model parameters, each coordinate of the VE problem has a cheap exact update:
+// - M given S: the stationarity condition of m_ij, exp(c_ij + m) + omega2_j m - y_ij = 0 with c = z0 + s^2/2, is
+//   solved exactly by m = y / omega2 - W(exp(c + y / omega2) / omega2), with W the Lambert W function. The argument
+//   overflows, so W(exp(x)) is computed directly as the Wright omega function of x = c + y / omega2 - log(omega2).
+// - S given M: the stationarity condition of s^2 = t is t (a exp(t / 2) + omega2) = 1, with a = exp(z0 + m) (diagonal)
+//   or the row mean of exp(z0 + m) (spherical). Its left side is increasing and convex in t, so Newton steps started
+//   from the upper bound 1 / (a + omega2) of the root decrease monotonically to it.
+// Both updates are elementwise passes over blocks of rows (see VeNewtonConfiguration::block_size), alternated until
+// the objective of the block changes by less than ftol_rel (relative), or for maxiter passes. xtol_rel is not used.
+#pragma once
+
+#include "arma_backend.h"
+
+#include "data.h"
+#include "nlopt_wrapper.h" // OptimizerResult
+#include "ve_newton.h"     // VeNewtonConfiguration
+
+// W(exp(x)) elementwise: solution w of w + log(w) = x
+arma::mat wright_omega(const arma::mat & x);
+
+// Same problem and conventions as ve_newton_diagonal (see ve_newton.h)
+OptimizerResult ve_coordinate_diagonal(
+    const arma::mat & Z0,
+    const CountMatrix & Y,
+    const arma::vec & omega2,
+    arma::mat & M,
+    arma::mat & S,
+    const VeNewtonConfiguration & config);
+
+// Same problem and conventions as ve_newton_spherical (see ve_newton.h)
+OptimizerResult ve_coordinate_spherical(
+    const arma::mat & Z0,
+    const CountMatrix & Y,
+    double omega2,
+    arma::mat & M,
+    arma::vec & S,
+    const VeNewtonConfiguration & config);
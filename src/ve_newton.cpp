@@ -0,0 +1,281 @@
+#include "ve_newton.h"
+
+#include <algorithm> // min
+#include <stdexcept>
+
+#include "trace.h"
+
+// ---------------------------------------------------------------------------------------
+// Common parts of the iteration
+
+// Newton steps are damped by backtracking until the Armijo condition holds, lane by lane.
+// Lanes whose step is still rejected after max_backtracks halvings are stopped (roundoff).
+static const double armijo_c1 = 1e-4;
+static const int max_backtracks = 30;
+
+// Largest step in (0, 1] along dS keeping S positive (with a margin), for each lane
+template <typename T> static T positive_step_limit(const T & S, const T & dS) {
+    T step = S;
+    step.ones();
+    const arma::uvec decreasing = find(dS < 0.);
+    step.elem(decreasing) = arma::clamp(-0.99 * S.elem(decreasing) / dS.elem(decreasing), 0., 1.);
+    return step;
+}
+
+// Status from the block outcomes, by decreasing severity
+struct BlockStatus {
+    bool maxiter_reached = false;
+    bool stalled = false;
+
+    nlopt_result status() const {
+        if(maxiter_reached) {
+            return NLOPT_MAXEVAL_REACHED;
+        } else if(stalled) {
+            return NLOPT_ROUNDOFF_LIMITED;
+        } else {
+            return NLOPT_FTOL_REACHED;
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------
+// Diagonal: one lane per element (i,j) of a block of rows
+
+OptimizerResult ve_newton_diagonal(
+    const arma::mat & Z0,
+    const CountMatrix & Y,
+    const arma::vec & omega2,
+    arma::mat & M,
+    arma::mat & S,
+    const VeNewtonConfiguration & config //
+) {
+    const arma::uword n = Y.n_rows;
+    const arma::uword p = Y.n_cols;
+    if(!(Z0.n_rows == n && Z0.n_cols == p && M.n_rows == n && M.n_cols == p && S.n_rows == n && S.n_cols == p &&
+         omega2.n_elem == p)) {
+        throw std::invalid_argument("ve_newton_diagonal: dimension mismatch");
+    }
+    BlockStatus block_status;
+    OptimizerResult result = {NLOPT_FTOL_REACHED, 0., 0};
+
+    for(arma::uword first = 0; first < n; first += config.block_size) {
+        PLNMODELS_TRACE_SPAN("ve_newton_block", "kernel");
+        const arma::uword last = std::min(n, first + config.block_size) - 1;
+        const arma::mat Yb = Y.to_mat(first, last);
+        const arma::mat Z0b = Z0.rows(first, last);
+        const arma::mat W = arma::repmat(omega2.t(), Yb.n_rows, 1);
+        arma::mat Mb = M.rows(first, last);
+        arma::mat Sb = S.rows(first, last);
+
+        auto objective = [&Yb, &Z0b, &W](const arma::mat & Mt, const arma::mat & St) -> arma::mat {
+            const arma::mat Zt = Z0b + Mt;
+            const arma::mat S2 = St % St;
+            return exp(Zt + 0.5 * S2) - Yb % Zt + 0.5 * W % (Mt % Mt + S2) - log(St);
+        };
+        arma::mat f = objective(Mb, Sb);
+        arma::umat active(arma::size(Mb), arma::fill::ones);
+
+        int iteration = 0;
+        for(; iteration < config.maxiter && active.max() > 0; iteration += 1) {
+            // Gradient and 2x2 Hessian of each lane, Newton step by Cramer's rule (the Hessian is positive definite)
+            const arma::mat S2 = Sb % Sb;
+            const arma::mat A = exp(Z0b + Mb + 0.5 * S2);
+            const arma::mat gm = A - Yb + W % Mb;
+            const arma::mat gs = Sb % A + W % Sb - 1. / Sb;
+            const arma::mat hmm = A + W;
+            const arma::mat hms = Sb % A;
+            const arma::mat hss = A % (1. + S2) + W + 1. / S2;
+            const arma::mat det = hmm % hss - hms % hms;
+            arma::mat dm = (hms % gs - hss % gm) / det;
+            arma::mat ds = (hms % gm - hmm % gs) / det;
+            const arma::uvec inactive = find(active == 0);
+            dm.elem(inactive).zeros();
+            ds.elem(inactive).zeros();
+            const arma::mat slope = gm % dm + gs % ds;
+
+            arma::mat step = positive_step_limit(Sb, ds);
+            arma::umat pending = active;
+            for(int backtrack = 0; backtrack <= max_backtracks && pending.max() > 0; backtrack += 1) {
+                const arma::mat Mt = Mb + step % dm;
+                const arma::mat St = Sb + step % ds;
+                const arma::mat ft = objective(Mt, St);
+                const arma::uvec accepted = find(pending % (ft <= f + armijo_c1 * step % slope));
+
+                const arma::vec Ma = Mt.elem(accepted);
+                const arma::vec Sa = St.elem(accepted);
+                const arma::vec fa = ft.elem(accepted);
+                const arma::uvec small_change = abs(Ma - Mb.elem(accepted)) <= config.xtol_rel * abs(Ma) &&
+                                                abs(Sa - Sb.elem(accepted)) <= config.xtol_rel * Sa;
+                const arma::uvec converged =
+                    accepted(find(abs(f.elem(accepted) - fa) <= config.ftol_rel * abs(fa) || small_change));
+                Mb.elem(accepted) = Ma;
+                Sb.elem(accepted) = Sa;
+                f.elem(accepted) = fa;
+                active.elem(converged).zeros();
+                pending.elem(accepted).zeros();
+                step.elem(find(pending)) *= 0.5;
+            }
+            const arma::uvec stalled = find(pending);
+            if(!stalled.is_empty()) {
+                block_status.stalled = true;
+                active.elem(stalled).zeros();
+            }
+        }
+        if(active.max() > 0) {
+            block_status.maxiter_reached = true;
+        }
+        M.rows(first, last) = Mb;
+        S.rows(first, last) = Sb;
+        result.objective += accu(f);
+        result.nb_iterations = std::max(result.nb_iterations, iteration);
+    }
+    result.status = block_status.status();
+    return result;
+}
+
+// ---------------------------------------------------------------------------------------
+// Spherical: one lane per row of a block
+
+OptimizerResult ve_newton_spherical(
+    const arma::mat & Z0,
+    const CountMatrix & Y,
+    double omega2,
+    arma::mat & M,
+    arma::vec & S,
+    const VeNewtonConfiguration & config //
+) {
+    const arma::uword n = Y.n_rows;
+    const arma::uword p = Y.n_cols;
+    if(!(Z0.n_rows == n && Z0.n_cols == p && M.n_rows == n && M.n_cols == p && S.n_elem == n)) {
+        throw std::invalid_argument("ve_newton_spherical: dimension mismatch");
+    }
+    const double dp = double(p);
+    BlockStatus block_status;
+    OptimizerResult result = {NLOPT_FTOL_REACHED, 0., 0};
+
+    for(arma::uword first = 0; first < n; first += config.block_size) {
+        PLNMODELS_TRACE_SPAN("ve_newton_block", "kernel");
+        const arma::uword last = std::min(n, first + config.block_size) - 1;
+        const arma::mat Yb = Y.to_mat(first, last);
+        const arma::mat Z0b = Z0.rows(first, last);
+        arma::mat Mb = M.rows(first, last);
+        arma::vec Sb = S.subvec(first, last);
+
+        auto objective = [&Yb, &Z0b, omega2, dp](const arma::mat & Mt, const arma::vec & St) -> arma::vec {
+            const arma::mat Zt = Z0b + Mt;
+            const arma::vec S2 = St % St;
+            const arma::mat A = exp(Zt.each_col() + 0.5 * S2);
+            return sum(A - Yb % Zt + 0.5 * omega2 * Mt % Mt, 1) + 0.5 * dp * omega2 * S2 - dp * log(St);
+        };
+        arma::vec f = objective(Mb, Sb);
+        arma::uvec active(Mb.n_rows, arma::fill::ones);
+
+        int iteration = 0;
+        for(; iteration < config.maxiter && active.max() > 0; iteration += 1) {
+            // Arrow Hessian [diag(D) h; h' hss], Newton step by elimination of the diagonal block
+            const arma::vec S2 = Sb % Sb;
+            const arma::mat A = exp((Z0b + Mb).each_col() + 0.5 * S2);
+            const arma::vec sum_A = sum(A, 1);
+            const arma::mat gm = A - Yb + omega2 * Mb;
+            const arma::vec gs = Sb % sum_A + dp * omega2 * Sb - dp / Sb;
+            const arma::mat D = A + omega2;
+            const arma::mat h = A.each_col() % Sb;
+            const arma::vec hss = (1. + S2) % sum_A + dp * omega2 + dp / S2;
+            arma::vec ds = (sum(h % gm / D, 1) - gs) / (hss - sum(h % h / D, 1));
+            arma::mat dm = -(gm + h.each_col() % ds) / D;
+            const arma::uvec inactive = find(active == 0);
+            dm.rows(inactive).zeros();
+            ds.elem(inactive).zeros();
+            const arma::vec slope = sum(gm % dm, 1) + gs % ds;
+
+            arma::vec step = positive_step_limit(Sb, ds);
+            arma::uvec pending = active;
+            for(int backtrack = 0; backtrack <= max_backtracks && pending.max() > 0; backtrack += 1) {
+                const arma::mat Mt = Mb + dm.each_col() % step;
+                const arma::vec St = Sb + step % ds;
+                const arma::vec ft = objective(Mt, St);
+                const arma::uvec accepted = find(pending % (ft <= f + armijo_c1 * step % slope));
+
+                const arma::mat Ma = Mt.rows(accepted);
+                const arma::vec Sa = St.elem(accepted);
+                const arma::uvec small_change =
+                    all(abs(Ma - Mb.rows(accepted)) <= config.xtol_rel * abs(Ma), 1) &&
+                    abs(Sa - Sb.elem(accepted)) <= config.xtol_rel * Sa;
+                const arma::vec fa = ft.elem(accepted);
+                const arma::uvec converged =
+                    accepted(find(abs(f.elem(accepted) - fa) <= config.ftol_rel * abs(fa) || small_change));
+                Mb.rows(accepted) = Ma;
+                Sb.elem(accepted) = Sa;
+                f.elem(accepted) = fa;
+                active.elem(converged).zeros();
+                pending.elem(accepted).zeros();
+                step.elem(find(pending)) *= 0.5;
+            }
+            const arma::uvec stalled = find(pending);
+            if(!stalled.is_empty()) {
+                block_status.stalled = true;
+                active.elem(stalled).zeros();
+            }
+        }
+        if(active.max() > 0) {
+            block_status.maxiter_reached = true;
+        }
+        M.rows(first, last) = Mb;
+        S.subvec(first, last) = Sb;
+        result.objective += accu(f);
+        result.nb_iterations = std::max(result.nb_iterations, iteration);
+    }
+    result.status = block_status.status();
+    return result;
+}
+
+#ifndef PLNMODELS_STANDALONE // R utilities and self tests
+// ---------------------------------------------------------------------------------------
+// sanity test
+
+// [[Rcpp::export]]
+bool cpp_test_ve_newton() {
+    bool success = true;
+    auto check = [&success](bool check_value, const char * context) {
+        if(!check_value) {
+            REprintf("Cpp internals failed: %s", context);
+            success = false;
+        }
+    };
+    VeNewtonConfiguration config;
+    config.ftol_rel = 1e-12;
+    config.xtol_rel = 1e-10;
+    config.maxiter = 100;
+    config.block_size = 7; // Several blocks, the last one incomplete
+
+    const arma::uword n = 20;
+    const arma::uword p = 5;
+    const arma::mat Z0 = arma::randn<arma::mat>(n, p);
+    const auto Y = CountMatrix::from_mat(arma::floor(3. * arma::randu<arma::mat>(n, p)));
+    const arma::mat Yd = Y.to_mat();
+    check(arma::approx_equal(Y.to_mat(7, 13), Yd.rows(7, 13), "absdiff", 0.), "to_mat row range");
+
+    // Solutions must cancel the gradient, from a poor starting point
+    const auto omega2 = arma::vec{0.5, 1., 2., 1., 4.};
+    arma::mat M(n, p, arma::fill::zeros);
+    arma::mat S(n, p, arma::fill::ones);
+    const OptimizerResult diagonal = ve_newton_diagonal(Z0, Y, omega2, M, S, config);
+    arma::mat A = exp(Z0 + M + 0.5 * S % S);
+    const arma::mat W = arma::repmat(omega2.t(), n, 1);
+    check(diagonal.status == NLOPT_FTOL_REACHED, "ve newton diagonal status");
+    check(abs(A - Yd + W % M).max() < 1e-6 && abs(S % A + W % S - 1. / S).max() < 1e-6,
+          "ve newton diagonal stationarity");
+
+    const double omega = 2.;
+    M.zeros();
+    arma::vec s(n, arma::fill::ones);
+    const OptimizerResult spherical = ve_newton_spherical(Z0, Y, omega, M, s, config);
+    A = exp((Z0 + M).each_col() + 0.5 * s % s);
+    check(spherical.status == NLOPT_FTOL_REACHED, "ve newton spherical status");
+    check(abs(A - Yd + omega * M).max() < 1e-6 &&
+              abs(s % sum(A, 1) + double(p) * omega * s - double(p) / s).max() < 1e-6,
+          "ve newton spherical stationarity");
+    return success;
+}
+
+#endif
@@ -0,0 +1,67 @@
+// Batched Newton solvers for the VE step of the diagonal and spherical models.
+//
+// With fixed model parameters, the VE step decouples into independent problems per row (spherical) or per element
+// (diagonal), each of them tiny. Instead of packing all of them into one large nlopt problem, these solvers run the
+// same Newton iteration on many problems at once: values of a block of rows are stored column-major (rows, p), so
+// each operation runs over contiguous values of independent problems (structure of arrays) and vectorizes across
+// problems. Converged problems are masked by a zero step, keeping all lanes in lockstep.
+#pragma once
+
+#include "arma_backend.h"
+#include <nlopt.h> // nlopt_result
+
+#include <stdexcept>
+#include <string>
+
+#include "data.h"
+#include "nlopt_wrapper.h" // OptimizerResult
+
+// Solver used for the VE step
+enum class VeEngine { Nlopt, BatchedNewton, CoordinateAscent }; // CoordinateAscent: see ve_coordinate.h
+
+// From its name in configuration["ve_engine"]: "nlopt", "batched_newton" or "coordinate_ascent"
+inline VeEngine ve_engine_from_name(const std::string & name) {
+    if(name == "nlopt") {
+        return VeEngine::Nlopt;
+    } else if(name == "batched_newton") {
+        return VeEngine::BatchedNewton;
+    } else if(name == "coordinate_ascent") {
+        return VeEngine::CoordinateAscent;
+    } else {
+        throw std::invalid_argument(
+            "unsupported config[ve_engine]: must be \"nlopt\", \"batched_newton\" or \"coordinate_ascent\"");
+    }
+}
+
+struct VeNewtonConfiguration {
+    double ftol_rel;        // A problem has converged when its objective changes by less than ftol_rel * |f|
+    double xtol_rel;        // ... or when all its parameters change by less than xtol_rel * |x|
+    int maxiter;            // Maximum number of Newton iterations
+    arma::uword block_size; // Number of rows processed together
+};
+
+// Diagonal model, elementwise problems:
+//   min_{m,s} exp(z0 + m + s^2/2) - y (z0 + m) + omega2_j (m^2 + s^2) / 2 - log(s)
+// Z0 = O + X Theta' (n,p) is the fixed part of the linear predictor, omega2 (p) the diagonal of Omega.
+// M and S (n,p) are used as initial values and updated in place.
+// Status is NLOPT_FTOL_REACHED if all problems converged, NLOPT_MAXEVAL_REACHED otherwise.
+// nb_iterations is the largest number of Newton iterations over blocks.
+OptimizerResult ve_newton_diagonal(
+    const arma::mat & Z0,
+    const CountMatrix & Y,
+    const arma::vec & omega2,
+    arma::mat & M,
+    arma::mat & S,
+    const VeNewtonConfiguration & config);
+
+// Spherical model, row problems:
+//   min_{m,s} sum_j [exp(z0_j + m_j + s^2/2) - y_j (z0_j + m_j) + omega2 m_j^2 / 2] + p omega2 s^2 / 2 - p log(s)
+// The Hessian is an arrow matrix (diagonal in m, plus a dense row and column for s), solved in O(p).
+// M (n,p) and S (n) are used as initial values and updated in place.
+OptimizerResult ve_newton_spherical(
+    const arma::mat & Z0,
+    const CountMatrix & Y,
+    double omega2,
+    arma::mat & M,
+    arma::vec & S,
+    const VeNewtonConfiguration & config);